@@ -0,0 +1,575 @@
+/*
+ * corpus.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * corpus.c is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * corpus.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "corpus.h"
+
+#include <glib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sci-log.h"
+
+/*
+ * The data file is a sequence of entries, each made up of a header, the normalized doi, a binary DocumentMeta record
+ * as written by document_meta_get_binary() and the pdf. All integers in the header are little endian:
+ * magic "SCIE", u32 doi length, u32 record length, u32 reserved, u64 pdf length
+ *
+ * The index file is a open addressing hash table over the normalized dois that is mapped into memory.
+ * It is only a cache of the data file, if it is missing, out of date or damaged it is rebuilt from the data file.
+ */
+#define CORPUS_DATA_FILE "corpus.dat"
+#define CORPUS_INDEX_FILE "corpus.idx"
+#define CORPUS_ENTRY_MAGIC "SCIE"
+#define CORPUS_ENTRY_HEADER_SIZE 24
+#define CORPUS_INDEX_MAGIC "SCIX"
+#define CORPUS_INDEX_VERSION 1
+#define CORPUS_INDEX_MIN_CAPACITY 1024
+#define CORPUS_FOREACH_BATCH 256
+
+struct CorpusIndexHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t capacity;
+	uint64_t count;
+	uint64_t indexedLength; // the data file up to here is contained in the index
+};
+
+struct CorpusSlot
+{
+	uint64_t hash;
+	uint64_t offset; // offset of the entry in the data file + 1, 0 for empty slots
+};
+
+struct CorpusEntry
+{
+	const char* doi;
+	size_t doiLength;
+	const char* record;
+	size_t recordLength;
+	const unsigned char* pdf;
+	size_t pdfLength;
+	size_t length;
+};
+
+struct _SciCorpus
+{
+	char* dataFileName;
+	char* indexFileName;
+	FILE* dataFile;
+	size_t dataLength;
+
+	const char* data;
+	size_t mappedLength;
+
+	int indexFd;
+	struct CorpusIndexHeader* index;
+	size_t indexSize;
+};
+
+static inline struct CorpusSlot* corpus_slots(struct CorpusIndexHeader* index)
+{
+	return (struct CorpusSlot*)(index + 1);
+}
+
+static uint64_t corpus_read_uint(const unsigned char* data, size_t bytes)
+{
+	uint64_t value = 0;
+	for(size_t i = 0; i < bytes; ++i)
+		value |= (uint64_t)data[i] << (8*i);
+	return value;
+}
+
+static void corpus_write_uint(unsigned char* data, uint64_t value, size_t bytes)
+{
+	for(size_t i = 0; i < bytes; ++i)
+		data[i] = (value >> (8*i)) & 0xFF;
+}
+
+static uint64_t corpus_hash(const char* doi, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < length; ++i)
+	{
+		hash ^= (unsigned char)doi[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Returns a newly allocated copy of doi without resolver prefixes and surrounding whitespace in lower case */
+static char* corpus_normalize_doi(const char* doi)
+{
+	static const char* const prefixes[] = {
+		"https://doi.org/", "http://doi.org/", "https://dx.doi.org/", "http://dx.doi.org/", "doi:"
+	};
+
+	if(!doi)
+		return NULL;
+
+	while(g_ascii_isspace(*doi))
+		++doi;
+	for(size_t i = 0; i < G_N_ELEMENTS(prefixes); ++i)
+	{
+		size_t prefixLength = strlen(prefixes[i]);
+		if(g_ascii_strncasecmp(doi, prefixes[i], prefixLength) == 0)
+		{
+			doi += prefixLength;
+			break;
+		}
+	}
+
+	char* normalized = g_ascii_strdown(doi, -1);
+	g_strchomp(normalized);
+	if(*normalized == '\0')
+	{
+		g_free(normalized);
+		return NULL;
+	}
+	return normalized;
+}
+
+static bool corpus_map_data(SciCorpus* corpus)
+{
+	if(corpus->mappedLength == corpus->dataLength)
+		return true;
+
+	if(corpus->data)
+		munmap((void*)corpus->data, corpus->mappedLength);
+	corpus->data = NULL;
+	corpus->mappedLength = 0;
+
+	if(corpus->dataLength == 0)
+		return true;
+
+	void* data = mmap(NULL, corpus->dataLength, PROT_READ, MAP_SHARED, fileno(corpus->dataFile), 0);
+	if(data == MAP_FAILED)
+	{
+		sci_log(LL_ERR, "%s: Could not map %s: %s", __func__, corpus->dataFileName, g_strerror(errno));
+		return false;
+	}
+	corpus->data = data;
+	corpus->mappedLength = corpus->dataLength;
+	return true;
+}
+
+static bool corpus_read_entry(const SciCorpus* corpus, size_t offset, struct CorpusEntry* entry)
+{
+	if(offset > corpus->mappedLength || corpus->mappedLength - offset < CORPUS_ENTRY_HEADER_SIZE)
+		return false;
+
+	const unsigned char* header = (const unsigned char*)corpus->data + offset;
+	if(memcmp(header, CORPUS_ENTRY_MAGIC, 4) != 0)
+		return false;
+
+	size_t available = corpus->mappedLength - offset - CORPUS_ENTRY_HEADER_SIZE;
+	entry->doiLength = corpus_read_uint(header + 4, 4);
+	entry->recordLength = corpus_read_uint(header + 8, 4);
+	entry->pdfLength = corpus_read_uint(header + 16, 8);
+	if(entry->doiLength > available || entry->recordLength > available - entry->doiLength ||
+		entry->pdfLength > available - entry->doiLength - entry->recordLength)
+		return false;
+
+	entry->doi = (const char*)header + CORPUS_ENTRY_HEADER_SIZE;
+	entry->record = entry->doi + entry->doiLength;
+	entry->pdf = entry->pdfLength ? (const unsigned char*)entry->record + entry->recordLength : NULL;
+	entry->length = CORPUS_ENTRY_HEADER_SIZE + entry->doiLength + entry->recordLength + entry->pdfLength;
+	return true;
+}
+
+static bool corpus_index_map(SciCorpus* corpus, size_t capacity, bool create)
+{
+	size_t size = sizeof(struct CorpusIndexHeader) + capacity*sizeof(struct CorpusSlot);
+	if(create && ftruncate(corpus->indexFd, size) != 0)
+	{
+		sci_log(LL_ERR, "%s: Could not resize %s: %s", __func__, corpus->indexFileName, g_strerror(errno));
+		return false;
+	}
+
+	void* index = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, corpus->indexFd, 0);
+	if(index == MAP_FAILED)
+	{
+		sci_log(LL_ERR, "%s: Could not map %s: %s", __func__, corpus->indexFileName, g_strerror(errno));
+		return false;
+	}
+	corpus->index = index;
+	corpus->indexSize = size;
+
+	if(create)
+	{
+		memset(corpus->index, 0, size);
+		memcpy(corpus->index->magic, CORPUS_INDEX_MAGIC, 4);
+		corpus->index->version = CORPUS_INDEX_VERSION;
+		corpus->index->capacity = capacity;
+	}
+	return true;
+}
+
+static void corpus_index_unmap(SciCorpus* corpus)
+{
+	if(corpus->index)
+		munmap(corpus->index, corpus->indexSize);
+	corpus->index = NULL;
+	corpus->indexSize = 0;
+}
+
+static void corpus_index_put(struct CorpusIndexHeader* index, uint64_t hash, uint64_t offset)
+{
+	struct CorpusSlot* slots = corpus_slots(index);
+	size_t mask = index->capacity - 1;
+	size_t i = hash & mask;
+	while(slots[i].offset)
+		i = (i + 1) & mask;
+	slots[i].hash = hash;
+	slots[i].offset = offset + 1;
+	++index->count;
+}
+
+/* Doubles the capacity of the index, the new table is built next to the old one and then renamed over it */
+static bool corpus_index_grow(SciCorpus* corpus)
+{
+	char* tmpFileName = g_strconcat(corpus->indexFileName, ".tmp", NULL);
+	int fd = open(tmpFileName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if(fd < 0)
+	{
+		sci_log(LL_ERR, "%s: Could not create %s: %s", __func__, tmpFileName, g_strerror(errno));
+		g_free(tmpFileName);
+		return false;
+	}
+
+	SciCorpus grown = *corpus;
+	grown.indexFd = fd;
+	if(!corpus_index_map(&grown, corpus->index->capacity*2, true))
+	{
+		close(fd);
+		unlink(tmpFileName);
+		g_free(tmpFileName);
+		return false;
+	}
+
+	struct CorpusSlot* slots = corpus_slots(corpus->index);
+	for(size_t i = 0; i < corpus->index->capacity; ++i)
+	{
+		if(slots[i].offset)
+			corpus_index_put(grown.index, slots[i].hash, slots[i].offset - 1);
+	}
+	grown.index->indexedLength = corpus->index->indexedLength;
+
+	if(rename(tmpFileName, corpus->indexFileName) != 0)
+	{
+		sci_log(LL_ERR, "%s: Could not replace %s: %s", __func__, corpus->indexFileName, g_strerror(errno));
+		corpus_index_unmap(&grown);
+		close(fd);
+		unlink(tmpFileName);
+		g_free(tmpFileName);
+		return false;
+	}
+	g_free(tmpFileName);
+
+	corpus_index_unmap(corpus);
+	close(corpus->indexFd);
+	corpus->indexFd = fd;
+	corpus->index = grown.index;
+	corpus->indexSize = grown.indexSize;
+	return true;
+}
+
+/* Returns the slot holding doi or the empty slot where it would be inserted */
+static struct CorpusSlot* corpus_index_find(SciCorpus* corpus, const char* doi, size_t doiLength, uint64_t hash)
+{
+	struct CorpusSlot* slots = corpus_slots(corpus->index);
+	size_t mask = corpus->index->capacity - 1;
+	for(size_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		if(!slots[i].offset)
+			return &slots[i];
+		if(slots[i].hash != hash)
+			continue;
+
+		// entries are only mapped once they are needed for a comparison
+		if(slots[i].offset > corpus->mappedLength && !corpus_map_data(corpus))
+			continue;
+
+		struct CorpusEntry entry;
+		if(corpus_read_entry(corpus, slots[i].offset - 1, &entry) &&
+			entry.doiLength == doiLength && memcmp(entry.doi, doi, doiLength) == 0)
+			return &slots[i];
+	}
+}
+
+static bool corpus_index_insert(SciCorpus* corpus, const char* doi, size_t doiLength, size_t offset)
+{
+	if((corpus->index->count + 1)*10 > corpus->index->capacity*7 && !corpus_index_grow(corpus))
+		return false;
+
+	uint64_t hash = corpus_hash(doi, doiLength);
+	struct CorpusSlot* slot = corpus_index_find(corpus, doi, doiLength, hash);
+	if(slot->offset)
+	{
+		slot->offset = offset + 1;
+	}
+	else
+	{
+		slot->hash = hash;
+		slot->offset = offset + 1;
+		++corpus->index->count;
+	}
+	return true;
+}
+
+/* Adds the entries of the data file that are not yet in the index, a damaged tail left by an interrupted write is cut off */
+static bool corpus_index_catch_up(SciCorpus* corpus)
+{
+	if(corpus->index->indexedLength > corpus->dataLength)
+	{
+		sci_log(LL_WARN, "%s: %s is newer than the data, rebuilding it", __func__, corpus->indexFileName);
+		corpus_index_unmap(corpus);
+		if(!corpus_index_map(corpus, CORPUS_INDEX_MIN_CAPACITY, true))
+			return false;
+	}
+
+	if(!corpus_map_data(corpus))
+		return false;
+
+	size_t offset = corpus->index->indexedLength;
+	if(offset < corpus->dataLength)
+		sci_log(LL_DEBUG, "%s: indexing %zu bytes of %s", __func__, corpus->dataLength - offset, corpus->dataFileName);
+
+	struct CorpusEntry entry;
+	while(offset < corpus->dataLength && corpus_read_entry(corpus, offset, &entry))
+	{
+		if(entry.doiLength && !corpus_index_insert(corpus, entry.doi, entry.doiLength, offset))
+			return false;
+		offset += entry.length;
+		corpus->index->indexedLength = offset;
+	}
+
+	if(offset < corpus->dataLength)
+	{
+		sci_log(LL_WARN, "%s: %s has a damaged tail of %zu bytes, removing it", __func__,
+				corpus->dataFileName, corpus->dataLength - offset);
+		if(ftruncate(fileno(corpus->dataFile), offset) != 0)
+		{
+			sci_log(LL_ERR, "%s: Could not truncate %s: %s", __func__, corpus->dataFileName, g_strerror(errno));
+			return false;
+		}
+		corpus->dataLength = offset;
+		return corpus_map_data(corpus);
+	}
+	return true;
+}
+
+SciCorpus* sci_corpus_open(const char* directory)
+{
+	if(g_mkdir_with_parents(directory, 0777) != 0)
+	{
+		sci_log(LL_ERR, "%s: Could not create %s: %s", __func__, directory, g_strerror(errno));
+		return NULL;
+	}
+
+	SciCorpus* corpus = g_malloc0(sizeof(*corpus));
+	corpus->indexFd = -1;
+	corpus->dataFileName = g_build_filename(directory, CORPUS_DATA_FILE, NULL);
+	corpus->indexFileName = g_build_filename(directory, CORPUS_INDEX_FILE, NULL);
+
+	corpus->dataFile = fopen(corpus->dataFileName, "ab+");
+	if(!corpus->dataFile || fseek(corpus->dataFile, 0, SEEK_END) != 0)
+	{
+		sci_log(LL_ERR, "%s: Could not open %s: %s", __func__, corpus->dataFileName, g_strerror(errno));
+		sci_corpus_close(corpus);
+		return NULL;
+	}
+	corpus->dataLength = ftell(corpus->dataFile);
+
+	corpus->indexFd = open(corpus->indexFileName, O_RDWR | O_CREAT, 0666);
+	if(corpus->indexFd < 0)
+	{
+		sci_log(LL_ERR, "%s: Could not open %s: %s", __func__, corpus->indexFileName, g_strerror(errno));
+		sci_corpus_close(corpus);
+		return NULL;
+	}
+
+	struct stat indexStat;
+	struct CorpusIndexHeader header;
+	bool valid = fstat(corpus->indexFd, &indexStat) == 0 &&
+		pread(corpus->indexFd, &header, sizeof(header), 0) == sizeof(header) &&
+		memcmp(header.magic, CORPUS_INDEX_MAGIC, 4) == 0 && header.version == CORPUS_INDEX_VERSION &&
+		header.capacity >= CORPUS_INDEX_MIN_CAPACITY && (header.capacity & (header.capacity - 1)) == 0 &&
+		(size_t)indexStat.st_size == sizeof(header) + header.capacity*sizeof(struct CorpusSlot);
+	if(!valid && indexStat.st_size > 0)
+		sci_log(LL_WARN, "%s: %s is invalid, rebuilding it", __func__, corpus->indexFileName);
+
+	if(!corpus_index_map(corpus, valid ? header.capacity : CORPUS_INDEX_MIN_CAPACITY, !valid) ||
+		!corpus_index_catch_up(corpus))
+	{
+		sci_corpus_close(corpus);
+		return NULL;
+	}
+
+	sci_log(LL_DEBUG, "%s: opened %s with %zu documents", __func__, directory, (size_t)corpus->index->count);
+	return corpus;
+}
+
+void sci_corpus_close(SciCorpus* corpus)
+{
+	if(!corpus)
+		return;
+
+	if(corpus->data)
+		munmap((void*)corpus->data, corpus->mappedLength);
+	corpus_index_unmap(corpus);
+	if(corpus->indexFd >= 0)
+		close(corpus->indexFd);
+	if(corpus->dataFile)
+		fclose(corpus->dataFile);
+	g_free(corpus->dataFileName);
+	g_free(corpus->indexFileName);
+	g_free(corpus);
+}
+
+bool sci_corpus_add(SciCorpus* corpus, const DocumentMeta* meta, const char* fullText, const unsigned char* pdf, size_t pdfLength)
+{
+	size_t recordLength;
+	char* record = document_meta_get_binary(meta, fullText, &recordLength);
+	if(!record)
+		return false;
+
+	char* doi = corpus_normalize_doi(meta->doi);
+	size_t doiLength = doi ? strlen(doi) : 0;
+	if(!pdf)
+		pdfLength = 0;
+
+	unsigned char header[CORPUS_ENTRY_HEADER_SIZE] = {0};
+	memcpy(header, CORPUS_ENTRY_MAGIC, 4);
+	corpus_write_uint(header + 4, doiLength, 4);
+	corpus_write_uint(header + 8, recordLength, 4);
+	corpus_write_uint(header + 16, pdfLength, 8);
+
+	size_t offset = corpus->dataLength;
+	bool ret = fwrite(header, 1, sizeof(header), corpus->dataFile) == sizeof(header) &&
+		(!doi || fwrite(doi, 1, doiLength, corpus->dataFile) == doiLength) &&
+		fwrite(record, 1, recordLength, corpus->dataFile) == recordLength &&
+		(!pdf || fwrite(pdf, 1, pdfLength, corpus->dataFile) == pdfLength) &&
+		fflush(corpus->dataFile) == 0;
+	g_free(record);
+
+	if(!ret)
+	{
+		sci_log(LL_ERR, "%s: Could not write to %s: %s", __func__, corpus->dataFileName, g_strerror(errno));
+		// keep the data file parseable by removeing whatever part of the entry made it to disk
+		if(ftruncate(fileno(corpus->dataFile), offset) != 0)
+			sci_log(LL_ERR, "%s: Could not truncate %s: %s", __func__, corpus->dataFileName, g_strerror(errno));
+		g_free(doi);
+		return false;
+	}
+
+	corpus->dataLength += sizeof(header) + doiLength + recordLength + pdfLength;
+	if(doi)
+	{
+		ret = corpus_index_insert(corpus, doi, doiLength, offset);
+		g_free(doi);
+		if(!ret)
+			return false;
+	}
+	corpus->index->indexedLength = corpus->dataLength;
+	return true;
+}
+
+static bool corpus_lookup(SciCorpus* corpus, const char* doi, struct CorpusEntry* entry)
+{
+	char* normalized = corpus_normalize_doi(doi);
+	if(!normalized || !corpus_map_data(corpus))
+	{
+		g_free(normalized);
+		return false;
+	}
+
+	size_t doiLength = strlen(normalized);
+	struct CorpusSlot* slot = corpus_index_find(corpus, normalized, doiLength, corpus_hash(normalized, doiLength));
+	g_free(normalized);
+	return slot->offset && corpus_read_entry(corpus, slot->offset - 1, entry);
+}
+
+DocumentMeta* sci_corpus_find_by_doi(SciCorpus* corpus, const char* doi, char** fullText)
+{
+	if(fullText)
+		*fullText = NULL;
+
+	struct CorpusEntry entry;
+	if(!corpus_lookup(corpus, doi, &entry))
+		return NULL;
+	return document_meta_load_from_binary(entry.record, entry.recordLength, fullText);
+}
+
+PdfData* sci_corpus_get_pdf(SciCorpus* corpus, const char* doi)
+{
+	struct CorpusEntry entry;
+	if(!corpus_lookup(corpus, doi, &entry) || !entry.pdf)
+		return NULL;
+
+	PdfData* pdf = g_malloc0(sizeof(*pdf));
+	pdf->meta = document_meta_load_from_binary(entry.record, entry.recordLength, NULL);
+	pdf->data = g_memdup2(entry.pdf, entry.pdfLength);
+	pdf->length = entry.pdfLength;
+	return pdf;
+}
+
+size_t sci_corpus_foreach(SciCorpus* corpus, sci_corpus_foreach_fn fn, void* userData)
+{
+	if(!corpus_map_data(corpus))
+		return 0;
+
+	// the metas are views into the mapped data file, a fresh arena every few documents keeps the memory used bounded
+	SciArena* arena = NULL;
+	size_t count = 0;
+	size_t offset = 0;
+	struct CorpusEntry entry;
+	while(offset < corpus->mappedLength && corpus_read_entry(corpus, offset, &entry))
+	{
+		offset += entry.length;
+
+		if(count % CORPUS_FOREACH_BATCH == 0)
+		{
+			sci_arena_unref(arena);
+			arena = sci_arena_new();
+		}
+
+		const char* fullText;
+		DocumentMeta* meta = document_meta_view_binary(arena, entry.record, entry.recordLength, NULL, &fullText);
+		if(!meta)
+			continue;
+
+		++count;
+		bool next = fn(meta, fullText, entry.pdf, entry.pdfLength, userData);
+		document_meta_unref(meta);
+		if(!next)
+			break;
+	}
+	sci_arena_unref(arena);
+	return count;
+}
+
+size_t sci_corpus_get_count(const SciCorpus* corpus)
+{
+	return corpus->index->count;
+}
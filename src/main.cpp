@@ -19,6 +19,7 @@
 
 #include <iostream>
 #include <scipaper/scipaper.h>
+#include <scipaper/corpus.h>
 #include <algorithm>
 #include <cassert>
 #include <fstream>
@@ -47,6 +48,35 @@ static void saveBiblatex(const DocumentMeta* meta, const std::filesystem::path&
 	free(biblatex);
 }
 
+static void addToCorpus(SciCorpus* corpus, DocumentMeta* meta, bool savePdf, bool saveText)
+{
+	char* text = nullptr;
+	if(saveText)
+	{
+		text = sci_get_document_text(meta);
+		if(!text)
+			Log(Log::WARN)<<"Could not get text for document "<<(meta->doi ? meta->doi : "");
+	}
+
+	PdfData* pdf = nullptr;
+	if(savePdf)
+	{
+		DocumentMeta anyBackend = *meta;
+		anyBackend.refcount = 0;
+		anyBackend.backendId = 0;
+		pdf = sci_get_document_pdf_data(&anyBackend);
+		if(!pdf)
+			Log(Log::WARN)<<"Could not get pdf for document "<<(meta->doi ? meta->doi : "");
+	}
+
+	if(!sci_corpus_add(corpus, meta, text, pdf ? pdf->data : nullptr, pdf ? pdf->length : 0))
+		Log(Log::WARN)<<"Could not add document "<<(meta->doi ? meta->doi : "")<<" to the corpus";
+
+	if(pdf)
+		pdf_data_free(pdf);
+	free(text);
+}
+
 static bool grabPapers(const DocumentMeta* meta,
 					   bool dryRun,
 					   bool savePdf,
@@ -56,11 +86,12 @@ static bool grabPapers(const DocumentMeta* meta,
 					   const std::filesystem::path& outDir,
 					   size_t maxCount,
 					   sorting_mode_t sortMode,
-					   bool titleDoi)
+					   bool titleDoi,
+					   SciCorpus* corpus)
 {
 	Log(Log::INFO)<<"Trying to download "<<maxCount<<" results";
-	RequestReturn* req = sci_fill_meta(meta, nullptr, std::min(maxCount, resultsPerPage), sortMode, 0);
-	bool retried = false;
+	// while one page is processed the next is fetched in the background, unless this is only a dry run
+	SciQuery* query = sci_query_open(meta, nullptr, std::min(maxCount, resultsPerPage), sortMode, dryRun ? 0 : 1);
 
 	FillReqest fq = {};
 	if(titleDoi)
@@ -73,105 +104,89 @@ static bool grabPapers(const DocumentMeta* meta,
 		memset(&fq, 0xFF, sizeof(FillReqest));
 	}
 
-	if(req)
+	if(query)
 	{
-		size_t pages = req->totalCount/resultsPerPage;
-		size_t totalCount = req->totalCount;
+		size_t totalCount = sci_query_get_total_count(query);
+		size_t pages = totalCount/resultsPerPage;
 
 		Log(Log::INFO)<<"Got "<<totalCount<<" results in "<<pages<<" pages";
 
 		if(dryRun)
 		{
-			request_return_free(req);
+			sci_query_close(query);
 			return true;
 		}
 
 		size_t processed = 0;
-		for(size_t page = 0; page <= pages; ++page)
+		while(DocumentMeta* document = sci_query_next(query))
 		{
-			if(page != 0)
-				req = sci_fill_meta(meta, nullptr, std::min(maxCount, resultsPerPage), sortMode, page);
-			if(!req)
+			if(processed % resultsPerPage == 0)
+				Log(Log::INFO)<<"Processing page "<<processed/resultsPerPage<<": "<<processed<<" of "<<totalCount;
+
+			if(corpus)
 			{
-				if(!retried)
-					--page;
-				retried = true;
-				continue;
+				addToCorpus(corpus, document, savePdf, saveText);
 			}
 			else
 			{
-				retried = false;
-			}
+				std::filesystem::path jsonpath = outDir/(std::to_string(processed) + ".json");
 
-			Log(Log::INFO)<<"Processing page "<<page<<": "<<processed<<" of "<<req->totalCount<<
-				", got "<<req->count<<" results this page";
-			for(size_t i = 0; i < req->count; ++i)
-			{
-				if(req->documents[i])
+				if(savePdf)
 				{
-					std::filesystem::path jsonpath = outDir/(std::to_string(processed) + ".json");
+					// the document may be shared with the result cache, so any backend is tried via an unowned shallow copy
+					DocumentMeta anyBackend = *document;
+					anyBackend.refcount = 0;
+					anyBackend.backendId = 0;
+					std::filesystem::path pdfpath = outDir/(std::to_string(processed) + ".pdf");
+					bool ret = sci_save_document_to_file(&anyBackend, pdfpath.c_str());
+					if(!ret)
+						Log(Log::WARN)<<"Could not get pdf for document "<<jsonpath;
+				}
+
+				char* text = nullptr;
+				if(saveText)
+				{
+					text = sci_get_document_text(document);
+					if(!text)
+						Log(Log::WARN)<<"Could not get text for document "<<jsonpath;
+				}
 
-					if(savePdf)
+				if(!printOnly)
+				{
+					if(!biblatex)
 					{
-						DocumentMeta* meta = document_meta_copy(req->documents[i]);
-						meta->backendId = 0;
-						std::filesystem::path pdfpath = outDir/(std::to_string(processed) + ".pdf");
-						bool ret = sci_save_document_to_file(meta, pdfpath.c_str());
+						Log(Log::DEBUG)<<"saveing meta for "<<jsonpath.c_str();
+						bool ret = document_meta_save_only_fillrq(jsonpath.c_str(), document, fq, text);
 						if(!ret)
-							Log(Log::WARN)<<"Could not get pdf for document "<<jsonpath;
-						document_meta_free(meta);
+							Log(Log::WARN)<<"Could not save document metadata"<<jsonpath;
 					}
-
-					char* text = nullptr;
-					if(saveText)
+					else
 					{
-						text = sci_get_document_text(req->documents[i]);
-						if(!text)
-							Log(Log::WARN)<<"Could not get text for document "<<jsonpath;
+						saveBiblatex(document, jsonpath);
 					}
-
-					if(!printOnly)
+				}
+				else
+				{
+					if(!biblatex)
 					{
-						if(!biblatex)
-						{
-							Log(Log::DEBUG)<<"saveing meta for "<<jsonpath.c_str();
-							bool ret = document_meta_save_only_fillrq(jsonpath.c_str(), req->documents[i], fq, text);
-							if(!ret)
-								Log(Log::WARN)<<"Could not save document metadata"<<jsonpath;
-						}
-						else
-						{
-							saveBiblatex(req->documents[i], jsonpath);
-						}
+						std::cout.flush();
+						document_meta_write_json_only_fillrq(stdout, document, fq, text);
 					}
 					else
 					{
-						if(!biblatex)
-						{
-							char* json = document_meta_get_json_only_fillrq(req->documents[i], fq, text, NULL);
-							std::cout<<json;
-							free(json);
-						}
-						else
-						{
-							char* biblatex = document_meta_get_biblatex(req->documents[i], NULL, NULL);
-							std::cout<<biblatex;
-							free(biblatex);
-						}
+						char* biblatex = document_meta_get_biblatex(document, NULL, NULL);
+						std::cout<<biblatex;
+						free(biblatex);
 					}
 				}
-				else
-				{
-					Log(Log::WARN)<<"Document meta for result "<<i<<" of page "<<page<<" is empty";
-				}
-				++processed;
-				if(maxCount > 0 && processed >= maxCount)
-					break;
+				free(text);
 			}
-			request_return_free(req);
+			document_meta_free(document);
+			++processed;
 			if(maxCount > 0 && processed >= maxCount)
 				break;
 		}
+		sci_query_close(query);
 		return true;
 	}
 
@@ -207,7 +222,18 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	bool ret = checkDir(config.outDir);
+	SciCorpus* corpus = nullptr;
+	if(!config.corpusDir.empty())
+	{
+		corpus = sci_corpus_open(config.corpusDir.c_str());
+		if(!corpus)
+		{
+			Log(Log::ERROR)<<"Could not open corpus at "<<config.corpusDir;
+			return 1;
+		}
+	}
+
+	bool ret = corpus || checkDir(config.outDir);
 	if(!ret)
 		return 1;
 
@@ -250,7 +276,8 @@ int main(int argc, char** argv)
 	char* json = document_meta_get_json(&queryMeta, nullptr, &length);
 	Log(Log::DEBUG)<<"Using document meta: "<<json;
 	free(json);
-	ret = grabPapers(&queryMeta, config.dryRun, config.savePdf, config.fullText, config.print, config.biblatex, config.outDir, config.maxNumber, config.sortMode, config.titleDoi);
+	ret = grabPapers(&queryMeta, config.dryRun, config.savePdf, config.fullText, config.print, config.biblatex, config.outDir, config.maxNumber, config.sortMode, config.titleDoi, corpus);
+	sci_corpus_close(corpus);
 	if(!ret)
 		return 1;
 	return 0;
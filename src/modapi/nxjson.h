@@ -20,6 +20,8 @@
 #ifndef NXJSON_H
 #define NXJSON_H
 
+#include <stddef.h>
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
@@ -55,6 +57,7 @@ typedef struct nx_json {
   struct nx_json* child;   /**< points to first child */
   struct nx_json* next;    /**< points to next child */
   struct nx_json* last_child;
+  struct nx_json** index;  /**< internal lookup index of wide OBJECTs and ARRAYs, used by nx_json_get() and nx_json_item() */
 } nx_json;
 
 /**
@@ -81,7 +84,44 @@ const nx_json* nx_json_parse(char* text, nx_json_unicode_encoder encoder);
 const nx_json* nx_json_parse_utf8(char* text);
 
 /**
- * @brief Frees a nx_json struct parsed by nx_json_parse()
+ * @brief Opaque set of key paths a parse is restricted to, see nx_json_projection_new()
+ */
+typedef struct nx_json_projection nx_json_projection;
+
+/**
+ * @brief Creates an empty projection, which keeps everything until paths are added with nx_json_projection_add()
+ * @return a new projection, to be freed with nx_json_projection_free()
+ */
+nx_json_projection* nx_json_projection_new(void);
+
+/**
+ * @brief Adds a key path to keep to a projection
+ * A path is a . separated list of keys leading from the top level object to the value to keep, the whole value including all its children is kept.
+ * Arrays are transparent, a path applies to all of their items, so "message.items.title" keeps the title of every item.
+ * Values of keys that lie on none of the paths are skipped over without allocating nodes or unescaping strings.
+ * @param projection the projection to add to
+ * @param path the key path to keep
+ */
+void nx_json_projection_add(nx_json_projection* projection, const char* path);
+
+/**
+ * @brief Frees a projection
+ */
+void nx_json_projection_free(nx_json_projection* projection);
+
+/**
+ * @brief Parses a json text like nx_json_parse() but only keeps the values selected by a projection
+ * @param text a text string containing the json to be parsed
+ * @param projection the projection to apply, or NULL to keep everything
+ * @param encoder a function of type nx_json_unicode_encoder
+ * @return parsed top level json object as a nx_json struct, to be freed with nx_json_free() or NULL if there was a parse error
+ */
+const nx_json* nx_json_parse_projected(char* text, const nx_json_projection* projection, nx_json_unicode_encoder encoder);
+
+/**
+ * @brief Frees a nx_json struct parsed by nx_json_parse() or nx_json_stream_finish()
+ * All nodes of a parse are allocated from one arena, so this releases the whole tree at once.
+ * It must only be called with the top level object, never with one of its children.
  */
 void nx_json_free(const nx_json* js);
 
@@ -105,6 +145,63 @@ const nx_json* nx_json_get(const nx_json* json, const char* key);
  */
 const nx_json* nx_json_item(const nx_json* json, int idx);
 
+/**
+ * @brief Opaque handle of a streaming parser, see nx_json_stream_new()
+ */
+typedef struct nx_json_stream nx_json_stream;
+
+/**
+ * @brief This typdef descibes a function that is called for every array item completed by a streaming parser.
+ * The item and all its children are freed once this function returns, copy out what you need.
+ */
+typedef void (*nx_json_item_callback)(const nx_json* item, void* user_data);
+
+/**
+ * @brief Creates a streaming parser that can be fed the json text in chunks as it arrives, for instance from a network transfer
+ *
+ * The items of the array at items_path are handed to callback as soon as each of them is complete and are then dropped,
+ * so that the parsed tree never holds more than one item at a time.
+ * The rest of the document is kept and returned by nx_json_stream_finish(), where the items array will be empty.
+ * Strings are decoded to UTF-8, comments are not supported in this mode.
+ *
+ * @param items_path a . separated list of keys leading from the top level object to the array whose items are to be streamed
+ * or NULL or "" if the top level value itself is the array.
+ * @param callback the function to call for every item, may be NULL
+ * @param user_data a pointer that is passed to callback
+ * @return a new parser, to be freed with nx_json_stream_finish() or nx_json_stream_free()
+ */
+nx_json_stream* nx_json_stream_new(const char* items_path, nx_json_item_callback callback, void* user_data);
+
+/**
+ * @brief Restricts a streaming parser to the values selected by a projection, see nx_json_projection_add()
+ * Paths into the streamed items must include the items path, which itself has to be part of the projection.
+ * Must be called before the first call to nx_json_stream_feed()
+ * @param stream the parser
+ * @param projection the projection to apply, it must outlive the parser
+ */
+void nx_json_stream_set_projection(nx_json_stream* stream, const nx_json_projection* projection);
+
+/**
+ * @brief Feeds the next chunk of json text to a streaming parser
+ * @param stream the parser
+ * @param data the chunk, it need not be NUL terminated and may end anywhere in the text
+ * @param length the length of data in bytes
+ * @return 1 on success, 0 if a parse error occured, in which case the parser can only be freed
+ */
+int nx_json_stream_feed(nx_json_stream* stream, const char* data, size_t length);
+
+/**
+ * @brief Ends the text and frees a streaming parser
+ * @param stream the parser
+ * @return the top level json object without the streamed items as a nx_json struct, to be freed with nx_json_free() or NULL if there was a parse error or the text was incomplete
+ */
+const nx_json* nx_json_stream_finish(nx_json_stream* stream);
+
+/**
+ * @brief Frees a streaming parser without finishing it, for instance after a parse error
+ */
+void nx_json_stream_free(nx_json_stream* stream);
+
 /**@}*/
 
 #ifdef  __cplusplus
@@ -0,0 +1,38 @@
+/**
+ * @file sci-async.h
+ * Worker pool for the asynchronous api of SCIPAPER
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * scipaper is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * scipaper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with scipaper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SCI_ASYNC_H_
+#define _SCI_ASYNC_H_
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool sci_async_init(void);
+
+/**
+ * Waits for all requests that are being processed, requests that have not started yet are cancelled
+ */
+void sci_async_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SCI_ASYNC_H_ */
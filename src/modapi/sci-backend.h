@@ -32,12 +32,33 @@ Api for use by libscipaper modules.
  * @param get_document_text_in a function pointer to a function that gets the full text for a document. See sci_get_document_text() for details on parameters
  * @param get_document_pdf_data_in a function pointer to a function that gets the pdf data for a document. See sci_get_document_pdf_data() for details on parameters
  * @param user_data a point for context that will be passed to fill_meta_in, get_document_text_in, and get_document_pdf_data_in when called
+ * These functions are called from several threads at once, any state they keep in user_data must be protected accordingly.
  * @return backend id that is to be given in DocumentMeta backendId as well as input for sci_plugin_unregister()
  */
 int sci_plugin_register(const BackendInfo* backend_info, RequestReturn* (*fill_meta_in)(const DocumentMeta*, size_t, sorting_mode_t, size_t, void*),
 						char* (*get_document_text_in)(const DocumentMeta*, void*),
 						PdfData* (*get_document_pdf_data_in)(const DocumentMeta*, void*), void* user_data);
 
+/**
+ * @brief Optionally registers a function that saves the pdf of a document directly to a file, for a backend that was registered with sci_plugin_register().
+ * If present it is used by sci_save_document_to_file() instead of get_document_pdf_data_in, so that large pdfs can be streamed to disk, see wgetPdfToFile()
+ * @param id the backend id returned by sci_plugin_register()
+ * @param save_document_pdf_in a function pointer to a function that saves the pdf for a document under the given file name, returning true on success.
+ */
+void sci_plugin_register_save_document_pdf(int id, bool (*save_document_pdf_in)(const DocumentMeta* meta, const char* fileName, void* user_data));
+
+/**
+ * @brief Optionally registers a function that looks up many DOIs at once, for a backend that was registered with sci_plugin_register().
+ * If present it is used by sci_find_by_dois() before falling back to looking up the remaining DOIs one by one via fill_meta_in.
+ * @param id the backend id returned by sci_plugin_register()
+ * @param find_by_dois_in a function pointer to a function that looks up count DOIs, setting results[i] to a newly allocated
+ * DocumentMeta for every dois[i] it found. results is zeroed by the caller, entries that are not found are left NULL.
+ * answered is zeroed by the caller as well, answered[i] is to be set to true for every dois[i] the backend got an answer for,
+ * found or not. DOIs that where answered but not found are not asked of this backend again, all others are retried one by one.
+ */
+void sci_plugin_register_find_by_dois(int id, void (*find_by_dois_in)(const char** dois, size_t count, DocumentMeta** results,
+																	  bool* answered, void* user_data));
+
 /**
  * @brief Unregisters a backend, must be called before the backend exits
  * @param id the backend id to unreigster.
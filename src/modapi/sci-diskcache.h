@@ -0,0 +1,106 @@
+/**
+ * @file sci-diskcache.h
+ * Persistent on disk cache of metadata lookups for SCIPAPER
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * scipaper is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * scipaper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with scipaper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SCI_DISKCACHE_H_
+#define _SCI_DISKCACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Name of the cache configuration group */
+#define SCI_CONF_CACHE_GROUP		"Cache"
+
+/**
+ * Computes a canonical hash of a sci_fill_meta() request,
+ * requests that differ only in the case or surrounding whitespace of their fields have the same hash
+ *
+ * @param meta The query
+ * @param fill The FillReqest of the query or NULL
+ * @param maxCount maximum number of documents requested
+ * @param sortMode the sorting mode requested
+ * @param page the page requested
+ * @return The hash as a newly allocated hex string, to be freed with g_free()
+ */
+char* sci_diskcache_get_request_hash(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+									 sorting_mode_t sortMode, size_t page);
+
+/**
+ * Looks up the result of a sci_fill_meta() request in the cache
+ *
+ * @param meta The query
+ * @param fill The FillReqest of the query or NULL
+ * @param maxCount maximum number of documents requested
+ * @param sortMode the sorting mode requested
+ * @param page the page requested
+ * @param negative set to true if the cache holds the information that the request found nothing
+ * @return A RequestReturn on a hit, NULL on a miss or for negative entries
+ */
+RequestReturn* sci_diskcache_get(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+								 sorting_mode_t sortMode, size_t page, bool* negative);
+
+/**
+ * Stores the result of a sci_fill_meta() request in the cache
+ *
+ * @param meta The query
+ * @param fill The FillReqest of the query or NULL
+ * @param maxCount maximum number of documents requested
+ * @param sortMode the sorting mode requested
+ * @param page the page requested
+ * @param result The result of the request, NULL to store that the request found nothing,
+ * which must only be done if every backend asked answered without failing
+ */
+void sci_diskcache_put(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+					   sorting_mode_t sortMode, size_t page, const RequestReturn* result);
+
+/**
+ * Looks up the pdf of a document in the cache by its DOI
+ *
+ * @param meta The document
+ * @return A PdfData struct to be freed with pdf_data_free(), or NULL on a miss
+ */
+PdfData* sci_diskcache_get_pdf(const DocumentMeta* meta);
+
+/**
+ * Stores the pdf of a document in the cache under its DOI, documents without a DOI are not cached
+ *
+ * @param meta The document
+ * @param data The pdf
+ * @param length The length of the data at pdf
+ */
+void sci_diskcache_put_pdf(const DocumentMeta* meta, const unsigned char* data, size_t length);
+
+/**
+ * Stores a pdf that was saved to a file in the cache under the DOI of its document
+ *
+ * @param meta The document
+ * @param fileName The file the pdf was saved to
+ */
+void sci_diskcache_put_pdf_file(const DocumentMeta* meta, const char* fileName);
+
+bool sci_diskcache_init(void);
+void sci_diskcache_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SCI_DISKCACHE_H_ */
@@ -1,6 +1,8 @@
 #pragma once
 #include <glib.h>
+#include <stdio.h>
 #include "types.h"
+#include "nxjson.h"
 
 /**
 * @addtogroup MODAPI
@@ -39,6 +41,42 @@ struct Pair* pair_new(const char* key, const char* value);
  */
 GString* buildQuery(const GSList* list);
 
+/**
+ * @brief Limits the rate at which requests are made to the host of the given url
+ *
+ * All requests made via the functions in this file to that host, blocking ones as well as those in a WRequestSet, share this limit.
+ * Requests are spaced evenly at 1/requestsPerSecond intervals, so concurrent requests never burst above the limit.
+ *
+ * @param url A url on the host to limit, only the scheme, host and port are considered
+ * @param requestsPerSecond The maximum number of requests per second, 0 or less to remove the limit
+ */
+void wsetRateLimit(const char* url, int requestsPerSecond);
+
+/**
+ * @brief Sets how often requests to the host of the given url are retried
+ *
+ * Requests that fail with a transient error, such as a timeout, a dropped connection or a http 408, 429 or 5xx status,
+ * are retried with a jittered exponential backoff, a Retry-After header sent by the host is respected.
+ * While waiting for a retry all other requests to the host are held back as well.
+ * Hosts without an explicit setting use Retry from the Network section of the config file.
+ *
+ * @param url A url on the host, only the scheme, host and port are considered
+ * @param retries The number of times a failed request is retried, 0 to never retry
+ */
+void wsetRetry(const char* url, int retries);
+
+/**
+ * @brief Gets the number of requests made by the calling thread that failed because the server could not be reached
+ * or returned a server error, even after all retries.
+ *
+ * The count is never reset, the failures of a call are the difference of the counts taken before and after it,
+ * so that calls nested in other calls do not disturb each others count.
+ * This allows libscipaper to tell a backend whose server is down from one that simply found nothing.
+ *
+ * @return The number of failed requests made by the calling thread so far
+ */
+unsigned int wgetFailureCount(void);
+
 /**
  * @brief Get a pdf file va a http(s) GET request
  *
@@ -47,6 +85,19 @@ GString* buildQuery(const GSList* list);
  */
 PdfData* wgetPdf(const char* url, int timeout);
 
+/**
+ * @brief Get a pdf file va a http(s) GET request and stream it straight to disk
+ *
+ * The download is aborted as soon as the first bytes show that the response is not a pdf.
+ * The data is written to a temporary file next to fileName that is only renamed into place once the download has succeeded.
+ *
+ * @param url The url to get
+ * @param timeout The timeout for this request in seconds
+ * @param fileName The file name under which to save the pdf
+ * @return true on success, false on failure
+ */
+bool wgetPdfToFile(const char* url, int timeout, const char* fileName);
+
 /**
  * @brief Get the http data return as a string from a url via a http(s) GET request
  *
@@ -55,6 +106,25 @@ PdfData* wgetPdf(const char* url, int timeout);
  */
 GString* wgetUrl(const char* url, int timeout);
 
+/**
+ * @brief Get a json document via a http(s) GET request and parse it while it is being downloaded
+ *
+ * The items of the array at itemsPath are handed to itemFn as soon as each of them has arrived,
+ * so that the caller can process them while the rest of the response is still in flight and the whole document is never held in memory.
+ * See nx_json_stream_new() for details.
+ *
+ * @param url The url to get
+ * @param timeout The timeout for this request in seconds
+ * @param itemsPath a . separated list of keys leading to the array whose items are to be streamed
+ * @param projection the key paths to keep, see nx_json_projection_add(), or NULL to keep everything
+ * @param itemFn the function to call for every item
+ * @param userData a pointer that is passed to itemFn
+ * @return the json document without the streamed items, to be freed with nx_json_free(), or NULL on failure.
+ * Note that itemFn may have been called for some items even if this function fails.
+ */
+const nx_json* wgetJson(const char* url, int timeout, const char* itemsPath, const nx_json_projection* projection,
+					   nx_json_item_callback itemFn, void* userData);
+
 /**
  * @brief Get the http data return as a string from a url via a http(s) POST request
  *
@@ -64,6 +134,116 @@ GString* wgetUrl(const char* url, int timeout);
  */
 GString* wpostUrl(const char* url, const char* data, int timeout);
 
+/**
+ * @brief A set of http requests that are performed concurrently via curl_multi
+ */
+typedef struct _WRequestSet WRequestSet;
+
+/**
+ * @brief Called when a request added to a WRequestSet has finished
+ *
+ * @param response A GString containing the data grabed from the url, or NULL if the request failed, owned by the callee
+ * @param userData The pointer given when the request was added
+ */
+typedef void (*wrequest_done_fn)(GString* response, void* userData);
+
+/**
+ * @brief Called when a pdf request added to a WRequestSet has finished
+ *
+ * @param pdf A newly PdfData struct, or NULL if the request failed or did not return a pdf, owned by the callee
+ * @param userData The pointer given when the request was added
+ */
+typedef void (*wrequest_pdf_done_fn)(PdfData* pdf, void* userData);
+
+/**
+ * @brief Called when a pdf file request added to a WRequestSet has finished
+ *
+ * @param saved true if a valid pdf was saved to the requested file name
+ * @param userData The pointer given when the request was added
+ */
+typedef void (*wrequest_file_done_fn)(bool saved, void* userData);
+
+/**
+ * @brief Creates a new empty set of concurrent requests
+ *
+ * @return A newly allocated WRequestSet, to be freed with wrequest_set_free(), or NULL on failure
+ */
+WRequestSet* wrequest_set_new(void);
+
+/**
+ * @brief Adds a http(s) GET request to the set, it is started right away and dose not block
+ *
+ * @param set The set to add the request to
+ * @param url The url to get
+ * @param timeout The timeout for this request in seconds
+ * @param done Called from wrequest_set_poll() once the request has finished, may add further requests to the set
+ * @param userData Passed to done
+ * @return true if the request was queued, if false done has already been called with NULL
+ */
+bool wrequest_set_add_get(WRequestSet* set, const char* url, int timeout, wrequest_done_fn done, void* userData);
+
+/**
+ * @brief Adds a http(s) POST request to the set, it is started right away and dose not block
+ *
+ * @param set The set to add the request to
+ * @param url The url to post
+ * @param data null terminated string that contains the data to post to url
+ * @param timeout The timeout for this request in seconds
+ * @param done Called from wrequest_set_poll() once the request has finished, may add further requests to the set
+ * @param userData Passed to done
+ * @return true if the request was queued, if false done has already been called with NULL
+ */
+bool wrequest_set_add_post(WRequestSet* set, const char* url, const char* data, int timeout, wrequest_done_fn done, void* userData);
+
+/**
+ * @brief Adds a request for a pdf file to the set, like wgetPdf() but non blocking
+ *
+ * @param set The set to add the request to
+ * @param url The url to get
+ * @param timeout The timeout for this request in seconds
+ * @param done Called from wrequest_set_poll() once the request has finished, may add further requests to the set
+ * @param userData Passed to done
+ * @return true if the request was queued, if false done has already been called with NULL
+ */
+bool wrequest_set_add_pdf(WRequestSet* set, const char* url, int timeout, wrequest_pdf_done_fn done, void* userData);
+
+/**
+ * @brief Adds a request for a pdf file to the set that is streamed to disk, like wgetPdfToFile() but non blocking
+ *
+ * @param set The set to add the request to
+ * @param url The url to get
+ * @param timeout The timeout for this request in seconds
+ * @param fileName The file name under which to save the pdf, every request writes to its own temporary file
+ * @param done Called from wrequest_set_poll() once the request has finished, may add further requests to the set
+ * @param userData Passed to done
+ * @return true if the request was queued, if false done has already been called with false
+ */
+bool wrequest_set_add_pdf_file(WRequestSet* set, const char* url, int timeout, const char* fileName,
+							   wrequest_file_done_fn done, void* userData);
+
+/**
+ * @brief Drives the transfers of the set and calls the done callbacks of all requests that have finished
+ *
+ * @param set The set to process
+ * @param timeoutMs The maximum time to wait for network activity in ms, 0 returns immediately
+ * @return The number of requests still in flight
+ */
+size_t wrequest_set_poll(WRequestSet* set, int timeoutMs);
+
+/**
+ * @brief Blocks until all requests in the set, including those added by callbacks, have finished
+ *
+ * @param set The set to wait on
+ */
+void wrequest_set_wait(WRequestSet* set);
+
+/**
+ * @brief Frees a request set, requests still in flight are aborted and their callbacks are called with NULL
+ *
+ * @param set The set to free, it is safe to pass NULL here
+ */
+void wrequest_set_free(WRequestSet* set);
+
 /**
  * @brief Create a json style entry string
  *
@@ -76,4 +256,83 @@ GString* wpostUrl(const char* url, const char* data, int timeout);
  */
 GString* createJsonEntry(const int indent, const char* key, const char* value, bool quote, bool newline);
 
+/**
+ * @brief A sink json, or other text, is written to, either counting the bytes, into a preallocated buffer or into a FILE
+ *
+ * To build a string, write everything once to a counting writer, allocate length + 1 bytes and write it again to a buffer writer.
+ */
+typedef struct _JsonWriter
+{
+	char* buffer; /**< if set the output is written here, it must be large enough to hold it */
+	FILE* file; /**< otherwise if set the output is written to this file */
+	size_t length; /**< the number of bytes written, or counted, so far */
+	bool error; /**< set if writing to the file failed */
+} JsonWriter;
+
+/**
+ * @brief Initalizes a JsonWriter that only counts the bytes written to it
+ *
+ * @param writer The writer to initalize
+ */
+void json_writer_init_count(JsonWriter* writer);
+
+/**
+ * @brief Initalizes a JsonWriter that writes into a buffer, the output is NUL terminated
+ *
+ * @param writer The writer to initalize
+ * @param buffer The buffer to write to, it must be large enough to hold the output as counted by a counting writer plus the NUL
+ */
+void json_writer_init_buffer(JsonWriter* writer, char* buffer);
+
+/**
+ * @brief Initalizes a JsonWriter that writes to a file
+ *
+ * @param writer The writer to initalize
+ * @param file The file to write to
+ */
+void json_writer_init_file(JsonWriter* writer, FILE* file);
+
+/**
+ * @brief Writes raw data to a JsonWriter
+ *
+ * @param writer The writer to write to
+ * @param data The data to write
+ * @param length The length of data in bytes
+ */
+void json_writer_append(JsonWriter* writer, const char* data, size_t length);
+
+/**
+ * @brief Writes a string to a JsonWriter, escaped so that it can be placed between quotes
+ *
+ * Valid UTF-8 is passed through unchanged, only quotes, backslashes and control characters are escaped.
+ * Bytes that are not valid UTF-8 are replaced with \\ufffd.
+ *
+ * @param writer The writer to write to
+ * @param value The NUL terminated string to escape
+ */
+void json_writer_append_escaped(JsonWriter* writer, const char* value);
+
+/**
+ * @brief Writes a json style entry to a JsonWriter, the output is the same as that of createJsonEntry()
+ *
+ * @param writer The writer to write to
+ * @param indent intent level to prepend
+ * @param key json entry key
+ * @param value json entry value, if NULL nothing is written
+ * @param quote if true qoutes "" are placed around value
+ * @param newline if true the entry ends with a unix newline
+ */
+void json_writer_append_entry(JsonWriter* writer, int indent, const char* key, const char* value, bool quote, bool newline);
+
 /**@}*/
+
+/**
+ * @brief Initalizes the http layer, its connection pool and the shared dns and tls session cache
+ * @return true on success, false on failure
+ */
+bool utils_init(void);
+
+/**
+ * @brief Closes all pooled connections and frees the resources held by the http layer
+ */
+void utils_exit(void);
@@ -48,12 +48,46 @@ struct CorePriv
 	int id;
 	int timeout;
 	int retry;
+	// the scroll state of the last search, core_fill_meta is called from several threads at once
+	GMutex pagingLock;
 	DocumentMeta* lastDocument;
 	char* scrollId;
 	int nextPage;
 	int lastMaxCount;
+	nx_json_projection* projection;
+	nx_json_projection* fullTextProjection;
 };
 
+// the fields of a result that core_parse_document_meta reads, everything else is skipped while parsing
+static const char* const coreResultFields[] = {
+	"identifiers",
+	"authors.name",
+	"abstract",
+	"doi",
+	"title",
+	"publisher",
+	"yearPublished",
+	"downloadUrl",
+	NULL
+};
+
+static nx_json_projection* core_create_projection(bool fullText)
+{
+	nx_json_projection* projection = nx_json_projection_new();
+	nx_json_projection_add(projection, "totalHits");
+	nx_json_projection_add(projection, "offset");
+	nx_json_projection_add(projection, "scrollId");
+	for(size_t i = 0; coreResultFields[i]; ++i)
+	{
+		char* path = g_strconcat("results.", coreResultFields[i], NULL);
+		nx_json_projection_add(projection, path);
+		g_free(path);
+	}
+	if(fullText)
+		nx_json_projection_add(projection, "results.fullText");
+	return projection;
+}
+
 struct CoreData
 {
 	char* fullText;
@@ -125,12 +159,11 @@ static DocumentMeta* core_parse_document_meta(const nx_json* item, struct CorePr
 {
 	DocumentMeta *result = document_meta_new();
 	result->backendId = priv->id;
-	result->hasFullText = true;
 
 	struct CoreData* coreData = g_malloc0(sizeof(*coreData));
 	coreData->fullText = g_strdup(nx_json_get(item, "fullText")->text_value);
 	coreData->id = core_get_document_id(nx_json_get(item, "identifiers"));
-	coreData->fullText = g_strdup(nx_json_get(item, "fullText")->text_value);
+	result->hasFullText = true;
 	result->backendData = coreData;
 	result->backend_data_free_fn = &core_free_data;
 	result->backend_data_copy_fn = &core_copy_data;
@@ -163,6 +196,18 @@ static DocumentMeta* core_parse_document_meta(const nx_json* item, struct CorePr
 	return result;
 }
 
+struct CoreResults
+{
+	GPtrArray* documents;
+	struct CorePriv* priv;
+};
+
+static void core_results_item(const nx_json* item, void* userData)
+{
+	struct CoreResults* results = userData;
+	g_ptr_array_add(results->documents, core_parse_document_meta(item, results->priv));
+}
+
 static bool core_is_in_range(int page, int nextPage)
 {
 	if(page < nextPage)
@@ -172,18 +217,23 @@ static bool core_is_in_range(int page, int nextPage)
 	return false;
 }
 
-static RequestReturn* core_fill_meta_impl(int *code, const DocumentMeta* meta, size_t maxCount,
-										  sorting_mode_t sortMode, size_t page, struct CorePriv* priv)
+static RequestReturn* core_fill_meta_impl(int* code, const DocumentMeta* meta, size_t maxCount,
+										  sorting_mode_t sortMode, size_t page, bool fullText, struct CorePriv* priv)
 {
 	(void)sortMode;
 
 	RequestReturn* results = NULL;
 	bool fastPage = false;
+	char* scrollId = NULL;
+	g_mutex_lock(&priv->pagingLock);
 	if(page == 0 || (document_meta_is_equal(meta, priv->lastDocument) &&
 		priv->lastMaxCount == maxCount && core_is_in_range(page, priv->nextPage) && priv->scrollId))
 	{
 		if(page != 0)
+		{
 			sci_module_log(LL_DEBUG, "Using fast pageing for this request");
+			scrollId = g_strdup(priv->scrollId);
+		}
 		fastPage = true;
 	}
 	else if(page != 0)
@@ -193,6 +243,7 @@ static RequestReturn* core_fill_meta_impl(int *code, const DocumentMeta* meta, s
 					page, priv->nextPage, priv->scrollId ? "" : "no scrollId stored",
 					priv->lastMaxCount == maxCount ? "" : "maxCounts are not equal");
 	}
+	g_mutex_unlock(&priv->pagingLock);
 
 	char* intStr = g_strdup_printf("%zu", maxCount);
 	GSList* queryList = g_slist_prepend(NULL, pair_new("limit", intStr));
@@ -200,8 +251,9 @@ static RequestReturn* core_fill_meta_impl(int *code, const DocumentMeta* meta, s
 	if(fastPage)
 	{
 		queryList = g_slist_prepend(queryList, pair_new("scroll", "true"));
-		if(page > 0 && priv->scrollId)
-			queryList = g_slist_prepend(queryList, pair_new("scrollId", priv->scrollId));
+		if(scrollId)
+			queryList = g_slist_prepend(queryList, pair_new("scrollId", scrollId));
+		g_free(scrollId);
 	}
 	else
 	{
@@ -261,26 +313,31 @@ static RequestReturn* core_fill_meta_impl(int *code, const DocumentMeta* meta, s
 
 	GString* url = core_create_url(priv, CORE_METHOD_SEARCH_WORKS, queryList);
 	sci_module_log(LL_DEBUG, "%s: getting url string: %s", __func__, url->str);
-	GString* jsonText = wgetUrl(url->str, priv->timeout + maxCount);
+	// results carry their full text, so they are parsed as they arrive instead of holding the whole response
+	struct CoreResults items = {
+		.documents = g_ptr_array_new_with_free_func((GDestroyNotify)document_meta_free),
+		.priv = priv
+	};
+	const nx_json_projection* projection = fullText ? priv->fullTextProjection : priv->projection;
+	const nx_json* json = wgetJson(url->str, priv->timeout + maxCount, "results", projection, core_results_item, &items);
 	g_string_free(url, true);
-	if(!jsonText)
+	if(!json)
 	{
+		g_ptr_array_free(items.documents, true);
 		*code = 1;
 		return results;
 	}
 
-	const nx_json* json = nx_json_parse_utf8(jsonText->str);
-	const nx_json* resutlsArray = nx_json_get(json, "results");
-	if(resutlsArray->type != NX_JSON_ARRAY)
+	if(nx_json_get(json, "results")->type != NX_JSON_ARRAY)
 	{
 		sci_module_log(LL_WARN, "%s: invalid response no results entry", __func__);
 		nx_json_free(json);
-		g_string_free(jsonText, true);
+		g_ptr_array_free(items.documents, true);
 		*code = 2;
 		return results;
 	}
 
-	results = request_return_new((size_t)resutlsArray->length, maxCount);
+	results = request_return_new(items.documents->len, maxCount);
 	if(!fastPage)
 		results->page = (size_t)(nx_json_get(json, "offset")->int_value/maxCount);
 	else
@@ -289,17 +346,19 @@ static RequestReturn* core_fill_meta_impl(int *code, const DocumentMeta* meta, s
 
 	for(size_t i = 0; i < results->count; ++i)
 	{
-		const nx_json* item = nx_json_item(resutlsArray, i);
-		results->documents[i] = core_parse_document_meta(item, priv);
+		results->documents[i] = g_ptr_array_index(items.documents, i);
+		g_ptr_array_index(items.documents, i) = NULL;
 	}
+	g_ptr_array_free(items.documents, true);
 
+	g_mutex_lock(&priv->pagingLock);
 	if(fastPage)
 	{
 		sci_module_log(LL_DEBUG, "Saveing scrollId for next request");
 		priv->lastMaxCount = maxCount;
 		priv->nextPage = ++page;
 		document_meta_free(priv->lastDocument);
-		priv->lastDocument = document_meta_copy(meta);
+		priv->lastDocument = document_meta_ref(meta);
 		g_free(priv->scrollId);
 		priv->scrollId = g_strdup(nx_json_get(json, "scrollId")->text_value);
 	}
@@ -310,17 +369,17 @@ static RequestReturn* core_fill_meta_impl(int *code, const DocumentMeta* meta, s
 		g_free(priv->scrollId);
 		priv->scrollId = NULL;
 	}
+	g_mutex_unlock(&priv->pagingLock);
 
 	nx_json_free(json);
-	g_string_free(jsonText, true);
 
 	*code = 0;
 	return results;
 }
 
-static RequestReturn* core_fill_meta(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page, void* userData)
+static RequestReturn* core_search(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page,
+								  bool fullText, struct CorePriv* priv)
 {
-	struct CorePriv* priv = userData;
 	RequestReturn* results = NULL;
 
 	if(maxCount == 0)
@@ -331,12 +390,13 @@ static RequestReturn* core_fill_meta(const DocumentMeta* meta, size_t maxCount,
 
 	if(meta->author || meta->title || meta->keywords || meta->searchText || meta->abstract || meta->doi)
 	{
-		int code = -1;
-		for(int i = 0; i < priv->retry && code != 0; ++i)
+		// transfer failures are retried by the http layer, responses without results are retried here
+		int code = 2;
+		for(int i = 0; i < priv->retry && code == 2; ++i)
 		{
 			if(i != 0)
 				sci_module_log(LL_WARN, "Could not get results from core, retrying %i of %i", i+1, priv->retry);
-			results = core_fill_meta_impl(&code, meta, maxCount, sortMode, page, priv);
+			results = core_fill_meta_impl(&code, meta, maxCount, sortMode, page, fullText, priv);
 		}
 	}
 	else
@@ -347,31 +407,70 @@ static RequestReturn* core_fill_meta(const DocumentMeta* meta, size_t maxCount,
 	return results;
 }
 
+static RequestReturn* core_fill_meta(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page, void* userData)
+{
+	// full texts are large, they are only parsed if the caller hinted that it wants them
+	return core_search(meta, maxCount, sortMode, page, meta->hasFullText, userData);
+}
+
+static char* core_get_output_text(const char* coreId, struct CorePriv* priv)
+{
+	GString* method = g_string_new(CORE_METHOD_OUTPUTS);
+	g_string_append(method, coreId);
+	GString* url = core_create_url(priv, method->str, NULL);
+	g_string_free(method, true);
+
+	sci_module_log(LL_DEBUG, "%s: getting full text of core output %s", __func__, coreId);
+	GString* jsonText = wgetUrl(url->str, priv->timeout);
+	g_string_free(url, true);
+	if(!jsonText)
+		return NULL;
+
+	char* text = NULL;
+	const nx_json* json = nx_json_parse_utf8(jsonText->str);
+	if(json)
+	{
+		text = g_strdup(nx_json_get(json, "fullText")->text_value);
+		nx_json_free(json);
+	}
+	g_string_free(jsonText, true);
+	return text;
+}
+
 char* core_get_document_text(const DocumentMeta* meta, void* userData)
 {
 	struct CorePriv* priv = userData;
 
+	// documents found without asking for their full text are refetched by their id, this is one request
+	// and can not end up at a different work like a new search could
 	if(meta->backendId == priv->id && meta->backendData)
 	{
 		struct CoreData* data = meta->backendData;
-		return g_strdup(data->fullText);
+		if(data->fullText)
+			return g_strdup(data->fullText);
+		if(data->id)
+			return core_get_output_text(data->id, priv);
+	}
+
+	// a foreign document, or one of ours without an id, is searched for by its doi if it has one
+	DocumentMeta* query;
+	if(meta->doi)
+	{
+		query = document_meta_new();
+		query->doi = g_strdup(meta->doi);
 	}
 	else
 	{
-		RequestReturn* metas = core_fill_meta(meta, 1, SCI_SORT_RELEVANCE, 0, priv);
-		if(!metas)
-		{
-			return NULL;
-		}
-		else
-		{
-			char* text = g_strdup(((struct CoreData*)metas->documents[0]->backendData)->fullText);
-			request_return_free(metas);
-			return text;
-		}
+		query = document_meta_copy(meta);
 	}
-
-	return NULL;
+	RequestReturn* metas = core_search(query, 1, SCI_SORT_RELEVANCE, 0, true, priv);
+	document_meta_free(query);
+
+	char* text = NULL;
+	if(metas && metas->count > 0 && metas->documents[0])
+		text = g_strdup(((struct CoreData*)metas->documents[0]->backendData)->fullText);
+	request_return_free(metas);
+	return text;
 }
 
 static char* core_get_arxiv_pdf_url(const char* arxivUrl)
@@ -394,52 +493,52 @@ static char* core_get_arxiv_pdf_url(const char* arxivUrl)
 	return urlWithExtension;
 }
 
-static PdfData* core_get_document_pdf_data(const DocumentMeta* meta, void* userData)
+static DocumentMeta* core_get_pdf_meta(const DocumentMeta* meta, struct CorePriv* priv)
 {
-	sci_module_log(LL_DEBUG, "%s got meta from %i", __func__, meta->backendId);
-	struct CorePriv* priv = userData;
-	DocumentMeta* pdfMeta = NULL;
-
 	if(meta->backendId == priv->id)
-	{
-		pdfMeta = document_meta_copy(meta);
-	}
-	else
-	{
-		if(meta->doi)
-			pdfMeta = sci_find_by_doi(meta->doi, priv->id);
-		if(!pdfMeta)
-		{
-			sci_module_log(LL_DEBUG, "unable to fill for doi %s to get pdf", meta->doi);
-			return NULL;
-		}
-	}
+		return document_meta_ref(meta);
 
+	DocumentMeta* pdfMeta = NULL;
+	if(meta->doi)
+		pdfMeta = sci_find_by_doi(meta->doi, priv->id);
+	if(!pdfMeta)
+		sci_module_log(LL_DEBUG, "unable to fill for doi %s to get pdf", meta->doi);
+	return pdfMeta;
+}
+
+static char* core_get_pdf_url(const DocumentMeta* pdfMeta)
+{
 	if(!pdfMeta->downloadUrl)
 		return NULL;
 
 	sci_module_log(LL_DEBUG, "Trying to get pdf from %s", pdfMeta->downloadUrl);
-	char* url;
-	bool freeUrl = false;
-	if(g_strstr_len(pdfMeta->downloadUrl, -1, "arxiv.org") != NULL)
-	{
-		url = core_get_arxiv_pdf_url(pdfMeta->downloadUrl);
-		if(!url)
-		{
-			sci_module_log(LL_DEBUG, "Url is from arxiv, but unable to find real pdf url");
-			return NULL;
-		}
+	if(g_strstr_len(pdfMeta->downloadUrl, -1, "arxiv.org") == NULL)
+		return g_strdup(pdfMeta->downloadUrl);
+
+	char* url = core_get_arxiv_pdf_url(pdfMeta->downloadUrl);
+	if(url)
 		sci_module_log(LL_DEBUG, "Url is from arxiv, diverting to %s", url);
-		freeUrl = true;
-	}
 	else
-	{
-		url = pdfMeta->downloadUrl;
-	}
+		sci_module_log(LL_DEBUG, "Url is from arxiv, but unable to find real pdf url");
+	return url;
+}
+
+static PdfData* core_get_document_pdf_data(const DocumentMeta* meta, void* userData)
+{
+	sci_module_log(LL_DEBUG, "%s got meta from %i", __func__, meta->backendId);
+	struct CorePriv* priv = userData;
+
+	DocumentMeta* pdfMeta = core_get_pdf_meta(meta, priv);
+	if(!pdfMeta)
+		return NULL;
 
-	PdfData* pdfData = wgetPdf(url, priv->timeout);
-	if(freeUrl)
+	PdfData* pdfData = NULL;
+	char* url = core_get_pdf_url(pdfMeta);
+	if(url)
+	{
+		pdfData = wgetPdf(url, priv->timeout);
 		g_free(url);
+	}
 
 	if(pdfData)
 		pdfData->meta = pdfMeta;
@@ -449,21 +548,50 @@ static PdfData* core_get_document_pdf_data(const DocumentMeta* meta, void* userD
 	return pdfData;
 }
 
+static bool core_save_document_pdf(const DocumentMeta* meta, const char* fileName, void* userData)
+{
+	sci_module_log(LL_DEBUG, "%s got meta from %i", __func__, meta->backendId);
+	struct CorePriv* priv = userData;
+
+	DocumentMeta* pdfMeta = core_get_pdf_meta(meta, priv);
+	if(!pdfMeta)
+		return false;
+
+	bool saved = false;
+	char* url = core_get_pdf_url(pdfMeta);
+	if(url)
+	{
+		saved = wgetPdfToFile(url, priv->timeout, fileName);
+		g_free(url);
+	}
+	document_meta_free(pdfMeta);
+
+	return saved;
+}
+
 G_MODULE_EXPORT const gchar *sci_module_init(void** data);
 const gchar *sci_module_init(void** data)
 {
 	struct CorePriv* priv = g_malloc0(sizeof(*priv));
+	g_mutex_init(&priv->pagingLock);
 
 	priv->rateLimit = sci_conf_get_int("Core", "RateLimit", 10, NULL);
+	wsetRateLimit(CORE_API_BASE_URL, priv->rateLimit);
 	priv->apiKey = sci_conf_get_string("Core", "ApiKey", NULL, NULL);
 	priv->timeout = sci_conf_get_int("Core", "Timeout", 20, NULL);
-	priv->retry = sci_conf_get_int("Core", "Retry", 1, NULL);
+	priv->retry = MAX(sci_conf_get_int("Core", "Retry", 1, NULL), 1);
+	// Core/Retry counts all attempts, the http layer counts the retries after the first one
+	wsetRetry(CORE_API_BASE_URL, priv->retry - 1);
 	*data = priv;
 
 	if(!priv->apiKey)
 		return "This module can not work without an api key, you must set this key in Core/ApiKey in the config file";
 
+	priv->projection = core_create_projection(false);
+	priv->fullTextProjection = core_create_projection(true);
+
 	priv->id = sci_plugin_register(&backend_info, core_fill_meta, core_get_document_text, core_get_document_pdf_data, priv);
+	sci_plugin_register_save_document_pdf(priv->id, core_save_document_pdf);
 
 	return NULL;
 }
@@ -476,5 +604,8 @@ void sci_module_exit(void* data)
 	g_free(priv->apiKey);
 	g_free(priv->scrollId);
 	document_meta_free(priv->lastDocument);
+	nx_json_projection_free(priv->projection);
+	nx_json_projection_free(priv->fullTextProjection);
+	g_mutex_clear(&priv->pagingLock);
 	g_free(priv);
 }
@@ -19,6 +19,7 @@
 #include <glib.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "sci-modules.h"
 #include "sci-log.h"
@@ -42,8 +43,9 @@ static BackendInfo backend_info = {
 #define CROSSREF_URL_DOMAIN  "https://api.crossref.org/"
 #define CROSSREF_METHOD_WORKS "works"
 #define CROSSREF_METHOD_JOURNALS "journals"
-#define CROSSREF_SELECT "DOI,ISSN,abstract,author,publisher,reference,volume,title,issue,page,published,created"
+#define CROSSREF_SELECT "DOI,ISSN,abstract,author,publisher,volume,title,issue,page,published,created"
 #define CROSSREF_QUERY_ITEM_LIMIT 1000
+#define CROSSREF_DOI_BATCH 50
 
 struct CrPriv
 {
@@ -51,8 +53,43 @@ struct CrPriv
 	int rateLimit;
 	int id;
 	int timeout;
+	nx_json_projection* workProjection;
+	nx_json_projection* workListProjection;
 };
 
+// the fields of a work that cf_parse_work_json reads, everything else is skipped while parsing
+static const char* const crossrefWorkFields[] = {
+	"URL",
+	"author.given",
+	"author.family",
+	"published.date-parts",
+	"published-print.date-parts",
+	"is-referenced-by-count",
+	"referance",
+	"publisher",
+	"volume",
+	"title",
+	"abstract",
+	"DOI",
+	"ISSN",
+	NULL
+};
+
+static nx_json_projection* cf_create_work_projection(const char* workPath)
+{
+	nx_json_projection* projection = nx_json_projection_new();
+	nx_json_projection_add(projection, "status");
+	nx_json_projection_add(projection, "message-type");
+	nx_json_projection_add(projection, "message.total-results");
+	for(size_t i = 0; crossrefWorkFields[i]; ++i)
+	{
+		char* path = g_strconcat(workPath, ".", crossrefWorkFields[i], NULL);
+		nx_json_projection_add(projection, path);
+		g_free(path);
+	}
+	return projection;
+}
+
 static GString* cf_create_url(struct CrPriv *priv, const char* method, GSList* queryList)
 {
 	GString* url = g_string_new(CROSSREF_URL_DOMAIN);
@@ -92,48 +129,99 @@ static const nx_json* cf_get_message(const nx_json* const json, const char* cons
 	return message;
 }
 
-static void cf_add_information_from_journal(DocumentMeta* meta, struct CrPriv* priv)
+static void cf_journal_done(GString* jsonText, void* userData)
 {
-	if(!meta->issn || (meta->publisher && meta->journal))
-		return;
+	GPtrArray* metas = userData;
+
+	if(jsonText)
+	{
+		const nx_json* json = nx_json_parse_utf8(jsonText->str);
+		const nx_json* messageNode = cf_get_message(json, "journal");
+		if(messageNode)
+		{
+			for(size_t i = 0; i < metas->len; ++i)
+			{
+				DocumentMeta* meta = g_ptr_array_index(metas, i);
+				if(!meta->publisher)
+					meta->publisher = document_meta_strdup(meta, nx_json_get(messageNode, "publisher")->text_value);
+				if(!meta->journal)
+					meta->journal = document_meta_strdup(meta, nx_json_get(messageNode, "title")->text_value);
+			}
+		}
+		if(json)
+			nx_json_free(json);
+		g_string_free(jsonText, true);
+	}
 
-	sci_module_log(LL_DEBUG, "adding journal info");
+	g_ptr_array_free(metas, true);
+}
 
-	GString* url = g_string_new(CROSSREF_URL_DOMAIN);
-	g_string_append(url, CROSSREF_METHOD_JOURNALS);
-	g_string_append_c(url, '/');
-	g_string_append(url, meta->issn);
+static void cf_add_information_from_journals(DocumentMeta** metas, size_t count, struct CrPriv* priv)
+{
+	GHashTable* journals = g_hash_table_new(g_str_hash, g_str_equal);
 
-	GString* jsonText = wgetUrl(url->str, priv->timeout);
-	if(!jsonText)
+	for(size_t i = 0; i < count; ++i)
+	{
+		DocumentMeta* meta = metas[i];
+		if(!meta || !meta->issn || (meta->publisher && meta->journal))
+			continue;
+
+		GPtrArray* journalMetas = g_hash_table_lookup(journals, meta->issn);
+		if(!journalMetas)
+		{
+			journalMetas = g_ptr_array_new();
+			g_hash_table_insert(journals, meta->issn, journalMetas);
+		}
+		g_ptr_array_add(journalMetas, meta);
+	}
+
+	if(g_hash_table_size(journals) == 0)
+	{
+		g_hash_table_destroy(journals);
 		return;
+	}
 
-	const nx_json* json = nx_json_parse_utf8(jsonText->str);
+	sci_module_log(LL_DEBUG, "adding journal info from %u journals", g_hash_table_size(journals));
 
-	if(json)
+	WRequestSet* requests = wrequest_set_new();
+	GHashTableIter iter;
+	gpointer issn;
+	gpointer journalMetas;
+	g_hash_table_iter_init(&iter, journals);
+	while(g_hash_table_iter_next(&iter, &issn, &journalMetas))
 	{
-		const nx_json* messageNode = cf_get_message(json, "journal");
-		if(messageNode)
+		if(!requests)
 		{
-			if(!meta->publisher)
-				meta->publisher = g_strdup(nx_json_get(messageNode, "publisher")->text_value);
-			if(!meta->journal)
-			meta->journal = g_strdup(nx_json_get(messageNode, "title")->text_value);
+			g_ptr_array_free(journalMetas, true);
+			continue;
 		}
-		nx_json_free(json);
+
+		char* method = g_strconcat(CROSSREF_METHOD_JOURNALS, "/", (const char*)issn, NULL);
+		GString* url = cf_create_url(priv, method, NULL);
+		g_free(method);
+		wrequest_set_add_get(requests, url->str, priv->timeout, cf_journal_done, journalMetas);
+		g_string_free(url, true);
+	}
+
+	if(requests)
+	{
+		wrequest_set_wait(requests);
+		wrequest_set_free(requests);
 	}
-	g_string_free(jsonText, true);
+	g_hash_table_destroy(journals);
 }
 
-static DocumentMeta* cf_parse_work_json(const nx_json* json, const DocumentMeta* metaIn, struct CrPriv* priv)
+static DocumentMeta* cf_parse_work_json(const nx_json* json, const DocumentMeta* metaIn, SciArena* arena)
 {
 	if(!json)
 		return NULL;
 
-	DocumentMeta* meta = metaIn ? document_meta_copy(metaIn) : document_meta_new();
+	DocumentMeta* meta = arena ? document_meta_new_arena(arena) : document_meta_new();
+	if(metaIn)
+		meta->doi = document_meta_strdup(meta, metaIn->doi);
 
 	meta->compleatedLookup = true;
-	meta->url    = g_strdup(nx_json_get(json, "URL")->text_value);
+	meta->url = document_meta_strdup(meta, nx_json_get(json, "URL")->text_value);
 	const nx_json* authorArray = nx_json_get(json, "author");
 	GString* authorString = g_string_new(NULL);
 	for(size_t i = 0; i < authorArray->length; ++i)
@@ -154,7 +242,7 @@ static DocumentMeta* cf_parse_work_json(const nx_json* json, const DocumentMeta*
 		if(i < authorArray->length-1)
 			g_string_append(authorString, ", ");
 	}
-	meta->author = g_strdup(authorString->str);
+	meta->author = document_meta_strdup(meta, authorString->str);
 	g_string_free(authorString, true);
 
 	const nx_json* publishedArray = nx_json_get(nx_json_get(json, "published"), "date-parts");
@@ -180,7 +268,7 @@ static DocumentMeta* cf_parse_work_json(const nx_json* json, const DocumentMeta*
 	const nx_json* journalNode = nx_json_get(json, "referance");
 	if(journalNode != NX_JSON_NULL )
 	{
-		meta->journal = g_strdup(nx_json_get(journalNode, "journal-title")->text_value);
+		meta->journal = document_meta_strdup(meta, nx_json_get(journalNode, "journal-title")->text_value);
 
 		if(!meta->year)
 		{
@@ -189,21 +277,22 @@ static DocumentMeta* cf_parse_work_json(const nx_json* json, const DocumentMeta*
 				meta->year = g_ascii_strtoull(yearStr, NULL, 10);
 		}
 	}
-	meta->publisher = g_strdup(nx_json_get(json, "publisher")->text_value);
-	meta->volume = g_strdup(nx_json_get(json, "volume")->text_value);
+	meta->publisher = document_meta_strdup(meta, nx_json_get(json, "publisher")->text_value);
+	meta->volume = document_meta_strdup(meta, nx_json_get(json, "volume")->text_value);
 
 	const nx_json* titleArray = nx_json_get(json, "title");
-	meta->title = g_strdup(nx_json_item(titleArray, 0)->text_value);
-	meta->abstract = g_strdup(nx_json_get(json, "abstract")->text_value);
+	meta->title = document_meta_strdup(meta, nx_json_item(titleArray, 0)->text_value);
+	meta->abstract = document_meta_strdup(meta, nx_json_get(json, "abstract")->text_value);
 
 	if(!meta->doi)
-		meta->doi = g_strdup(nx_json_get(json, "DOI")->text_value);
+		meta->doi = document_meta_strdup(meta, nx_json_get(json, "DOI")->text_value);
 
 	const nx_json* issnArray = nx_json_get(json, "ISSN");
 	if(issnArray->type == NX_JSON_ARRAY && issnArray->length > 0)
-		meta->issn = g_strdup(nx_json_item(issnArray, 0)->text_value);
+		meta->issn = document_meta_strdup(meta, nx_json_item(issnArray, 0)->text_value);
 
-	cf_add_information_from_journal(meta, priv);
+	// the remaining fields of metaIn are only taken where crossref has none, its backend data belongs to another backend
+	document_meta_combine(meta, metaIn);
 
 	return meta;
 }
@@ -224,12 +313,12 @@ static RequestReturn* cf_fill_from_doi(const DocumentMeta* meta, struct CrPriv*
 
 	if(jsonText)
 	{
-		const nx_json* json = nx_json_parse_utf8(jsonText->str);
+		const nx_json* json = nx_json_parse_projected(jsonText->str, priv->workProjection, nx_json_unicode_to_utf8);
 		if(json)
 		{
 			const nx_json* message = cf_get_message(json, "work");
 			if(message)
-				filledMeta = cf_parse_work_json(message, meta, priv);
+				filledMeta = cf_parse_work_json(message, meta, NULL);
 			else
 				sci_module_log(LL_WARN, "%s: got invalid entry without a message node", __func__);
 			nx_json_free(json);
@@ -238,6 +327,7 @@ static RequestReturn* cf_fill_from_doi(const DocumentMeta* meta, struct CrPriv*
 
 	if(filledMeta)
 	{
+		cf_add_information_from_journals(&filledMeta, 1, priv);
 		filledMeta->backendId = priv->id;
 		ret = request_return_new(1, 1);
 		ret->totalCount = 1;
@@ -254,6 +344,34 @@ static RequestReturn* cf_fill_from_doi(const DocumentMeta* meta, struct CrPriv*
 	return ret;
 }
 
+struct CfWorkList
+{
+	GPtrArray* documents;
+	SciArena* arena;
+	size_t maxCount;
+	struct CrPriv* priv;
+};
+
+static void cf_work_list_item(const nx_json* item, void* userData)
+{
+	struct CfWorkList* list = userData;
+
+	if(list->documents->len >= list->maxCount)
+		return;
+
+	if(item->type != NX_JSON_NULL)
+	{
+		DocumentMeta* meta = cf_parse_work_json(item, NULL, list->arena);
+		meta->backendId = list->priv->id;
+		g_ptr_array_add(list->documents, meta);
+	}
+	else
+	{
+		g_ptr_array_add(list->documents, NULL);
+		sci_module_log(LL_WARN, "%s: invalid array item", __func__);
+	}
+}
+
 static RequestReturn* cf_fill_try_work_query(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortingMode, size_t page, struct CrPriv* priv)
 {
 	GSList* queryList = NULL;
@@ -309,47 +427,44 @@ static RequestReturn* cf_fill_try_work_query(const DocumentMeta* meta, size_t ma
 
 	GString* url = cf_create_url(priv, CROSSREF_METHOD_WORKS, queryList);
 	sci_module_log(LL_DEBUG, "%s: %s", __func__, url->str);
-	GString* jsonText = wgetUrl(url->str, priv->timeout);
-	if(jsonText)
+	// works are parsed as they arrive, the remaining json only holds the message header.
+	// The works of a page all live in one arena that is handed to the RequestReturn
+	struct CfWorkList list = {
+		.documents = g_ptr_array_new_with_free_func((GDestroyNotify)document_meta_free),
+		.arena = sci_arena_new(),
+		.maxCount = maxCount,
+		.priv = priv
+	};
+	const nx_json* json = wgetJson(url->str, priv->timeout, "message.items", priv->workListProjection, cf_work_list_item, &list);
+	const nx_json* messageNode = cf_get_message(json, "work-list");
+	if(messageNode)
 	{
-		sci_module_log(LL_DEBUG, "got text");
-		const nx_json* json = nx_json_parse_utf8(jsonText->str);
-		const nx_json* messageNode = cf_get_message(json, "work-list");
-		if(messageNode)
-		{
-			long long int totalResults = nx_json_get(messageNode, "total-results")->int_value;
-				sci_module_log(LL_DEBUG, "%s: got %lli results of which %zu will be processed",
-				__func__, totalResults, (totalResults > maxCount ? maxCount : (size_t)totalResults));
+		long long int totalResults = nx_json_get(messageNode, "total-results")->int_value;
+			sci_module_log(LL_DEBUG, "%s: got %lli results of which %u will be processed",
+			__func__, totalResults, list.documents->len);
 
-			const nx_json* arrayNode = nx_json_get(messageNode, "items");
-			if(arrayNode->type == NX_JSON_ARRAY)
-			{
-				documents = request_return_new(arrayNode->length < maxCount ? arrayNode->length : maxCount, maxCount);
-				documents->page = page;
-				documents->totalCount = totalResults;
-				for(size_t i = 0; i < documents->count; ++i)
-				{
-					const nx_json* item = nx_json_item(arrayNode, i);
-					if(item->type != NX_JSON_NULL)
-					{
-						documents->documents[i] = cf_parse_work_json(item, NULL, priv);
-						documents->documents[i]->backendId = priv->id;
-					}
-					else
-					{
-						documents->documents[i] = NULL;
-						sci_module_log(LL_WARN, "%s: invalid array item", __func__);
-					}
-				}
-			}
-			else
+		if(nx_json_get(messageNode, "items")->type == NX_JSON_ARRAY)
+		{
+			documents = request_return_new_arena(list.documents->len, maxCount, list.arena);
+			list.arena = NULL;
+			documents->page = page;
+			documents->totalCount = totalResults;
+			for(size_t i = 0; i < documents->count; ++i)
 			{
-				sci_module_log(LL_WARN, "%s: No items array node in work list", __func__);
+				documents->documents[i] = g_ptr_array_index(list.documents, i);
+				g_ptr_array_index(list.documents, i) = NULL;
 			}
+			cf_add_information_from_journals(documents->documents, documents->count, priv);
+		}
+		else
+		{
+			sci_module_log(LL_WARN, "%s: No items array node in work list", __func__);
 		}
-		g_string_free(jsonText, true);
-		nx_json_free(json);
 	}
+	if(json)
+		nx_json_free(json);
+	g_ptr_array_free(list.documents, true);
+	sci_arena_unref(list.arena);
 	g_string_free(url, true);
 	return documents;
 }
@@ -369,14 +484,134 @@ static RequestReturn* cf_fill_meta_in(const DocumentMeta* meta, size_t maxCount,
 	return cf_fill_try_work_query(meta, maxCount, sortingMode, page, priv);
 }
 
+static void cf_find_doi_batch(const char** dois, const size_t* indices, size_t count, DocumentMeta** results,
+							  bool* answered, struct CrPriv* priv)
+{
+	// a doi may be given several times, each is asked for once and the work found is handed to all of its indices
+	GString* filter = g_string_new(NULL);
+	GHashTable* indicesByDoi = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+	for(size_t i = 0; i < count; ++i)
+	{
+		char* doi = g_ascii_strdown(dois[indices[i]], -1);
+		GArray* doiIndices = g_hash_table_lookup(indicesByDoi, doi);
+		if(!doiIndices)
+		{
+			if(filter->len > 0)
+				g_string_append_c(filter, ',');
+			g_string_append(filter, "doi:");
+			g_string_append(filter, dois[indices[i]]);
+			doiIndices = g_array_new(false, false, sizeof(size_t));
+			g_hash_table_insert(indicesByDoi, doi, doiIndices);
+		}
+		else
+		{
+			g_free(doi);
+		}
+		g_array_append_val(doiIndices, indices[i]);
+	}
+
+	GSList* queryList = NULL;
+	queryList = g_slist_prepend(queryList, pair_new("filter", filter->str));
+	char* intStr = g_strdup_printf("%u", g_hash_table_size(indicesByDoi));
+	queryList = g_slist_prepend(queryList, pair_new("rows", intStr));
+	g_free(intStr);
+	queryList = g_slist_prepend(queryList, pair_new("select", CROSSREF_SELECT));
+
+	GString* url = cf_create_url(priv, CROSSREF_METHOD_WORKS, queryList);
+	sci_module_log(LL_DEBUG, "%s: %s", __func__, url->str);
+	struct CfWorkList list = {
+		.documents = g_ptr_array_new_with_free_func((GDestroyNotify)document_meta_free),
+		.arena = sci_arena_new(),
+		.maxCount = g_hash_table_size(indicesByDoi),
+		.priv = priv
+	};
+	const nx_json* json = wgetJson(url->str, priv->timeout, "message.items", priv->workListProjection, cf_work_list_item, &list);
+	if(cf_get_message(json, "work-list"))
+	{
+		DocumentMeta** found = g_malloc0(sizeof(*found)*list.documents->len);
+		GArray** foundIndices = g_malloc0(sizeof(*foundIndices)*list.documents->len);
+		size_t foundCount = 0;
+		for(size_t i = 0; i < list.documents->len; ++i)
+		{
+			DocumentMeta* meta = g_ptr_array_index(list.documents, i);
+			if(!meta || !meta->doi)
+				continue;
+
+			// crossref returns the works in no particular order and dois are case insensitive
+			char* doi = g_ascii_strdown(meta->doi, -1);
+			GArray* doiIndices = g_hash_table_lookup(indicesByDoi, doi);
+			g_free(doi);
+			if(!doiIndices || results[g_array_index(doiIndices, size_t, 0)])
+				continue;
+
+			results[g_array_index(doiIndices, size_t, 0)] = meta;
+			foundIndices[foundCount] = doiIndices;
+			found[foundCount++] = meta;
+			g_ptr_array_index(list.documents, i) = NULL;
+		}
+		sci_module_log(LL_DEBUG, "%s: found %zu of %u dois", __func__, foundCount, g_hash_table_size(indicesByDoi));
+		// crossref answered for every doi of the batch, the ones missing from the response are not known to it
+		for(size_t i = 0; i < count; ++i)
+			answered[indices[i]] = true;
+		cf_add_information_from_journals(found, foundCount, priv);
+
+		// repeated dois get their own copy, as the caller is free to modify every result
+		for(size_t i = 0; i < foundCount; ++i)
+		{
+			for(guint j = 1; j < foundIndices[i]->len; ++j)
+				results[g_array_index(foundIndices[i], size_t, j)] = document_meta_copy(found[i]);
+		}
+		g_free(foundIndices);
+		g_free(found);
+	}
+
+	if(json)
+		nx_json_free(json);
+	g_ptr_array_free(list.documents, true);
+	sci_arena_unref(list.arena);
+	g_string_free(url, true);
+	g_hash_table_destroy(indicesByDoi);
+	g_string_free(filter, true);
+}
+
+// looks up many dois at once using the doi filter of the works endpoint
+static void cf_find_by_dois(const char** dois, size_t count, DocumentMeta** results, bool* answered, void* userData)
+{
+	struct CrPriv* priv = userData;
+	size_t* indices = g_malloc(sizeof(*indices)*CROSSREF_DOI_BATCH);
+	size_t batchCount = 0;
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		// a comma would split the filter, such dois are left for cf_fill_meta_in
+		if(!dois[i] || strchr(dois[i], ','))
+			continue;
+
+		indices[batchCount++] = i;
+		if(batchCount == CROSSREF_DOI_BATCH)
+		{
+			cf_find_doi_batch(dois, indices, batchCount, results, answered, priv);
+			batchCount = 0;
+		}
+	}
+	if(batchCount > 0)
+		cf_find_doi_batch(dois, indices, batchCount, results, answered, priv);
+
+	g_free(indices);
+}
+
 G_MODULE_EXPORT const gchar *sci_module_init(void** data);
 const gchar *sci_module_init(void** data)
 {
 	struct CrPriv* priv = g_malloc0(sizeof(*priv));
 	priv->id = sci_plugin_register(&backend_info, cf_fill_meta_in, NULL, NULL, priv);
+	sci_plugin_register_find_by_dois(priv->id, cf_find_by_dois);
 	priv->rateLimit = sci_conf_get_int("Crossref", "RateLimit", 10, NULL);
+	wsetRateLimit(CROSSREF_URL_DOMAIN, priv->rateLimit);
 	priv->email = sci_conf_get_string("Crossref", "Email", NULL, NULL);
 	priv->timeout = sci_conf_get_int("Crossref", "Timeout", 20, NULL);
+	priv->workProjection = cf_create_work_projection("message");
+	priv->workListProjection = cf_create_work_projection("message.items");
 	*data = priv;
 	return NULL;
 }
@@ -387,5 +622,7 @@ void sci_module_exit(void* data)
 	struct CrPriv* priv = data;
 	sci_plugin_unregister(priv->id);
 	g_free(priv->email);
+	nx_json_projection_free(priv->workProjection);
+	nx_json_projection_free(priv->workListProjection);
 	g_free(priv);
 }
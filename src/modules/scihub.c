@@ -17,6 +17,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/HTMLparser.h>
 #include "sci-modules.h"
@@ -108,23 +109,16 @@ static char* get_pdf_url_simple(GString* htmlText)
 	return g_strdup(begin);
 }
 
-static PdfData* scihub_get_document_pdf_data(const DocumentMeta* meta, void* userData)
+static char* scihub_get_pdf_url(const DocumentMeta* meta, struct ScihubPriv* priv)
 {
-	sci_module_log(LL_DEBUG, "%s", __func__);
-	struct ScihubPriv* priv = userData;
-
-	if(!meta->doi)
-	{
-		sci_module_log(LL_DEBUG, "scihub works on dois only");
-		return NULL;
-	}
-
 	GString* url = g_string_new(priv->baseUrl);
 	g_string_append(url, meta->doi);
 
 	sci_module_log(LL_WARN, "Geting scihub page from %s", url->str);
 	GString* htmlText = wgetUrl(url->str, priv->timeout);
 	g_string_free(url, true);
+	if(!htmlText)
+		return NULL;
 
 	xmlDocPtr htmlPage = htmlReadMemory(htmlText->str, htmlText->len, "/" ,NULL, XML_PARSE_RECOVER);
 	if(!htmlPage)
@@ -136,29 +130,66 @@ static PdfData* scihub_get_document_pdf_data(const DocumentMeta* meta, void* use
 
 	char* pdfUrl = get_pdf_url(xmlDocGetRootElement(htmlPage));
 
-	PdfData* pdfData = NULL;
 	if(!pdfUrl)
 		pdfUrl = get_pdf_url_simple(htmlText);
 
-	if(pdfUrl)
-	{
-		pdfData = wgetPdf((char*)pdfUrl, priv->timeout);
-		g_free(pdfUrl);
-	}
-	else
-	{
+	if(!pdfUrl)
 		sci_module_log(LL_WARN, "Could not get pdf url from scihub page");
+
+	g_string_free(htmlText, true);
+	xmlFreeDoc(htmlPage);
+
+	return pdfUrl;
+}
+
+static PdfData* scihub_get_document_pdf_data(const DocumentMeta* meta, void* userData)
+{
+	sci_module_log(LL_DEBUG, "%s", __func__);
+	struct ScihubPriv* priv = userData;
+
+	if(!meta->doi)
+	{
+		sci_module_log(LL_DEBUG, "scihub works on dois only");
+		return NULL;
 	}
 
+	char* pdfUrl = scihub_get_pdf_url(meta, priv);
+	if(!pdfUrl)
+		return NULL;
+
+	PdfData* pdfData = wgetPdf(pdfUrl, priv->timeout);
+	g_free(pdfUrl);
+
 	if(!pdfData)
 		sci_module_log(LL_WARN, "Unable to grab pdf from scihub pdf link");
 
-	g_string_free(htmlText, true);
-	xmlFreeDoc(htmlPage);
-
 	return pdfData;
 }
 
+static bool scihub_save_document_pdf(const DocumentMeta* meta, const char* fileName, void* userData)
+{
+	sci_module_log(LL_DEBUG, "%s", __func__);
+	struct ScihubPriv* priv = userData;
+
+	if(!meta->doi)
+	{
+		sci_module_log(LL_DEBUG, "scihub works on dois only");
+		return false;
+	}
+
+	char* pdfUrl = scihub_get_pdf_url(meta, priv);
+	if(!pdfUrl)
+		return false;
+
+	bool saved = wgetPdfToFile(pdfUrl, priv->timeout, fileName);
+	g_free(pdfUrl);
+
+	if(!saved)
+		sci_module_log(LL_WARN, "Unable to grab pdf from scihub pdf link");
+
+	return saved;
+}
+
 
 G_MODULE_EXPORT const gchar *sci_module_init(void** data);
 const gchar *sci_module_init(void** data)
@@ -173,6 +204,7 @@ const gchar *sci_module_init(void** data)
 
 	sci_module_log(LL_DEBUG, "scihub register");
 	priv->id = sci_plugin_register(&backend_info, NULL, NULL, scihub_get_document_pdf_data, priv);
+	sci_plugin_register_save_document_pdf(priv->id, scihub_save_document_pdf);
 
 	return NULL;
 }
@@ -34,12 +34,20 @@ extern "C" {
 
 #include "nxjson.h"
 
-// redefine NX_JSON_CALLOC & NX_JSON_FREE to use custom allocator
-#ifndef NX_JSON_CALLOC
-#define NX_JSON_CALLOC() calloc(1, sizeof(nx_json))
-#define NX_JSON_FREE(json) free((void*)(json))
+// redefine NX_JSON_MALLOC & NX_JSON_FREE to use custom allocator for the arena blocks
+#ifndef NX_JSON_MALLOC
+#define NX_JSON_MALLOC(size) malloc(size)
+#define NX_JSON_FREE(ptr) free((void*)(ptr))
 #endif
 
+// nodes are bump allocated from blocks that grow up to NX_JSON_BLOCK_SIZE_MAX
+#define NX_JSON_BLOCK_SIZE 16384
+#define NX_JSON_BLOCK_SIZE_MAX (1024*1024)
+#define NX_JSON_ALIGN 8
+
+// objects and arrays with at least this many children get an index for constant time lookups
+#define NX_JSON_INDEX_MIN 8
+
 // redefine NX_JSON_REPORT_ERROR to use custom error reporting
 #ifndef NX_JSON_REPORT_ERROR
 #define NX_JSON_REPORT_ERROR(msg, p) fprintf(stderr, "NXJSON PARSE ERROR (%d): " msg " at %s\n", __LINE__, p)
@@ -49,11 +57,82 @@ extern "C" {
 
 static const nx_json dummy={ NX_JSON_NULL };
 
-static nx_json* create_json(nx_json_type type, const char* key, nx_json* parent) {
-  nx_json* js=NX_JSON_CALLOC();
-  assert(js);
-  js->type=type;
-  js->key=key;
+typedef struct nx_json_block {
+  struct nx_json_block* next;
+  size_t size;
+  size_t used;
+} nx_json_block;
+
+// all nodes of a parse session are allocated from one arena, that lives in its first block right in front of the top level node
+typedef struct nx_json_arena {
+  nx_json_block* blocks; // most recent block first
+} nx_json_arena;
+
+#define ALIGN_UP(n) (((n)+NX_JSON_ALIGN-1)&~(size_t)(NX_JSON_ALIGN-1))
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(nx_json_block))
+#define ARENA_HEADER_SIZE ALIGN_UP(sizeof(nx_json_arena))
+#define ARENA_OF(js) ((nx_json_arena*)((char*)(js)-ARENA_HEADER_SIZE))
+
+static nx_json_block* arena_block_new(size_t size, nx_json_block* next) {
+  nx_json_block* block=NX_JSON_MALLOC(size);
+  assert(block);
+  block->next=next;
+  block->size=size;
+  block->used=BLOCK_HEADER_SIZE;
+  return block;
+}
+
+// creates an arena whose first allocation of up to first_size bytes is guaranteed to be placed right after the arena
+static nx_json_arena* arena_new(size_t first_size) {
+  size_t size=BLOCK_HEADER_SIZE+ARENA_HEADER_SIZE+ALIGN_UP(first_size);
+  if (size<NX_JSON_BLOCK_SIZE) size=NX_JSON_BLOCK_SIZE;
+  nx_json_block* block=arena_block_new(size, 0);
+  nx_json_arena* arena=(nx_json_arena*)((char*)block+block->used);
+  block->used+=ARENA_HEADER_SIZE;
+  arena->blocks=block;
+  return arena;
+}
+
+static void* arena_alloc(nx_json_arena* arena, size_t size) {
+  size=ALIGN_UP(size);
+  nx_json_block* block=arena->blocks;
+  if (!block || block->size-block->used<size) {
+    size_t block_size=block ? block->size*2 : NX_JSON_BLOCK_SIZE;
+    if (block_size>NX_JSON_BLOCK_SIZE_MAX) block_size=NX_JSON_BLOCK_SIZE_MAX;
+    if (block_size<BLOCK_HEADER_SIZE+size) block_size=BLOCK_HEADER_SIZE+size;
+    block=arena->blocks=arena_block_new(block_size, block);
+  }
+  void* p=(char*)block+block->used;
+  block->used+=size;
+  memset(p, 0, size);
+  return p;
+}
+
+// frees everything but the most recent block, so that a reused arena quickly stops allocating
+static void arena_reset(nx_json_arena* arena) {
+  nx_json_block* block=arena->blocks;
+  if (!block) return;
+  nx_json_block* p=block->next;
+  while (p) {
+    nx_json_block* next=p->next;
+    NX_JSON_FREE(p);
+    p=next;
+  }
+  block->next=0;
+  block->used=BLOCK_HEADER_SIZE;
+}
+
+static void arena_free(nx_json_arena* arena) {
+  // the arena itself may live in its oldest block
+  nx_json_block* p=arena->blocks;
+  while (p) {
+    nx_json_block* next=p->next;
+    NX_JSON_FREE(p);
+    p=next;
+  }
+}
+
+static void append_json(nx_json* js, nx_json* parent) {
   if (!parent->last_child) {
     parent->child=parent->last_child=js;
   }
@@ -62,18 +141,55 @@ static nx_json* create_json(nx_json_type type, const char* key, nx_json* parent)
     parent->last_child=js;
   }
   parent->length++;
+}
+
+static unsigned int hash_key(const char* key) {
+  // FNV-1a
+  unsigned int hash=2166136261u;
+  while (*key) {
+    hash^=(unsigned char)*key++;
+    hash*=16777619u;
+  }
+  return hash;
+}
+
+static size_t index_capacity(int length) {
+  size_t capacity=16;
+  while (capacity<2*(size_t)length) capacity*=2;
+  return capacity;
+}
+
+// arrays get a vector of their children, objects an open addressing hash table of theirs, keyed by key
+static void index_json(nx_json_arena* arena, nx_json* js) {
+  if (js->length<NX_JSON_INDEX_MIN) return;
+  nx_json* p;
+  if (js->type==NX_JSON_ARRAY) {
+    js->index=arena_alloc(arena, js->length*sizeof(nx_json*));
+    int i=0;
+    for (p=js->child; p; p=p->next) js->index[i++]=p;
+  }
+  else if (js->type==NX_JSON_OBJECT) {
+    size_t mask=index_capacity(js->length)-1;
+    js->index=arena_alloc(arena, (mask+1)*sizeof(nx_json*));
+    for (p=js->child; p; p=p->next) {
+      if (!p->key) continue;
+      size_t i=hash_key(p->key)&mask;
+      while (js->index[i] && strcmp(js->index[i]->key, p->key)) i=(i+1)&mask;
+      if (!js->index[i]) js->index[i]=p; // on duplicate keys the first one wins, as with the linear search
+    }
+  }
+}
+
+static nx_json* create_json(nx_json_arena* arena, nx_json_type type, const char* key, nx_json* parent) {
+  nx_json* js=arena_alloc(arena, sizeof(nx_json));
+  js->type=type;
+  js->key=key;
+  append_json(js, parent);
   return js;
 }
 
 void nx_json_free(const nx_json* js) {
-  nx_json* p=js->child;
-  nx_json* p1;
-  while (p) {
-    p1=p->next;
-    nx_json_free(p);
-    p=p1;
-  }
-  NX_JSON_FREE(js);
+  arena_free(ARENA_OF(js));
 }
 
 static int unicode_to_utf8(unsigned int codepoint, char* p, char** endp) {
@@ -192,6 +308,131 @@ static char* skip_block_comment(char* p) {
   return p+1;
 }
 
+struct nx_json_projection {
+  char* key;
+  int keep_all; // the whole subtree below this key is kept
+  struct nx_json_projection* children;
+  struct nx_json_projection* next;
+};
+
+nx_json_projection* nx_json_projection_new(void) {
+  nx_json_projection* projection=calloc(1, sizeof(nx_json_projection));
+  assert(projection);
+  return projection;
+}
+
+static void projection_free_children(nx_json_projection* projection) {
+  nx_json_projection* p=projection->children;
+  while (p) {
+    nx_json_projection* next=p->next;
+    nx_json_projection_free(p);
+    p=next;
+  }
+  projection->children=0;
+}
+
+void nx_json_projection_free(nx_json_projection* projection) {
+  if (!projection) return;
+  projection_free_children(projection);
+  free(projection->key);
+  free(projection);
+}
+
+void nx_json_projection_add(nx_json_projection* projection, const char* path) {
+  const char* p=path;
+  while (!projection->keep_all) {
+    const char* end=strchr(p, '.');
+    size_t length=end ? (size_t)(end-p) : strlen(p);
+    nx_json_projection* child;
+    for (child=projection->children; child; child=child->next) {
+      if (strlen(child->key)==length && !strncmp(child->key, p, length)) break;
+    }
+    if (!child) {
+      child=nx_json_projection_new();
+      child->key=malloc(length+1);
+      assert(child->key);
+      memcpy(child->key, p, length);
+      child->key[length]='\0';
+      child->next=projection->children;
+      projection->children=child;
+    }
+    projection=child;
+    if (!end) {
+      projection->keep_all=1;
+      projection_free_children(projection);
+      return;
+    }
+    p=end+1;
+  }
+}
+
+// returns the projection that applies to the value of key, sets *skip if the value is not part of the projection at all
+static const nx_json_projection* projection_child(const nx_json_projection* projection, const char* key, int* skip) {
+  *skip=0;
+  if (!projection || !projection->children) return 0;
+  const nx_json_projection* child;
+  for (child=projection->children; child; child=child->next) {
+    if (!strcmp(child->key, key)) return child;
+  }
+  *skip=1;
+  return 0;
+}
+
+// skips over a value without creating nodes or unescaping anything, comments inside skipped values are not supported
+static char* skip_value(char* p) {
+  char* ps=p;
+  int depth=0;
+  while (1) {
+    switch (*p) {
+      case '\0':
+        NX_JSON_REPORT_ERROR("unexpected end of text", ps);
+        return 0; // error
+      case '"':
+        p++;
+        while (*p!='"') {
+          if (!*p) {
+            NX_JSON_REPORT_ERROR("no closing quote for string", ps);
+            return 0; // error
+          }
+          if (*p=='\\' && p[1]) p++;
+          p++;
+        }
+        p++;
+        if (!depth) return p;
+        break;
+      case '{':
+      case '[':
+        depth++;
+        p++;
+        break;
+      case '}':
+      case ']':
+        if (!depth) { // the key has no value, parse_value rejects this too
+          NX_JSON_REPORT_ERROR("unexpected chars", p);
+          return 0; // error
+        }
+        p++;
+        if (!--depth) return p;
+        break;
+      default:
+        if (!depth && !IS_WHITESPACE(*p) && *p!=',') { // scalar
+          char* pe=p;
+          while (*pe && !IS_WHITESPACE(*pe) && *pe!=',' && *pe!='}' && *pe!=']') pe++;
+          size_t length=pe-p;
+          if (!(*p=='-' || (*p>='0' && *p<='9')) &&
+              !(length==4 && (!strncmp(p, "true", 4) || !strncmp(p, "null", 4))) &&
+              !(length==5 && !strncmp(p, "false", 5))) {
+            NX_JSON_REPORT_ERROR("unexpected chars", p);
+            return 0; // error
+          }
+          return pe;
+        }
+        p++;
+        break;
+    }
+  }
+}
+
 static char* parse_key(const char** key, char* p, nx_json_unicode_encoder encoder) {
   // on '}' return with *p=='}'
   char c;
@@ -238,7 +479,8 @@ static char* parse_key(const char** key, char* p, nx_json_unicode_encoder encode
   return 0; // error
 }
 
-static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unicode_encoder encoder) {
+static char* parse_value(nx_json_arena* arena, nx_json* parent, const char* key, char* p,
+                         nx_json_unicode_encoder encoder, const nx_json_projection* projection) {
   nx_json* js;
   while (1) {
     switch (*p) {
@@ -251,35 +493,44 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         p++;
         break;
       case '{':
-        js=create_json(NX_JSON_OBJECT, key, parent);
+        js=create_json(arena, NX_JSON_OBJECT, key, parent);
         p++;
         while (1) {
           const char* new_key;
           p=parse_key(&new_key, p, encoder);
           if (!p) return 0; // error
-          if (*p=='}') return p+1; // end of object
-          p=parse_value(js, new_key, p, encoder);
+          if (*p=='}') { // end of object
+            index_json(arena, js);
+            return p+1;
+          }
+          int skip;
+          const nx_json_projection* child=projection_child(projection, new_key, &skip);
+          if (skip) p=skip_value(p);
+          else p=parse_value(arena, js, new_key, p, encoder, child);
           if (!p) return 0; // error
         }
       case '[':
-        js=create_json(NX_JSON_ARRAY, key, parent);
+        js=create_json(arena, NX_JSON_ARRAY, key, parent);
         p++;
         while (1) {
-          p=parse_value(js, 0, p, encoder);
+          p=parse_value(arena, js, 0, p, encoder, projection);
           if (!p) return 0; // error
-          if (*p==']') return p+1; // end of array
+          if (*p==']') { // end of array
+            index_json(arena, js);
+            return p+1;
+          }
         }
       case ']':
         return p;
       case '"':
         p++;
-        js=create_json(NX_JSON_STRING, key, parent);
+        js=create_json(arena, NX_JSON_STRING, key, parent);
         js->text_value=unescape_string(p, &p, encoder);
         if (!js->text_value) return 0; // propagate error
         return p;
       case '-': case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
         {
-          js=create_json(NX_JSON_INTEGER, key, parent);
+          js=create_json(arena, NX_JSON_INTEGER, key, parent);
           char* pe;
           errno = 0;
           js->int_value=strtoll(p, &pe, 0);
@@ -303,7 +554,7 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         }
       case 't':
         if (!strncmp(p, "true", 4)) {
-          js=create_json(NX_JSON_BOOL, key, parent);
+          js=create_json(arena, NX_JSON_BOOL, key, parent);
           js->int_value=1;
           return p+4;
         }
@@ -311,7 +562,7 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         return 0; // error
       case 'f':
         if (!strncmp(p, "false", 5)) {
-          js=create_json(NX_JSON_BOOL, key, parent);
+          js=create_json(arena, NX_JSON_BOOL, key, parent);
           js->int_value=0;
           return p+5;
         }
@@ -319,7 +570,7 @@ static char* parse_value(nx_json* parent, const char* key, char* p, nx_json_unic
         return 0; // error
       case 'n':
         if (!strncmp(p, "null", 4)) {
-          create_json(NX_JSON_NULL, key, parent);
+          create_json(arena, NX_JSON_NULL, key, parent);
           return p+4;
         }
         NX_JSON_REPORT_ERROR("unexpected chars", p);
@@ -355,9 +606,15 @@ const nx_json* nx_json_parse_utf8(char* text) {
 }
 
 const nx_json* nx_json_parse(char* text, nx_json_unicode_encoder encoder) {
+  return nx_json_parse_projected(text, 0, encoder);
+}
+
+const nx_json* nx_json_parse_projected(char* text, const nx_json_projection* projection, nx_json_unicode_encoder encoder) {
   nx_json js={0};
-  if (!parse_value(&js, 0, text, encoder)) {
-    if (js.child) nx_json_free(js.child);
+  // the top level node is the first allocation, which puts it right behind the arena, see nx_json_free()
+  nx_json_arena* arena=arena_new(sizeof(nx_json));
+  if (!parse_value(arena, &js, 0, text, encoder, projection) || !js.child) {
+    arena_free(arena);
     return 0;
   }
   return js.child;
@@ -366,6 +623,13 @@ const nx_json* nx_json_parse(char* text, nx_json_unicode_encoder encoder) {
 const nx_json* nx_json_get(const nx_json* json, const char* key) {
   if (!json || !key) return &dummy; // never return null
   nx_json* js;
+  if (json->index && json->type==NX_JSON_OBJECT) {
+    size_t mask=index_capacity(json->length)-1;
+    for (size_t i=hash_key(key)&mask; (js=json->index[i]); i=(i+1)&mask) {
+      if (!strcmp(js->key, key)) return js;
+    }
+    return &dummy; // never return null
+  }
   for (js=json->child; js; js=js->next) {
     if (js->key && !strcmp(js->key, key)) return js;
   }
@@ -375,12 +639,489 @@ const nx_json* nx_json_get(const nx_json* json, const char* key) {
 const nx_json* nx_json_item(const nx_json* json, int idx) {
   if (!json) return &dummy; // never return null
   nx_json* js;
+  if (json->index && json->type==NX_JSON_ARRAY) {
+    if (idx<0 || idx>=json->length) return &dummy; // never return null
+    return json->index[idx];
+  }
   for (js=json->child; js; js=js->next) {
     if (!idx--) return js;
   }
   return &dummy; // never return null
 }
 
+// streaming parser
+
+typedef enum nx_json_stream_state {
+  NXS_VALUE,
+  NXS_VALUE_OR_END,
+  NXS_KEY,
+  NXS_KEY_OR_END,
+  NXS_COLON,
+  NXS_COMMA_OR_END,
+  NXS_DONE
+} nx_json_stream_state;
+
+typedef enum nx_json_stream_token {
+  NXS_TOKEN_NONE,
+  NXS_TOKEN_STRING,
+  NXS_TOKEN_NUMBER,
+  NXS_TOKEN_LITERAL
+} nx_json_stream_token;
+
+typedef struct nx_json_stream_frame {
+  nx_json* js;
+  const nx_json_projection* projection;
+  nx_json_stream_state state;
+  int match; // number of components of the items path this container lies on, -1 if it is off the path
+} nx_json_stream_frame;
+
+struct nx_json_stream {
+  nx_json root;
+  nx_json_arena* arena;
+  nx_json_arena items;
+  int items_depth;
+  nx_json_stream_frame* stack;
+  int depth;
+  int capacity;
+  char** path;
+  int path_length;
+  nx_json_item_callback callback;
+  void* user_data;
+  nx_json_unicode_encoder encoder;
+  nx_json_stream_token token;
+  int escaped;
+  char* buf;
+  size_t buf_length;
+  size_t buf_capacity;
+  char* key;
+  const nx_json_projection* projection;
+  const nx_json_projection* value_projection;
+  int skip_next;
+  int skipping;
+  int skip_started;
+  int skip_depth;
+  int skip_in_string;
+  char skip_literal[6]; // a skipped true, false or null, checked like stream_finish_literal() would
+  int skip_literal_length;
+  int error;
+};
+
+nx_json_stream* nx_json_stream_new(const char* items_path, nx_json_item_callback callback, void* user_data) {
+  nx_json_stream* stream=calloc(1, sizeof(nx_json_stream));
+  assert(stream);
+  stream->callback=callback;
+  stream->user_data=user_data;
+  stream->encoder=unicode_to_utf8;
+  stream->capacity=16;
+  stream->stack=malloc(stream->capacity*sizeof(nx_json_stream_frame));
+  assert(stream->stack);
+  stream->stack[0].js=&stream->root;
+  stream->stack[0].state=NXS_VALUE;
+  stream->stack[0].match=-1;
+  stream->stack[0].projection=0;
+  stream->depth=1;
+
+  if (items_path && *items_path) {
+    const char* p=items_path;
+    stream->path_length=1;
+    while ((p=strchr(p, '.'))) stream->path_length++, p++;
+    stream->path=malloc(stream->path_length*sizeof(char*));
+    assert(stream->path);
+    p=items_path;
+    for (int i=0; i<stream->path_length; i++) {
+      const char* end=strchr(p, '.');
+      size_t length=end ? (size_t)(end-p) : strlen(p);
+      stream->path[i]=malloc(length+1);
+      assert(stream->path[i]);
+      memcpy(stream->path[i], p, length);
+      stream->path[i][length]='\0';
+      p=end+1;
+    }
+  }
+  return stream;
+}
+
+void nx_json_stream_set_projection(nx_json_stream* stream, const nx_json_projection* projection) {
+  stream->projection=projection;
+}
+
+void nx_json_stream_free(nx_json_stream* stream) {
+  if (!stream) return;
+  if (stream->arena) arena_free(stream->arena);
+  arena_free(&stream->items);
+  for (int i=0; i<stream->path_length; i++) free(stream->path[i]);
+  free(stream->path);
+  free(stream->stack);
+  free(stream->buf);
+  free(stream->key);
+  free(stream);
+}
+
+#define STREAM_ERROR(stream, msg, c) do { \
+    char at[2]={(c), '\0'}; \
+    NX_JSON_REPORT_ERROR(msg, at); \
+    (stream)->error=1; \
+  } while (0)
+
+static void stream_buf_append(nx_json_stream* stream, char c) {
+  if (stream->buf_length+1>=stream->buf_capacity) {
+    stream->buf_capacity=stream->buf_capacity ? stream->buf_capacity*2 : 256;
+    stream->buf=realloc(stream->buf, stream->buf_capacity);
+    assert(stream->buf);
+  }
+  stream->buf[stream->buf_length++]=c;
+  stream->buf[stream->buf_length]='\0';
+}
+
+static nx_json_stream_frame* stream_top(nx_json_stream* stream) {
+  return &stream->stack[stream->depth-1];
+}
+
+// the key and the text value are stored right behind the node, as the chunks they came from do not outlive the parser
+static nx_json* stream_create_json(nx_json_stream* stream, nx_json_type type, const char* text) {
+  size_t key_length=stream->key ? strlen(stream->key)+1 : 0;
+  size_t text_length=text ? strlen(text)+1 : 0;
+  size_t size=sizeof(nx_json)+key_length+text_length;
+  nx_json* js;
+  if (stream->items_depth && stream->depth>=stream->items_depth) {
+    // everything below the items array goes to an arena that is recycled once the item is handed out
+    js=arena_alloc(&stream->items, size);
+  }
+  else {
+    if (!stream->arena) stream->arena=arena_new(size);
+    js=arena_alloc(stream->arena, size);
+  }
+  js->type=type;
+  char* strings=(char*)(js+1);
+  if (stream->key) {
+    memcpy(strings, stream->key, key_length);
+    js->key=strings;
+    free(stream->key);
+    stream->key=0;
+  }
+  if (text) {
+    memcpy(strings+key_length, text, text_length);
+    js->text_value=strings+key_length;
+  }
+  append_json(js, stream_top(stream)->js);
+  return js;
+}
+
+static int stream_is_items(nx_json_stream* stream, const nx_json_stream_frame* frame) {
+  return frame->match==stream->path_length && frame->js->type==NX_JSON_ARRAY;
+}
+
+static void stream_value_done(nx_json_stream* stream, nx_json* js) {
+  nx_json_stream_frame* top=stream_top(stream);
+  if (stream->depth==1) {
+    top->state=NXS_DONE;
+    return;
+  }
+  top->state=NXS_COMMA_OR_END;
+  if (stream_is_items(stream, top)) {
+    // items are handed out and dropped right away, so the array never holds more than the item being parsed
+    if (stream->callback) stream->callback(js, stream->user_data);
+    top->js->child=top->js->last_child=0;
+    top->js->length=0;
+    arena_reset(&stream->items);
+  }
+}
+
+static void stream_open(nx_json_stream* stream, nx_json_type type) {
+  nx_json_stream_frame* top=stream_top(stream);
+  int match=-1;
+  const nx_json_projection* projection;
+  if (stream->depth==1) {
+    match=0;
+    projection=stream->projection;
+  }
+  else {
+    if (top->match>=0 && top->match<stream->path_length && stream->key && !strcmp(stream->key, stream->path[top->match]))
+      match=top->match+1;
+    projection=top->js->type==NX_JSON_ARRAY ? top->projection : stream->value_projection;
+  }
+
+  nx_json* js=stream_create_json(stream, type, 0);
+  if (stream->depth==stream->capacity) {
+    stream->capacity*=2;
+    stream->stack=realloc(stream->stack, stream->capacity*sizeof(nx_json_stream_frame));
+    assert(stream->stack);
+  }
+  nx_json_stream_frame* frame=&stream->stack[stream->depth++];
+  frame->js=js;
+  frame->match=match;
+  frame->projection=projection;
+  frame->state=type==NX_JSON_OBJECT ? NXS_KEY_OR_END : NXS_VALUE_OR_END;
+  if (stream_is_items(stream, frame)) stream->items_depth=stream->depth;
+}
+
+static void stream_close(nx_json_stream* stream) {
+  nx_json* js=stream_top(stream)->js;
+  index_json(stream->items_depth && stream->depth>stream->items_depth ? &stream->items : stream->arena, js);
+  if (stream->depth==stream->items_depth) stream->items_depth=0;
+  stream->depth--;
+  stream_value_done(stream, js);
+}
+
+static void stream_finish_string(nx_json_stream* stream) {
+  char* end;
+  stream_buf_append(stream, '"');
+  char* text=unescape_string(stream->buf, &end, stream->encoder);
+  if (!text) {
+    stream->error=1;
+    return;
+  }
+  nx_json_stream_frame* top=stream_top(stream);
+  if (top->state==NXS_KEY || top->state==NXS_KEY_OR_END) {
+    stream->key=strdup(text);
+    assert(stream->key);
+    stream->value_projection=projection_child(top->projection, text, &stream->skip_next);
+    top->state=NXS_COLON;
+  }
+  else {
+    stream_value_done(stream, stream_create_json(stream, NX_JSON_STRING, text));
+  }
+}
+
+static void stream_finish_number(nx_json_stream* stream) {
+  char* pe;
+  errno=0;
+  long long int_value=strtoll(stream->buf, &pe, 0);
+  if (pe==stream->buf || errno==ERANGE) {
+    NX_JSON_REPORT_ERROR("invalid number", stream->buf);
+    stream->error=1;
+    return;
+  }
+  nx_json* js;
+  if (*pe=='.' || *pe=='e' || *pe=='E') {
+    errno=0;
+    double dbl_value=strtod(stream->buf, &pe);
+    if (pe==stream->buf || errno==ERANGE || *pe) {
+      NX_JSON_REPORT_ERROR("invalid number", stream->buf);
+      stream->error=1;
+      return;
+    }
+    js=stream_create_json(stream, NX_JSON_DOUBLE, 0);
+    js->dbl_value=dbl_value;
+  }
+  else if (*pe) {
+    NX_JSON_REPORT_ERROR("invalid number", stream->buf);
+    stream->error=1;
+    return;
+  }
+  else {
+    js=stream_create_json(stream, NX_JSON_INTEGER, 0);
+    js->int_value=int_value;
+    js->dbl_value=int_value;
+  }
+  stream_value_done(stream, js);
+}
+
+static void stream_finish_literal(nx_json_stream* stream) {
+  nx_json* js;
+  if (!strcmp(stream->buf, "true")) {
+    js=stream_create_json(stream, NX_JSON_BOOL, 0);
+    js->int_value=1;
+  }
+  else if (!strcmp(stream->buf, "false")) {
+    js=stream_create_json(stream, NX_JSON_BOOL, 0);
+  }
+  else if (!strcmp(stream->buf, "null")) {
+    js=stream_create_json(stream, NX_JSON_NULL, 0);
+  }
+  else {
+    NX_JSON_REPORT_ERROR("unexpected chars", stream->buf);
+    stream->error=1;
+    return;
+  }
+  stream_value_done(stream, js);
+}
+
+static void stream_finish_token(nx_json_stream* stream) {
+  nx_json_stream_token token=stream->token;
+  stream->token=NXS_TOKEN_NONE;
+  if (token==NXS_TOKEN_NUMBER) stream_finish_number(stream);
+  else if (token==NXS_TOKEN_LITERAL) stream_finish_literal(stream);
+  stream->buf_length=0;
+}
+
+static void stream_begin_token(nx_json_stream* stream, nx_json_stream_token token, char c) {
+  stream->token=token;
+  stream->buf_length=0;
+  if (token!=NXS_TOKEN_STRING) stream_buf_append(stream, c);
+}
+
+static void stream_skip_done(nx_json_stream* stream) {
+  stream->skipping=0;
+  free(stream->key);
+  stream->key=0;
+  stream_top(stream)->state=NXS_COMMA_OR_END;
+}
+
+// consumes the characters of a value that is not part of the projection, returns 0 if c is not part of it anymore
+static int stream_skip(nx_json_stream* stream, char c) {
+  if (stream->skip_in_string) {
+    if (stream->escaped) stream->escaped=0;
+    else if (c=='\\') stream->escaped=1;
+    else if (c=='"') {
+      stream->skip_in_string=0;
+      if (!stream->skip_depth) stream_skip_done(stream);
+    }
+    return 1;
+  }
+
+  if (!stream->skip_started) {
+    if (IS_WHITESPACE(c)) return 1;
+    if (!strchr("\"{[-0123456789tfn", c)) {
+      STREAM_ERROR(stream, "unexpected chars", c);
+      return 1;
+    }
+    stream->skip_started=1;
+    stream->skip_literal_length=0;
+    if (c=='t' || c=='f' || c=='n') {
+      stream->skip_literal[stream->skip_literal_length++]=c;
+      return 1;
+    }
+  }
+  else if (!stream->skip_depth) { // inside a number or literal
+    if (IS_WHITESPACE(c) || c==',' || c=='}' || c==']') {
+      if (stream->skip_literal_length) {
+        stream->skip_literal[stream->skip_literal_length]='\0';
+        if (strcmp(stream->skip_literal, "true") && strcmp(stream->skip_literal, "false") && strcmp(stream->skip_literal, "null")) {
+          STREAM_ERROR(stream, "unexpected chars", c);
+          return 1;
+        }
+      }
+      stream_skip_done(stream);
+      return 0;
+    }
+    if (stream->skip_literal_length) {
+      if (stream->skip_literal_length>=5) {
+        STREAM_ERROR(stream, "unexpected chars", c);
+        return 1;
+      }
+      stream->skip_literal[stream->skip_literal_length++]=c;
+    }
+    return 1;
+  }
+
+  switch (c) {
+    case '"':
+      stream->skip_in_string=1;
+      break;
+    case '{':
+    case '[':
+      stream->skip_depth++;
+      break;
+    case '}':
+    case ']':
+      if (!--stream->skip_depth) stream_skip_done(stream);
+      break;
+    default:
+      break;
+  }
+  return 1;
+}
+
+int nx_json_stream_feed(nx_json_stream* stream, const char* data, size_t length) {
+  for (size_t i=0; i<length && !stream->error; i++) {
+    char c=data[i];
+
+    if (stream->skipping && stream_skip(stream, c)) continue;
+
+    if (stream->token==NXS_TOKEN_STRING) {
+      if (stream->escaped) stream->escaped=0;
+      else if (c=='\\') stream->escaped=1;
+      else if (c=='"') {
+        stream->token=NXS_TOKEN_NONE;
+        stream_finish_string(stream);
+        stream->buf_length=0;
+        continue;
+      }
+      stream_buf_append(stream, c);
+      continue;
+    }
+    else if (stream->token==NXS_TOKEN_NUMBER) {
+      if ((c>='0' && c<='9') || c=='.' || c=='e' || c=='E' || c=='+' || c=='-' || c=='x' || c=='X') {
+        stream_buf_append(stream, c);
+        continue;
+      }
+      stream_finish_token(stream);
+      if (stream->error) break;
+    }
+    else if (stream->token==NXS_TOKEN_LITERAL) {
+      if (c>='a' && c<='z') {
+        stream_buf_append(stream, c);
+        continue;
+      }
+      stream_finish_token(stream);
+      if (stream->error) break;
+    }
+
+    if (IS_WHITESPACE(c)) continue;
+
+    nx_json_stream_frame* top=stream_top(stream);
+    switch (top->state) {
+      case NXS_VALUE:
+      case NXS_VALUE_OR_END:
+        if (c=='{') stream_open(stream, NX_JSON_OBJECT);
+        else if (c=='[') stream_open(stream, NX_JSON_ARRAY);
+        else if (c=='"') stream_begin_token(stream, NXS_TOKEN_STRING, c);
+        else if (c=='-' || (c>='0' && c<='9')) stream_begin_token(stream, NXS_TOKEN_NUMBER, c);
+        else if (c=='t' || c=='f' || c=='n') stream_begin_token(stream, NXS_TOKEN_LITERAL, c);
+        else if (c==']' && top->state==NXS_VALUE_OR_END) stream_close(stream);
+        else STREAM_ERROR(stream, "unexpected chars", c);
+        break;
+      case NXS_KEY:
+      case NXS_KEY_OR_END:
+        if (c=='"') stream_begin_token(stream, NXS_TOKEN_STRING, c);
+        else if (c=='}' && top->state==NXS_KEY_OR_END) stream_close(stream);
+        else STREAM_ERROR(stream, "unexpected chars", c);
+        break;
+      case NXS_COLON:
+        if (c!=':') {
+          STREAM_ERROR(stream, "unexpected chars", c);
+        }
+        else if (stream->skip_next) {
+          stream->skip_next=0;
+          stream->skipping=1;
+          stream->skip_started=0;
+          stream->skip_depth=0;
+          top->state=NXS_VALUE;
+        }
+        else {
+          top->state=NXS_VALUE;
+        }
+        break;
+      case NXS_COMMA_OR_END:
+        if (c==',') top->state=top->js->type==NX_JSON_OBJECT ? NXS_KEY : NXS_VALUE;
+        else if (c=='}' && top->js->type==NX_JSON_OBJECT) stream_close(stream);
+        else if (c==']' && top->js->type==NX_JSON_ARRAY) stream_close(stream);
+        else STREAM_ERROR(stream, "unexpected chars", c);
+        break;
+      case NXS_DONE:
+        STREAM_ERROR(stream, "unexpected chars after end of text", c);
+        break;
+    }
+  }
+  return !stream->error;
+}
+
+const nx_json* nx_json_stream_finish(nx_json_stream* stream) {
+  const nx_json* js=0;
+  if (!stream->error && stream->token!=NXS_TOKEN_STRING) stream_finish_token(stream);
+  if (!stream->error && stream->depth==1 && stream_top(stream)->state==NXS_DONE) {
+    js=stream->root.child;
+    stream->root.child=stream->root.last_child=0;
+    stream->arena=0;
+  }
+  else if (!stream->error) {
+    NX_JSON_REPORT_ERROR("unexpected end of text", "");
+  }
+  nx_json_stream_free(stream);
+  return js;
+}
+
 
 #ifdef  __cplusplus
 }
@@ -44,6 +44,7 @@ static struct argp_option options[] =
   {"doi",				'i', "[STRING]",0,	"Search for a specific doi" },
   {"dry-run",			'd', 0,			0,	"Just show how many results there are"},
   {"out-dir",			'o', "[DIRECTORY]",	0,	"Place to save output" },
+  {"corpus",			'c', "[DIRECTORY]",	0,	"Add results to the corpus in this directory instead of saving individual files" },
   {"limit",				'l', "[NUMBER]",	0,	"Maximum number of results to process" },
   {"pdf",				'p', 0,				0,		"Save pdf"},
   {"full-text",			'f', 0,				0,		"Save full text"},
@@ -66,6 +67,7 @@ struct Config
 	std::string backend;
 	std::string author;
 	std::filesystem::path outDir = "./out";
+	std::filesystem::path corpusDir;
 	size_t maxNumber = 10;
 	bool dryRun = false;
 	bool fullText = false;
@@ -110,6 +112,9 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	case 'o':
 		config->outDir.assign(arg);
 		break;
+	case 'c':
+		config->corpusDir.assign(arg);
+		break;
 	case 'j':
 		config->journal.assign(arg);
 		break;
@@ -0,0 +1,258 @@
+/**
+ * @file sci-async.c
+ * Asynchronous api of SCIPAPER
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * scipaper is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * scipaper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with scipaper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <stdlib.h>
+
+#include "sci-async.h"
+#include "sci-conf.h"
+#include "sci-log.h"
+#include "scipaper.h"
+#include "async.h"
+
+typedef enum {
+	SCI_REQUEST_FILL_META = 0,
+	SCI_REQUEST_FIND_BY_DOI,
+	SCI_REQUEST_TEXT,
+	SCI_REQUEST_PDF,
+	SCI_REQUEST_SAVE,
+} request_type_t;
+
+struct _SciRequest
+{
+	request_type_t type;
+	gint cancelled;
+	GMainContext* context;
+	void (*callback)(void);
+	void* userData;
+
+	DocumentMeta* meta;
+	FillReqest fill;
+	bool hasFill;
+	size_t maxCount;
+	sorting_mode_t sortMode;
+	size_t page;
+	char* fileName;
+
+	void* result;
+	bool success;
+};
+
+static GThreadPool* pool;
+static gint shuttingDown;
+
+static void sci_request_free(SciRequest* request)
+{
+	document_meta_unref(request->meta);
+	g_free(request->fileName);
+	g_main_context_unref(request->context);
+	g_free(request);
+}
+
+// runs on the context of the request
+static gboolean sci_request_complete(gpointer data)
+{
+	SciRequest* request = data;
+	bool cancelled = g_atomic_int_get(&request->cancelled);
+
+	switch(request->type)
+	{
+		case SCI_REQUEST_FILL_META:
+			if(cancelled)
+			{
+				request_return_free(request->result);
+				request->result = NULL;
+			}
+			((sci_fill_meta_cb)request->callback)(request, request->result, request->userData);
+			break;
+		case SCI_REQUEST_FIND_BY_DOI:
+			if(cancelled)
+			{
+				document_meta_unref(request->result);
+				request->result = NULL;
+			}
+			((sci_document_meta_cb)request->callback)(request, request->result, request->userData);
+			break;
+		case SCI_REQUEST_TEXT:
+			if(cancelled)
+			{
+				free(request->result);
+				request->result = NULL;
+			}
+			((sci_text_cb)request->callback)(request, request->result, request->userData);
+			break;
+		case SCI_REQUEST_PDF:
+			if(cancelled && request->result)
+			{
+				pdf_data_free(request->result);
+				request->result = NULL;
+			}
+			((sci_pdf_cb)request->callback)(request, request->result, request->userData);
+			break;
+		case SCI_REQUEST_SAVE:
+			((sci_save_cb)request->callback)(request, request->success && !cancelled, request->userData);
+			break;
+	}
+
+	sci_request_free(request);
+	return G_SOURCE_REMOVE;
+}
+
+// runs on a worker thread
+static void sci_request_run(gpointer data, gpointer userData)
+{
+	SciRequest* request = data;
+
+	if(g_atomic_int_get(&shuttingDown))
+		g_atomic_int_set(&request->cancelled, true);
+
+	if(!g_atomic_int_get(&request->cancelled))
+	{
+		switch(request->type)
+		{
+			case SCI_REQUEST_FILL_META:
+				request->result = sci_fill_meta(request->meta, request->hasFill ? &request->fill : NULL,
+												request->maxCount, request->sortMode, request->page);
+				break;
+			case SCI_REQUEST_FIND_BY_DOI:
+				request->result = sci_find_by_doi(request->meta->doi, request->meta->backendId);
+				break;
+			case SCI_REQUEST_TEXT:
+				request->result = sci_get_document_text(request->meta);
+				break;
+			case SCI_REQUEST_PDF:
+				request->result = sci_get_document_pdf_data(request->meta);
+				break;
+			case SCI_REQUEST_SAVE:
+				request->success = sci_save_document_to_file(request->meta, request->fileName);
+				break;
+		}
+	}
+
+	// an idle source is used instead of g_main_context_invoke(), as that could run the callback on this thread
+	GSource* source = g_idle_source_new();
+	g_source_set_callback(source, sci_request_complete, request, NULL);
+	g_source_attach(source, request->context);
+	g_source_unref(source);
+}
+
+static SciRequest* sci_request_new(request_type_t type, const DocumentMeta* meta, GMainContext* context,
+								   void (*callback)(void), void* userData)
+{
+	SciRequest* request = g_malloc0(sizeof(*request));
+	request->type = type;
+	request->meta = meta ? document_meta_ref(meta) : document_meta_new();
+	request->context = context ? g_main_context_ref(context) : g_main_context_ref_thread_default();
+	request->callback = callback;
+	request->userData = userData;
+	return request;
+}
+
+static SciRequest* sci_request_push(SciRequest* request)
+{
+	GError* error = NULL;
+	if(!pool || !g_thread_pool_push(pool, request, &error))
+	{
+		sci_log(LL_ERR, "%s: Could not queue request: %s", __func__, error ? error->message : "not initalized");
+		g_clear_error(&error);
+		g_atomic_int_set(&request->cancelled, true);
+		GSource* source = g_idle_source_new();
+		g_source_set_callback(source, sci_request_complete, request, NULL);
+		g_source_attach(source, request->context);
+		g_source_unref(source);
+	}
+	return request;
+}
+
+SciRequest* sci_fill_meta_async(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount, sorting_mode_t sortMode,
+								size_t page, GMainContext* context, sci_fill_meta_cb callback, void* userData)
+{
+	SciRequest* request = sci_request_new(SCI_REQUEST_FILL_META, meta, context, (void (*)(void))callback, userData);
+	if(fill)
+	{
+		request->fill = *fill;
+		request->hasFill = true;
+	}
+	request->maxCount = maxCount;
+	request->sortMode = sortMode;
+	request->page = page;
+	return sci_request_push(request);
+}
+
+SciRequest* sci_find_by_doi_async(const char* doi, int backendId, GMainContext* context,
+								  sci_document_meta_cb callback, void* userData)
+{
+	SciRequest* request = sci_request_new(SCI_REQUEST_FIND_BY_DOI, NULL, context, (void (*)(void))callback, userData);
+	request->meta->doi = g_strdup(doi);
+	request->meta->backendId = backendId;
+	return sci_request_push(request);
+}
+
+SciRequest* sci_get_document_text_async(const DocumentMeta* meta, GMainContext* context, sci_text_cb callback, void* userData)
+{
+	SciRequest* request = sci_request_new(SCI_REQUEST_TEXT, meta, context, (void (*)(void))callback, userData);
+	return sci_request_push(request);
+}
+
+SciRequest* sci_get_document_pdf_data_async(const DocumentMeta* meta, GMainContext* context, sci_pdf_cb callback, void* userData)
+{
+	SciRequest* request = sci_request_new(SCI_REQUEST_PDF, meta, context, (void (*)(void))callback, userData);
+	return sci_request_push(request);
+}
+
+SciRequest* sci_save_document_to_file_async(const DocumentMeta* meta, const char* fileName, GMainContext* context,
+											sci_save_cb callback, void* userData)
+{
+	SciRequest* request = sci_request_new(SCI_REQUEST_SAVE, meta, context, (void (*)(void))callback, userData);
+	request->fileName = g_strdup(fileName);
+	return sci_request_push(request);
+}
+
+void sci_request_cancel(SciRequest* request)
+{
+	g_atomic_int_set(&request->cancelled, true);
+}
+
+bool sci_request_is_cancelled(const SciRequest* request)
+{
+	return g_atomic_int_get(&request->cancelled);
+}
+
+bool sci_async_init(void)
+{
+	int threads = sci_conf_get_int("Dispatch", "AsyncThreads", 16, NULL);
+	GError* error = NULL;
+	pool = g_thread_pool_new(sci_request_run, NULL, threads > 0 ? threads : 1, false, &error);
+	if(!pool)
+	{
+		sci_log(LL_ERR, "%s: Could not create worker pool: %s", __func__, error->message);
+		g_error_free(error);
+		return false;
+	}
+	return true;
+}
+
+void sci_async_exit(void)
+{
+	if(!pool)
+		return;
+
+	// queued requests still run, but only to deliver their cancellation
+	g_atomic_int_set(&shuttingDown, true);
+	g_thread_pool_free(pool, false, true);
+	pool = NULL;
+}
@@ -23,22 +23,123 @@
 #include <stdbool.h>
 
 #include "sci-log.h"
+#include "sci-diskcache.h"
+#include "utils.h"
+
+typedef enum {
+	SCI_BACKEND_OP_META = 0,
+	SCI_BACKEND_OP_TEXT,
+	SCI_BACKEND_OP_PDF,
+	SCI_BACKEND_OP_COUNT,
+} backend_op_t;
+
+typedef enum {
+	SCI_BREAKER_CLOSED = 0,
+	SCI_BREAKER_OPEN,
+	SCI_BREAKER_HALF_OPEN,
+} breaker_state_t;
+
+/* Moving averages of the latency in ms and of the fraction of calls that returned a result,
+ * as well as the state of the circuit breaker that stops calls to a backend whose server is failing */
+struct SciBackendStats
+{
+	double latency;
+	double success;
+	unsigned int calls;
+	gint64 lastCall;
+	breaker_state_t breaker;
+	int failures;
+	gint64 openedAt;
+};
 
 struct SciBackend
 {
 	RequestReturn* (*fill_meta)(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page, void* user_data);
 	char* (*get_document_text)(const DocumentMeta* meta, void* user_data);
 	PdfData* (*get_document_pdf_data)(const DocumentMeta* meta, void* user_data);
+	bool (*save_document_pdf)(const DocumentMeta* meta, const char* fileName, void* user_data);
+	void (*find_by_dois)(const char** dois, size_t count, DocumentMeta** results, bool* answered, void* user_data);
 	int id;
 	const BackendInfo* backend_info;
 	void* user_data;
+	int active;
+	struct SciBackendStats stats[SCI_BACKEND_OP_COUNT];
 };
 
+#define SCI_BACKEND_STATS_WEIGHT 0.2
+#define SCI_BACKEND_MIN_SUCCESS 0.05
+#define SCI_BACKEND_PROBE_INTERVAL (60*G_TIME_SPAN_SECOND)
+
+/* The registered backends, guarded by backendsLock. Callers work on snapshots of the list taken with sci_backends_snapshot(),
+ * every backend in a snapshot is counted in its active member so that it is not freed while it is in use */
 static GSList *backends;
 static const BackendInfo** backendsArray;
+static GMutex backendsLock;
+static GCond backendsIdle;
+
+static GMutex statsLock;
+static bool adaptiveOrder = true;
+static int breakerThreshold = 5;
+static gint64 breakerCooldown = 30000;
+
+static dispatch_mode_t dispatchMode = SCI_DISPATCH_SERIAL;
+static gint64 dispatchTimeout = 30000;
+static int completionThreads = 8;
+
+struct SciCompletion
+{
+	const DocumentMeta* document;
+	const FillReqest* fill;
+	GPtrArray* sources;
+};
+
+/* The parallel dispatch modes run the backend calls of all sci_fill_meta() calls in this many shared threads,
+ * calls beyond that wait for a thread to become free */
+#define SCI_FANOUT_THREADS 32
+static GThreadPool* fanoutPool;
+
+struct SciFanout
+{
+	GMutex lock;
+	GCond cond;
+	int refcount;
+	size_t pending;
+	RequestReturn** results;
+	size_t backendCount;
+	int first;
+	bool failed;
+	DocumentMeta* meta;
+	size_t maxCount;
+	sorting_mode_t sortMode;
+	size_t page;
+};
+
+struct SciFanoutJob
+{
+	struct SciFanout* fanout;
+	struct SciBackend* backend;
+	size_t index;
+};
+
+struct SciResultCacheEntry
+{
+	char* key;
+	RequestReturn* result;
+	GList link;
+};
+
+/* Results of recent sci_fill_meta() calls, the queue is ordered from most to least recently used.
+ * The documents are shared with the callers via their reference count */
+static GMutex resultCacheLock;
+static GHashTable* resultCache;
+static GQueue resultCacheOrder = G_QUEUE_INIT;
+static size_t resultCacheSize = 0;
+static size_t resultCacheHits = 0;
+static size_t resultCacheMisses = 0;
 
 const BackendInfo** sci_get_all_backends(void)
 {
+	g_mutex_lock(&backendsLock);
 	if(!backendsArray)
 	{
 		backendsArray = g_malloc(sizeof(*backendsArray)*(g_slist_length(backends)+1));
@@ -52,20 +153,26 @@ const BackendInfo** sci_get_all_backends(void)
 
 		backendsArray[i] = NULL;
 	}
-	return backendsArray;
+	const BackendInfo** array = backendsArray;
+	g_mutex_unlock(&backendsLock);
+	return array;
 }
 
 const BackendInfo* sci_get_backend_info(int id)
 {
+	const BackendInfo* info = NULL;
+	g_mutex_lock(&backendsLock);
 	for(GSList* element = backends; element; element = element->next)
 	{
 		struct SciBackend* backend = (struct SciBackend*)element->data;
 		if(backend->id == id)
 		{
-			return backend->backend_info;
+			info = backend->backend_info;
+			break;
 		}
 	}
-	return NULL;
+	g_mutex_unlock(&backendsLock);
+	return info;
 }
 
 const char* sci_get_backend_name(int id)
@@ -80,20 +187,27 @@ const char* sci_get_backend_name(int id)
 
 int sci_backend_get_id_by_name(const char* name)
 {
+	int id = 0;
+	g_mutex_lock(&backendsLock);
 	for(GSList* element = backends; element; element = element->next)
 	{
 		struct SciBackend* backend = (struct SciBackend*)element->data;
 		if(g_str_equal(backend->backend_info->name, name))
 		{
-			return backend->id;
+			id = backend->id;
+			break;
 		}
 	}
-	return 0;
+	g_mutex_unlock(&backendsLock);
+	return id;
 }
 
 size_t sci_get_backend_count(void)
 {
-	return g_slist_length(backends);
+	g_mutex_lock(&backendsLock);
+	size_t count = g_slist_length(backends);
+	g_mutex_unlock(&backendsLock);
+	return count;
 }
 
 int sci_plugin_register(const BackendInfo* backend_info,
@@ -105,13 +219,14 @@ int sci_plugin_register(const BackendInfo* backend_info,
 
 	struct SciBackend* backend = g_malloc0(sizeof(*backend));
 
-	backend->id = ++id_counter;
+	backend->id = g_atomic_int_add(&id_counter, 1) + 1;
 	backend->fill_meta = fill_meta_in;
 	backend->get_document_text = get_document_text_in;
 	backend->get_document_pdf_data = get_document_pdf_data_in;
 	backend->backend_info = backend_info;
 	backend->user_data = user_data;
 
+	g_mutex_lock(&backendsLock);
 	backends = g_slist_prepend(backends, backend);
 
 	if(backendsArray)
@@ -119,30 +234,230 @@ int sci_plugin_register(const BackendInfo* backend_info,
 		g_free(backendsArray);
 		backendsArray = NULL;
 	}
-	return id_counter;
+	g_mutex_unlock(&backendsLock);
+	return backend->id;
 }
 
-void sci_plugin_unregister(int id)
+// must be called with backendsLock held
+static struct SciBackend* sci_backend_get_locked(int id)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next)
+	for(GSList* element = backends; element; element = element->next)
 	{
-		struct SciBackend* last_backend = (struct SciBackend*)element->data;
-		if(last_backend->id == id)
-			break;
+		struct SciBackend* backend = (struct SciBackend*)element->data;
+		if(backend->id == id)
+			return backend;
 	}
-	if (!element)
-		sci_log(LL_WARN, "Trying to remove non-existing comm backend with id %d", id);
+	return NULL;
+}
+
+void sci_plugin_register_save_document_pdf(int id, bool (*save_document_pdf_in)(const DocumentMeta* meta, const char* fileName, void* user_data))
+{
+	g_mutex_lock(&backendsLock);
+	struct SciBackend* backend = sci_backend_get_locked(id);
+	if(backend)
+		backend->save_document_pdf = save_document_pdf_in;
+	g_mutex_unlock(&backendsLock);
 
-	g_free(element->data);
+	if(!backend)
+		sci_log(LL_WARN, "Trying to register a pdf saver for non-existing backend with id %d", id);
+}
 
-	backends = g_slist_remove(backends, element->data);
+void sci_plugin_register_find_by_dois(int id, void (*find_by_dois_in)(const char** dois, size_t count, DocumentMeta** results,
+									  bool* answered, void* user_data))
+{
+	g_mutex_lock(&backendsLock);
+	struct SciBackend* backend = sci_backend_get_locked(id);
+	if(backend)
+		backend->find_by_dois = find_by_dois_in;
+	g_mutex_unlock(&backendsLock);
 
+	if(!backend)
+		sci_log(LL_WARN, "Trying to register a batch doi lookup for non-existing backend with id %d", id);
+}
+
+void sci_plugin_unregister(int id)
+{
+	g_mutex_lock(&backendsLock);
+	struct SciBackend* backend = sci_backend_get_locked(id);
+	if(!backend)
+	{
+		g_mutex_unlock(&backendsLock);
+		sci_log(LL_WARN, "Trying to remove non-existing comm backend with id %d", id);
+		return;
+	}
+
+	// removed first so that no new calls are started, then the calls still in flight are waited for
+	backends = g_slist_remove(backends, backend);
 	if(backendsArray)
 	{
 		g_free(backendsArray);
 		backendsArray = NULL;
 	}
+	while(backend->active > 0)
+		g_cond_wait(&backendsIdle, &backendsLock);
+	g_mutex_unlock(&backendsLock);
+
+	g_free(backend);
+}
+
+/* Returns a copy of the backend list in registration order, to be released with sci_backends_release().
+ * The backends in it stay valid until then, even if they are unregistered in the meantime */
+static GSList* sci_backends_snapshot(void)
+{
+	g_mutex_lock(&backendsLock);
+	GSList* snapshot = g_slist_copy(backends);
+	for(GSList* element = snapshot; element; element = element->next)
+		++((struct SciBackend*)element->data)->active;
+	g_mutex_unlock(&backendsLock);
+	return snapshot;
+}
+
+static void sci_backends_release(GSList* snapshot)
+{
+	if(!snapshot)
+		return;
+
+	g_mutex_lock(&backendsLock);
+	for(GSList* element = snapshot; element; element = element->next)
+		--((struct SciBackend*)element->data)->active;
+	g_cond_broadcast(&backendsIdle);
+	g_mutex_unlock(&backendsLock);
+	g_slist_free(snapshot);
+}
+
+static const char* backend_op_name(backend_op_t op)
+{
+	switch(op)
+	{
+		case SCI_BACKEND_OP_META:
+			return "metadata";
+		case SCI_BACKEND_OP_TEXT:
+			return "text";
+		case SCI_BACKEND_OP_PDF:
+			return "pdf";
+		default:
+			return NULL;
+	}
+}
+
+/* Checks the circuit breaker of a backend, if this returns true the call must be made and recorded with backend_record().
+ * Once the cooldown of an open breaker has passed, a single call is let through as a probe */
+static bool backend_call_allowed(struct SciBackend* backend, backend_op_t op)
+{
+	bool allowed = true;
+	g_mutex_lock(&statsLock);
+	struct SciBackendStats* stats = &backend->stats[op];
+	if(stats->breaker == SCI_BREAKER_OPEN && g_get_monotonic_time() - stats->openedAt >= breakerCooldown*G_TIME_SPAN_MILLISECOND)
+	{
+		sci_log(LL_DEBUG, "%s: probing %s of %s", __func__, backend_op_name(op), backend->backend_info->name);
+		stats->breaker = SCI_BREAKER_HALF_OPEN;
+	}
+	else if(stats->breaker != SCI_BREAKER_CLOSED)
+	{
+		allowed = false;
+	}
+	g_mutex_unlock(&statsLock);
+
+	if(!allowed)
+		sci_log(LL_DEBUG, "%s: skipping %s of %s, its server is failing", __func__, backend_op_name(op), backend->backend_info->name);
+	return allowed;
+}
+
+/* The state of the calling thread at the start of a backend call, the failure count is compared instead of reset,
+ * as backends may call into libscipaper themselves and such nested calls are recorded on their own */
+struct SciBackendCall
+{
+	gint64 start;
+	unsigned int failures;
+};
+
+static struct SciBackendCall backend_call_begin(void)
+{
+	struct SciBackendCall call = {g_get_monotonic_time(), wgetFailureCount()};
+	return call;
+}
+
+/* Records the outcome of a call to a backend, a call counts as failed for the circuit breaker if it returned
+ * nothing and some of its requests failed due to the network or the server, as opposed to simply finding nothing.
+ * Returns true if some of the requests of the call failed, in which case finding nothing is not a real answer */
+static bool backend_record(struct SciBackend* backend, backend_op_t op, const struct SciBackendCall* call, bool success)
+{
+	gint64 now = g_get_monotonic_time();
+	double latency = (now - call->start)/1000.0;
+	bool transferFailed = wgetFailureCount() != call->failures;
+	bool failed = transferFailed && !success;
+
+	g_mutex_lock(&statsLock);
+	struct SciBackendStats* stats = &backend->stats[op];
+	if(stats->calls == 0)
+	{
+		stats->latency = latency;
+		stats->success = success ? 1.0 : 0.0;
+	}
+	else
+	{
+		stats->latency += SCI_BACKEND_STATS_WEIGHT*(latency - stats->latency);
+		stats->success += SCI_BACKEND_STATS_WEIGHT*((success ? 1.0 : 0.0) - stats->success);
+	}
+	++stats->calls;
+	stats->lastCall = now;
+
+	if(!failed)
+	{
+		if(stats->breaker != SCI_BREAKER_CLOSED)
+			sci_log(LL_INFO, "%s: %s of %s recovered", __func__, backend_op_name(op), backend->backend_info->name);
+		stats->breaker = SCI_BREAKER_CLOSED;
+		stats->failures = 0;
+	}
+	else if(stats->breaker == SCI_BREAKER_HALF_OPEN ||
+		(breakerThreshold > 0 && ++stats->failures >= breakerThreshold && stats->breaker == SCI_BREAKER_CLOSED))
+	{
+		sci_log(LL_WARN, "%s: %s of %s is failing, skipping it for %lims", __func__,
+				backend_op_name(op), backend->backend_info->name, (long)breakerCooldown);
+		stats->breaker = SCI_BREAKER_OPEN;
+		stats->openedAt = now;
+	}
+	g_mutex_unlock(&statsLock);
+	return transferFailed;
+}
+
+/* The expected time until a result is obtained from a backend, backends that have not been called
+ * recently are probed again first, so that a backend that recovered moves back up */
+static double backend_expected_cost(const struct SciBackend* backend, backend_op_t op, gint64 now)
+{
+	const struct SciBackendStats* stats = &backend->stats[op];
+	if(stats->calls == 0 || now - stats->lastCall > SCI_BACKEND_PROBE_INTERVAL)
+		return 0;
+	return stats->latency/MAX(stats->success, SCI_BACKEND_MIN_SUCCESS);
+}
+
+struct SciBackendOrder
+{
+	backend_op_t op;
+	gint64 now;
+};
+
+static gint backend_cost_compare(gconstpointer a, gconstpointer b, gpointer userData)
+{
+	const struct SciBackendOrder* order = userData;
+	double costA = backend_expected_cost(a, order->op, order->now);
+	double costB = backend_expected_cost(b, order->op, order->now);
+	return (costA > costB) - (costA < costB);
+}
+
+/* Returns a snapshot of the backend list, to be released with sci_backends_release(), ordered by expected cost for op.
+ * Backends of equal cost keep their registration order */
+static GSList* sci_backends_ordered(backend_op_t op)
+{
+	GSList* ordered = sci_backends_snapshot();
+	if(!adaptiveOrder || !ordered || !ordered->next)
+		return ordered;
+
+	struct SciBackendOrder order = {op, g_get_monotonic_time()};
+	g_mutex_lock(&statsLock);
+	ordered = g_slist_sort_with_data(ordered, backend_cost_compare, &order);
+	g_mutex_unlock(&statsLock);
+	return ordered;
 }
 
 static bool is_filled_as_requested(const DocumentMeta* meta, const FillReqest* fill)
@@ -181,26 +496,299 @@ static bool is_filled_as_requested(const DocumentMeta* meta, const FillReqest* f
 	return ret;
 }
 
-static void sci_compleat_fill_meta(DocumentMeta* meta, const FillReqest* fill)
+/* Looks up the document with every other backend until it would be filled as requested.
+ * The document itself is not modified here, as this runs in a worker thread and arenas are not thread safe,
+ * instead the metas found are collected in backend order to be combined into the document afterwards */
+static void sci_compleat_collect_sources(gpointer data, gpointer userData)
 {
-	if(!meta->doi)
-		return;
+	struct SciCompletion* completion = data;
+	DocumentMeta* combined = document_meta_copy(completion->document);
 
-	for(GSList *element = backends; element; element = element->next)
+	GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_META);
+	for(GSList *element = ordered; element; element = element->next)
 	{
 		struct SciBackend* backend = element->data;
-		if(backend->id == meta->backendId)
+		if(backend->id == combined->backendId)
 			continue;
 		sci_log(LL_DEBUG, "try filling with %s", sci_get_backend_name(backend->id));
-		DocumentMeta* soruceMeta = sci_find_by_doi(meta->doi, backend->id);
-		document_meta_combine(meta, soruceMeta);
-		if(is_filled_as_requested(meta, fill))
+		DocumentMeta* soruceMeta = sci_find_by_doi(combined->doi, backend->id);
+		if(!soruceMeta)
+			continue;
+		document_meta_combine(combined, soruceMeta);
+		g_ptr_array_add(completion->sources, soruceMeta);
+		if(is_filled_as_requested(combined, completion->fill))
 			break;
 	}
+
+	sci_backends_release(ordered);
+	document_meta_unref(combined);
 }
 
-RequestReturn* sci_fill_meta(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount, sorting_mode_t sortMode, size_t page)
+static void sci_compleat_fill_metas(DocumentMeta** metas, size_t count, const FillReqest* fill)
+{
+	struct SciCompletion* completions = g_malloc0(sizeof(*completions)*count);
+	GThreadPool* pool = NULL;
+	if(count > 1 && completionThreads > 1)
+		pool = g_thread_pool_new(sci_compleat_collect_sources, NULL, MIN(completionThreads, (int)count), false, NULL);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		completions[i].document = metas[i];
+		completions[i].fill = fill;
+		completions[i].sources = g_ptr_array_new_with_free_func((GDestroyNotify)document_meta_unref);
+		if(!metas[i]->doi)
+			continue;
+		if(pool)
+			g_thread_pool_push(pool, &completions[i], NULL);
+		else
+			sci_compleat_collect_sources(&completions[i], NULL);
+	}
+
+	if(pool)
+		g_thread_pool_free(pool, false, true);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(guint j = 0; j < completions[i].sources->len; ++j)
+			document_meta_combine(metas[i], completions[i].sources->pdata[j]);
+		g_ptr_array_free(completions[i].sources, true);
+	}
+	g_free(completions);
+}
+
+static void fill_meta_finish(RequestReturn* newMetas, const DocumentMeta* meta, const FillReqest* fill)
+{
+	// incomplete documents are completed as one batch, so that their lookups can run concurrently
+	GPtrArray* incompleat = g_ptr_array_new();
+	for(size_t i = 0; i < newMetas->count; ++i)
+	{
+		document_meta_combine(newMetas->documents[i], meta);
+		if(meta->backendId == 0 && !is_filled_as_requested(newMetas->documents[i], fill))
+		{
+			sci_log(LL_DEBUG,
+				"%s: Document found by %s but uncompeat filling:", __func__,
+				sci_get_backend_name(newMetas->documents[i]->backendId));
+			g_ptr_array_add(incompleat, newMetas->documents[i]);
+		}
+	}
+
+	sci_compleat_fill_metas((DocumentMeta**)incompleat->pdata, incompleat->len, fill);
+	g_ptr_array_free(incompleat, true);
+
+	for(size_t i = 0; i < newMetas->count; ++i)
+		newMetas->documents[i]->compleatedLookup = true;
+}
+
+static void fanout_unref(struct SciFanout* fanout)
+{
+	g_mutex_lock(&fanout->lock);
+	bool last = --fanout->refcount == 0;
+	g_mutex_unlock(&fanout->lock);
+	if(!last)
+		return;
+
+	for(size_t i = 0; i < fanout->backendCount; ++i)
+		request_return_free(fanout->results[i]);
+	g_free(fanout->results);
+	document_meta_unref(fanout->meta);
+	g_mutex_clear(&fanout->lock);
+	g_cond_clear(&fanout->cond);
+	g_free(fanout);
+}
+
+static void fanout_worker(gpointer data, gpointer userData)
+{
+	(void)userData;
+	struct SciFanoutJob* job = data;
+	struct SciFanout* fanout = job->fanout;
+	struct SciBackend* backend = job->backend;
+
+	struct SciBackendCall call = backend_call_begin();
+	RequestReturn* result = backend->fill_meta(fanout->meta, fanout->maxCount, fanout->sortMode, fanout->page, backend->user_data);
+	if(result && result->count == 0)
+	{
+		request_return_free(result);
+		result = NULL;
+	}
+	bool failed = backend_record(backend, SCI_BACKEND_OP_META, &call, result);
+
+	g_mutex_lock(&fanout->lock);
+	fanout->results[job->index] = result;
+	if(failed)
+		fanout->failed = true;
+	if(result && fanout->first < 0)
+		fanout->first = job->index;
+	--fanout->pending;
+	g_cond_broadcast(&fanout->cond);
+	g_mutex_unlock(&fanout->lock);
+
+	g_mutex_lock(&backendsLock);
+	--backend->active;
+	g_cond_broadcast(&backendsIdle);
+	g_mutex_unlock(&backendsLock);
+
+	fanout_unref(fanout);
+	g_free(job);
+}
+
+static GThreadPool* fanout_pool(void)
+{
+	static gsize initialized = 0;
+	if(g_once_init_enter(&initialized))
+	{
+		fanoutPool = g_thread_pool_new(fanout_worker, NULL, SCI_FANOUT_THREADS, false, NULL);
+		g_once_init_leave(&initialized, 1);
+	}
+	return fanoutPool;
+}
+
+/* Combines the results of several backends, documents with the same DOI are combined into the first occurrence */
+static RequestReturn* fanout_merge(RequestReturn** results, size_t count, size_t maxCount)
+{
+	size_t total = 0;
+	for(size_t i = 0; i < count; ++i)
+		total += results[i] ? results[i]->count : 0;
+
+	RequestReturn* merged = request_return_new(total, maxCount);
+	GHashTable* dois = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	size_t out = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(!results[i])
+			continue;
+
+		merged->page = results[i]->page;
+		if(results[i]->totalCount > merged->totalCount)
+			merged->totalCount = results[i]->totalCount;
+
+		for(size_t j = 0; j < results[i]->count; ++j)
+		{
+			DocumentMeta* document = results[i]->documents[j];
+			if(!document)
+				continue;
+
+			char* doi = document->doi ? g_ascii_strdown(document->doi, -1) : NULL;
+			DocumentMeta* existing = doi ? g_hash_table_lookup(dois, doi) : NULL;
+			if(existing)
+			{
+				document_meta_combine(existing, document);
+				g_free(doi);
+				continue;
+			}
+			if(out >= maxCount)
+			{
+				g_free(doi);
+				continue;
+			}
+
+			// the document keeps its arena alive by itself, so it can be moved out of its RequestReturn
+			merged->documents[out++] = document;
+			results[i]->documents[j] = NULL;
+			if(doi)
+				g_hash_table_insert(dois, doi, document);
+		}
+	}
+	g_hash_table_destroy(dois);
+	merged->count = out;
+	return merged;
+}
+
+static RequestReturn* sci_fill_meta_fanout(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+										   sorting_mode_t sortMode, size_t page, bool* conclusive)
+{
+	struct SciFanout* fanout = g_malloc0(sizeof(*fanout));
+	g_mutex_init(&fanout->lock);
+	g_cond_init(&fanout->cond);
+	GSList* snapshot = sci_backends_snapshot();
+	fanout->backendCount = g_slist_length(snapshot);
+	fanout->results = g_malloc0(sizeof(*fanout->results)*fanout->backendCount);
+	fanout->first = -1;
+	fanout->meta = document_meta_ref(meta);
+	fanout->maxCount = maxCount;
+	fanout->sortMode = sortMode;
+	fanout->page = page;
+	fanout->refcount = 1;
+
+	gint64 deadline = g_get_monotonic_time() + dispatchTimeout*G_TIME_SPAN_MILLISECOND;
+	size_t index = 0;
+	for(GSList *element = snapshot; element; element = element->next, ++index)
+	{
+		struct SciBackend* backend = element->data;
+		if(!backend->fill_meta)
+			continue;
+		if(!backend_call_allowed(backend, SCI_BACKEND_OP_META))
+		{
+			*conclusive = false;
+			continue;
+		}
+
+		sci_log(LL_DEBUG, "%s: Trying to fill using %s", __func__, backend->backend_info->name);
+		struct SciFanoutJob* job = g_malloc0(sizeof(*job));
+		job->fanout = fanout;
+		job->backend = backend;
+		job->index = index;
+
+		g_mutex_lock(&backendsLock);
+		++backend->active;
+		g_mutex_unlock(&backendsLock);
+
+		g_mutex_lock(&fanout->lock);
+		++fanout->refcount;
+		++fanout->pending;
+		g_mutex_unlock(&fanout->lock);
+
+		g_thread_pool_push(fanout_pool(), job, NULL);
+	}
+
+	RequestReturn* result = NULL;
+	g_mutex_lock(&fanout->lock);
+	while(fanout->pending > 0 && !(dispatchMode == SCI_DISPATCH_FIRST_SUCCESS && fanout->first >= 0))
+	{
+		if(!g_cond_wait_until(&fanout->cond, &fanout->lock, deadline))
+			break;
+	}
+
+	if(fanout->pending > 0 && !(dispatchMode == SCI_DISPATCH_FIRST_SUCCESS && fanout->first >= 0))
+	{
+		sci_log(LL_WARN, "%s: %zu backend(s) did not answer in time and are ignored", __func__, fanout->pending);
+		*conclusive = false;
+	}
+	if(fanout->failed)
+		*conclusive = false;
+
+	// results of backends that answer late are freed by the last of them to finish
+	if(dispatchMode == SCI_DISPATCH_FIRST_SUCCESS && fanout->first >= 0)
+	{
+		// the first result is used as is, it does not depend on the backends that have not answered
+		result = fanout->results[fanout->first];
+		fanout->results[fanout->first] = NULL;
+		*conclusive = true;
+	}
+	else if(dispatchMode == SCI_DISPATCH_MERGE)
+	{
+		result = fanout_merge(fanout->results, fanout->backendCount, maxCount);
+		if(result->count == 0)
+		{
+			request_return_free(result);
+			result = NULL;
+		}
+	}
+	g_mutex_unlock(&fanout->lock);
+	fanout_unref(fanout);
+	sci_backends_release(snapshot);
+
+	if(result)
+		fill_meta_finish(result, meta, fill);
+	return result;
+}
+
+/* Asks the backends to fill meta, conclusive is set to false if the result may be incomplete because a backend that
+ * should have been asked was skipped, did not answer in time or had requests fail. A NULL return then does not mean
+ * that there is nothing to find and a merged result may lack the documents of these backends */
+static RequestReturn* sci_fill_meta_from_backends(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+												  sorting_mode_t sortMode, size_t page, bool* conclusive)
 {
+	*conclusive = true;
 	if(meta->backendId != 0 && fill)
 	{
 		sci_log(LL_WARN,
@@ -208,30 +796,43 @@ RequestReturn* sci_fill_meta(const DocumentMeta* meta, const FillReqest* fill, s
 				__func__, meta->backendId);
 	}
 
-	for(GSList *element = backends; element; element = element->next)
+	if(meta->backendId == 0 && dispatchMode != SCI_DISPATCH_SERIAL && sci_get_backend_count() > 1)
 	{
-		struct SciBackend* backend = element->data;
-		if(backend->fill_meta && (meta->backendId == backend->id || meta->backendId == 0))
+		RequestReturn* newMetas = sci_fill_meta_fanout(meta, fill, maxCount, sortMode, page, conclusive);
+		if(newMetas)
+			return newMetas;
+	}
+	else
+	{
+		RequestReturn* newMetas = NULL;
+		GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_META);
+		for(GSList *element = ordered; element && !newMetas; element = element->next)
 		{
-			sci_log(LL_DEBUG, "%s: Trying to fill using %s", __func__, backend->backend_info->name);
-			RequestReturn* newMetas = backend->fill_meta(meta, maxCount, sortMode, page, backend->user_data);
-			if(newMetas)
+			struct SciBackend* backend = element->data;
+			if(!backend->fill_meta || (meta->backendId != backend->id && meta->backendId != 0))
+				continue;
+			if(!backend_call_allowed(backend, SCI_BACKEND_OP_META))
 			{
-				for(size_t i = 0; i < newMetas->count; ++i)
-				{
-					document_meta_combine(newMetas->documents[i], meta);
-					if(meta->backendId == 0 && !is_filled_as_requested(newMetas->documents[i], fill))
-					{
-						sci_log(LL_DEBUG,
-							"%s: Document found by %s but uncompeat filling:", __func__, sci_get_backend_name(backend->id));
-						sci_compleat_fill_meta(newMetas->documents[i], fill);
-					}
-					newMetas->documents[i]->compleatedLookup = true;
-				}
-				return newMetas;
+				*conclusive = false;
+				continue;
 			}
+			sci_log(LL_DEBUG, "%s: Trying to fill using %s", __func__, backend->backend_info->name);
+			struct SciBackendCall call = backend_call_begin();
+			newMetas = backend->fill_meta(meta, maxCount, sortMode, page, backend->user_data);
+			if(backend_record(backend, SCI_BACKEND_OP_META, &call, newMetas))
+				*conclusive = false;
+		}
+		sci_backends_release(ordered);
+
+		if(newMetas)
+		{
+			// only the backend that answered contributes to the result, the ones that failed before it dont matter
+			*conclusive = true;
+			fill_meta_finish(newMetas, meta, fill);
+			return newMetas;
 		}
 	}
+
 	if(meta->backendId == 0)
 		sci_log(LL_WARN, "%s: Unable to fill meta", __func__);
 	else
@@ -240,19 +841,358 @@ RequestReturn* sci_fill_meta(const DocumentMeta* meta, const FillReqest* fill, s
 	return NULL;
 }
 
+static RequestReturn* result_cache_share(const RequestReturn* result)
+{
+	if(!result)
+		return NULL;
+
+	RequestReturn* shared = request_return_new(result->count, result->maxCount);
+	shared->page = result->page;
+	shared->totalCount = result->totalCount;
+	for(size_t i = 0; i < result->count; ++i)
+		shared->documents[i] = result->documents[i] ? document_meta_ref(result->documents[i]) : NULL;
+	return shared;
+}
+
+static void result_cache_entry_free(struct SciResultCacheEntry* entry)
+{
+	g_queue_unlink(&resultCacheOrder, &entry->link);
+	request_return_free(entry->result);
+	g_free(entry->key);
+	g_free(entry);
+}
+
+// must be called with resultCacheLock held
+static void result_cache_trim(size_t size)
+{
+	while(resultCacheOrder.length > size)
+	{
+		struct SciResultCacheEntry* entry = resultCacheOrder.tail->data;
+		g_hash_table_remove(resultCache, entry->key);
+	}
+}
+
+static bool result_cache_get(const char* key, RequestReturn** result)
+{
+	g_mutex_lock(&resultCacheLock);
+	struct SciResultCacheEntry* entry = resultCache ? g_hash_table_lookup(resultCache, key) : NULL;
+	if(entry)
+	{
+		g_queue_unlink(&resultCacheOrder, &entry->link);
+		g_queue_push_head_link(&resultCacheOrder, &entry->link);
+		*result = result_cache_share(entry->result);
+		++resultCacheHits;
+	}
+	else
+	{
+		++resultCacheMisses;
+	}
+	g_mutex_unlock(&resultCacheLock);
+	return entry != NULL;
+}
+
+static void result_cache_put(const char* key, const RequestReturn* result)
+{
+	g_mutex_lock(&resultCacheLock);
+	if(resultCacheSize > 0)
+	{
+		if(!resultCache)
+		{
+			resultCache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+												(GDestroyNotify)result_cache_entry_free);
+		}
+
+		struct SciResultCacheEntry* entry = g_malloc0(sizeof(*entry));
+		entry->key = g_strdup(key);
+		entry->result = result_cache_share(result);
+		entry->link.data = entry;
+		// another thread may have completed the same request in the meantime, the newer result replaces it
+		g_hash_table_replace(resultCache, entry->key, entry);
+		g_queue_push_head_link(&resultCacheOrder, &entry->link);
+		result_cache_trim(resultCacheSize);
+	}
+	g_mutex_unlock(&resultCacheLock);
+}
+
+void sci_set_dispatch_mode(dispatch_mode_t mode, int timeout)
+{
+	dispatchMode = mode;
+	dispatchTimeout = timeout;
+}
+
+void sci_set_circuit_breaker(int threshold, int cooldown)
+{
+	g_mutex_lock(&statsLock);
+	breakerThreshold = threshold;
+	breakerCooldown = cooldown;
+	g_mutex_unlock(&statsLock);
+}
+
+void sci_set_adaptive_order(bool adaptive)
+{
+	adaptiveOrder = adaptive;
+}
+
+void sci_set_completion_threads(int threads)
+{
+	completionThreads = threads;
+}
+
+void sci_result_cache_set_size(size_t entries)
+{
+	g_mutex_lock(&resultCacheLock);
+	resultCacheSize = entries;
+	if(resultCache)
+		result_cache_trim(resultCacheSize);
+	g_mutex_unlock(&resultCacheLock);
+}
+
+void sci_result_cache_flush(void)
+{
+	g_mutex_lock(&resultCacheLock);
+	if(resultCache)
+		g_hash_table_remove_all(resultCache);
+	g_mutex_unlock(&resultCacheLock);
+}
+
+void sci_result_cache_get_stats(size_t* hits, size_t* misses, size_t* entries)
+{
+	g_mutex_lock(&resultCacheLock);
+	if(hits)
+		*hits = resultCacheHits;
+	if(misses)
+		*misses = resultCacheMisses;
+	if(entries)
+		*entries = resultCacheOrder.length;
+	g_mutex_unlock(&resultCacheLock);
+}
+
+/* Looks up a request in the result cache and then in the disk cache, returns true on a hit,
+ * in which case result is set to the cached result, NULL if the request is known to find nothing */
+static bool sci_fill_meta_cached(const char* key, const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+								 sorting_mode_t sortMode, size_t page, RequestReturn** result)
+{
+	if(result_cache_get(key, result))
+		return true;
+
+	bool negative;
+	*result = sci_diskcache_get(meta, fill, maxCount, sortMode, page, &negative);
+	if(!*result && !negative)
+		return false;
+
+	result_cache_put(key, *result);
+	return true;
+}
+
+/* Stores the result of a request in the caches, conclusive tells if the result is the complete answer,
+ * otherwise it stems from a failure, or lacks the part of a backend that failed, and must not be remembered */
+static void sci_fill_meta_store(const char* key, const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+								sorting_mode_t sortMode, size_t page, const RequestReturn* result, bool conclusive)
+{
+	if(!conclusive)
+		return;
+
+	sci_diskcache_put(meta, fill, maxCount, sortMode, page, result);
+	result_cache_put(key, result);
+}
+
+RequestReturn* sci_fill_meta(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount, sorting_mode_t sortMode, size_t page)
+{
+	char* key = sci_diskcache_get_request_hash(meta, fill, maxCount, sortMode, page);
+	RequestReturn* result;
+	if(!sci_fill_meta_cached(key, meta, fill, maxCount, sortMode, page, &result))
+	{
+		bool conclusive;
+		result = sci_fill_meta_from_backends(meta, fill, maxCount, sortMode, page, &conclusive);
+		sci_fill_meta_store(key, meta, fill, maxCount, sortMode, page, result, conclusive);
+	}
+
+	g_free(key);
+	return result;
+}
+
+struct SciDoiLookup
+{
+	const char* doi;
+	int backendId;
+	DocumentMeta** result;
+	const GSList* answered;
+};
+
+/* Looks up a DOI that the batch lookups did not find, the backends in answered already reported this DOI as missing
+ * and are not asked again */
+static void sci_find_by_doi_worker(gpointer data, gpointer userData)
+{
+	struct SciDoiLookup* lookup = data;
+	if(!lookup->answered)
+	{
+		*lookup->result = sci_find_by_doi(lookup->doi, lookup->backendId);
+		return;
+	}
+
+	GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_META);
+	for(GSList *element = ordered; element && !*lookup->result; element = element->next)
+	{
+		struct SciBackend* backend = element->data;
+		if(backend->fill_meta && (lookup->backendId == backend->id || lookup->backendId == 0) &&
+			!g_slist_find((GSList*)lookup->answered, backend))
+		{
+			*lookup->result = sci_find_by_doi(lookup->doi, backend->id);
+		}
+	}
+	sci_backends_release(ordered);
+}
+
+/* Hands all DOIs that are not resolved yet to a backend that can look up many DOIs at once,
+ * the documents found are cached just like the results of sci_find_by_doi().
+ * The backend is added to answeredBy of every DOI it reported as missing, a DOI it did not get an answer for is not added */
+static void sci_find_by_dois_batch(struct SciBackend* backend, const char** dois, size_t count, int backendId,
+								   DocumentMeta** results, bool* resolved, GSList** answeredBy)
+{
+	size_t* indices = g_malloc(sizeof(*indices)*count);
+	const char** pending = g_malloc(sizeof(*pending)*count);
+	size_t pendingCount = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(resolved[i])
+			continue;
+		indices[pendingCount] = i;
+		pending[pendingCount++] = dois[i];
+	}
+
+	if(pendingCount > 0)
+	{
+		sci_log(LL_DEBUG, "%s: looking up %zu dois with %s", __func__, pendingCount, backend->backend_info->name);
+		DocumentMeta** found = g_malloc0(sizeof(*found)*pendingCount);
+		bool* answered = g_malloc0(sizeof(*answered)*pendingCount);
+		struct SciBackendCall call = backend_call_begin();
+		backend->find_by_dois(pending, pendingCount, found, answered, backend->user_data);
+
+		size_t foundCount = 0;
+		for(size_t i = 0; i < pendingCount; ++i)
+		{
+			if(!found[i])
+			{
+				if(answered[i])
+					answeredBy[indices[i]] = g_slist_prepend(answeredBy[indices[i]], backend);
+				continue;
+			}
+
+			DocumentMeta query = {0};
+			query.doi = (char*)pending[i];
+			query.backendId = backendId;
+			document_meta_combine(found[i], &query);
+			found[i]->compleatedLookup = true;
+
+			RequestReturn* result = request_return_new(1, 1);
+			result->totalCount = 1;
+			result->documents[0] = found[i];
+			char* key = sci_diskcache_get_request_hash(&query, NULL, 1, SCI_SORT_RELEVANCE, 0);
+			sci_fill_meta_store(key, &query, NULL, 1, SCI_SORT_RELEVANCE, 0, result, true);
+			g_free(key);
+			result->documents[0] = NULL;
+			request_return_free(result);
+
+			results[indices[i]] = found[i];
+			resolved[indices[i]] = true;
+			++foundCount;
+		}
+		backend_record(backend, SCI_BACKEND_OP_META, &call, foundCount > 0);
+		g_free(answered);
+		g_free(found);
+	}
+
+	g_free(pending);
+	g_free(indices);
+}
+
+DocumentMeta** sci_find_by_dois(const char** dois, size_t count, int backendId)
+{
+	DocumentMeta** results = g_malloc0(sizeof(*results)*count);
+	bool* resolved = g_malloc0(sizeof(*resolved)*count);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		DocumentMeta query = {0};
+		query.doi = (char*)dois[i];
+		query.backendId = backendId;
+		char* key = sci_diskcache_get_request_hash(&query, NULL, 1, SCI_SORT_RELEVANCE, 0);
+		RequestReturn* result;
+		if(sci_fill_meta_cached(key, &query, NULL, 1, SCI_SORT_RELEVANCE, 0, &result))
+		{
+			resolved[i] = true;
+			if(result && result->count > 0 && result->documents[0])
+				results[i] = document_meta_ref(result->documents[0]);
+			request_return_free(result);
+		}
+		g_free(key);
+	}
+
+	// every batch is given all DOIs still unresolved, the backends that reported a DOI as missing are remembered for it
+	GSList** answeredBy = g_malloc0(sizeof(*answeredBy)*count);
+	GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_META);
+	for(GSList *element = ordered; element; element = element->next)
+	{
+		struct SciBackend* backend = element->data;
+		if(backend->find_by_dois && (backendId == backend->id || backendId == 0) &&
+			backend_call_allowed(backend, SCI_BACKEND_OP_META))
+		{
+			sci_find_by_dois_batch(backend, dois, count, backendId, results, resolved, answeredBy);
+		}
+	}
+	sci_backends_release(ordered);
+
+	// whatever could not be found in bulk is looked up one by one, concurrently
+	struct SciDoiLookup* lookups = g_malloc0(sizeof(*lookups)*count);
+	GThreadPool* pool = NULL;
+	if(count > 1 && completionThreads > 1)
+		pool = g_thread_pool_new(sci_find_by_doi_worker, NULL, MIN(completionThreads, (int)count), false, NULL);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(resolved[i])
+			continue;
+		lookups[i].doi = dois[i];
+		lookups[i].backendId = backendId;
+		lookups[i].result = &results[i];
+		lookups[i].answered = answeredBy[i];
+		if(pool)
+			g_thread_pool_push(pool, &lookups[i], NULL);
+		else
+			sci_find_by_doi_worker(&lookups[i], NULL);
+	}
+
+	if(pool)
+		g_thread_pool_free(pool, false, true);
+
+	for(size_t i = 0; i < count; ++i)
+		g_slist_free(answeredBy[i]);
+	g_free(answeredBy);
+	g_free(lookups);
+	g_free(resolved);
+	return results;
+}
+
 char* sci_get_document_text(const DocumentMeta* meta)
 {
-	for(GSList *element = backends; element; element = element->next)
+	char* text = NULL;
+	GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_TEXT);
+	for(GSList *element = ordered; element && !text; element = element->next)
 	{
 		struct SciBackend* backend = element->data;
-		if(backend->get_document_text && (meta->backendId == backend->id || meta->backendId == 0))
+		if(backend->get_document_text && (meta->backendId == backend->id || meta->backendId == 0) &&
+			backend_call_allowed(backend, SCI_BACKEND_OP_TEXT))
 		{
-			char* text = backend->get_document_text(meta, backend->user_data);
-			if(text)
-				return text;
+			struct SciBackendCall call = backend_call_begin();
+			text = backend->get_document_text(meta, backend->user_data);
+			backend_record(backend, SCI_BACKEND_OP_TEXT, &call, text);
 		}
 	}
-	if(meta->backendId == 0)
+	sci_backends_release(ordered);
+
+	if(text)
+		return text;
+	else if(meta->backendId == 0)
 		sci_log(LL_WARN, "%s: Unable to get text", __func__);
 	else
 		sci_log(LL_WARN, "%s: Unable to get text from %s, maybe try without specifying a backend",
@@ -262,22 +1202,91 @@ char* sci_get_document_text(const DocumentMeta* meta)
 
 PdfData* sci_get_document_pdf_data(const DocumentMeta* meta)
 {
+	PdfData* cached = sci_diskcache_get_pdf(meta);
+	if(cached)
+		return cached;
+
 	bool backendAvail = false;
-	for(GSList *element = backends; element; element = element->next)
+	PdfData* data = NULL;
+	GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_PDF);
+	for(GSList *element = ordered; element && !data; element = element->next)
 	{
 		struct SciBackend* backend = element->data;
-		if(backend->get_document_pdf_data && (meta->backendId == backend->id || meta->backendId == 0))
+		if(backend->get_document_pdf_data && (meta->backendId == backend->id || meta->backendId == 0) &&
+			backend_call_allowed(backend, SCI_BACKEND_OP_PDF))
 		{
-			PdfData* data = backend->get_document_pdf_data(meta, backend->user_data);
+			struct SciBackendCall call = backend_call_begin();
+			data = backend->get_document_pdf_data(meta, backend->user_data);
+			backend_record(backend, SCI_BACKEND_OP_PDF, &call, data);
 			backendAvail = true;
-			if(data)
-				return data;
 		}
 	}
-	if(meta->backendId == 0)
+	sci_backends_release(ordered);
+
+	if(data)
+	{
+		sci_diskcache_put_pdf(meta, data->data, data->length);
+		return data;
+	}
+	else if(meta->backendId == 0)
 		sci_log(LL_WARN, "%s: Unable to get pdf data%s", __func__, backendAvail ? "" : " no backend available");
 	else
 		sci_log(LL_WARN, "%s: Unable to get pdf data from %s, maybe try without specifying a backend",
 				__func__, sci_get_backend_name(meta->backendId));
 	return NULL;
 }
+
+bool sci_save_document_to_file(const DocumentMeta* meta, const char* fileName)
+{
+	PdfData* cached = sci_diskcache_get_pdf(meta);
+	if(cached)
+	{
+		bool ret = sci_save_pdf_to_file(cached, fileName);
+		pdf_data_free(cached);
+		return ret;
+	}
+
+	bool saved = false;
+	PdfData* data = NULL;
+	GSList* ordered = sci_backends_ordered(SCI_BACKEND_OP_PDF);
+	for(GSList *element = ordered; element && !saved && !data; element = element->next)
+	{
+		struct SciBackend* backend = element->data;
+		if(meta->backendId != backend->id && meta->backendId != 0)
+			continue;
+		if((!backend->save_document_pdf && !backend->get_document_pdf_data) || !backend_call_allowed(backend, SCI_BACKEND_OP_PDF))
+			continue;
+
+		struct SciBackendCall call = backend_call_begin();
+		if(backend->save_document_pdf)
+		{
+			saved = backend->save_document_pdf(meta, fileName, backend->user_data);
+			backend_record(backend, SCI_BACKEND_OP_PDF, &call, saved);
+		}
+		else if(backend->get_document_pdf_data)
+		{
+			data = backend->get_document_pdf_data(meta, backend->user_data);
+			backend_record(backend, SCI_BACKEND_OP_PDF, &call, data);
+		}
+	}
+	sci_backends_release(ordered);
+
+	if(saved)
+	{
+		sci_diskcache_put_pdf_file(meta, fileName);
+		return true;
+	}
+	else if(data)
+	{
+		sci_diskcache_put_pdf(meta, data->data, data->length);
+		bool ret = sci_save_pdf_to_file(data, fileName);
+		pdf_data_free(data);
+		return ret;
+	}
+	else if(meta->backendId == 0)
+		sci_log(LL_WARN, "%s: Unable to save pdf", __func__);
+	else
+		sci_log(LL_WARN, "%s: Unable to save pdf from %s, maybe try without specifying a backend",
+				__func__, sci_get_backend_name(meta->backendId));
+	return false;
+}
@@ -0,0 +1,436 @@
+/**
+ * @file sci-diskcache.c
+ * Persistent on disk cache of metadata lookups for SCIPAPER
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * scipaper is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * scipaper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with scipaper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sci-diskcache.h"
+#include "sci-conf.h"
+#include "sci-log.h"
+#include "scipaper.h"
+
+/*
+ * Every request is stored in its own file, named after the sha256 of the normalized request and sharded into
+ * subdirectories by the first two hex digits. Files are replaced atomically so that any number of processes may
+ * read the cache while it is written. All integers are little endian, a file is made up of:
+ * magic "SCIK", u16 version, u16 flags, u64 creation time, u64 total count, u64 page, u32 count,
+ * followed by count records, each made up of u32 backend name length, the backend name
+ * and a binary DocumentMeta record as written by document_meta_get_binary().
+ * The backend is stored per record as the documents of a merged result come from different backends.
+ */
+#define DISKCACHE_MAGIC "SCIK"
+#define DISKCACHE_VERSION 2
+#define DISKCACHE_HEADER_SIZE 36
+#define DISKCACHE_FLAG_NEGATIVE 1
+
+/*
+ * Pdfs are stored once per distinct content under pdf/blobs, named after the sha256 of the pdf.
+ * pdf/doi holds one small file per DOI, named after the sha256 of the normalized DOI, containing the hash of its pdf,
+ * so that identical pdfs fetched for different DOIs or from different backends share one blob.
+ */
+#define DISKCACHE_PDF_DIR "pdf"
+#define DISKCACHE_HASH_LENGTH 64
+
+static char* cacheDir = NULL;
+static bool cachePdfs = false;
+static gint64 ttl = 86400;
+static gint64 negativeTtl = 600;
+
+static void diskcache_write_uint(GByteArray* data, uint64_t value, size_t bytes)
+{
+	guint8 buffer[8];
+	for(size_t i = 0; i < bytes; ++i)
+		buffer[i] = (value >> (8*i)) & 0xFF;
+	g_byte_array_append(data, buffer, bytes);
+}
+
+static uint64_t diskcache_read_uint(const unsigned char* data, size_t bytes)
+{
+	uint64_t value = 0;
+	for(size_t i = 0; i < bytes; ++i)
+		value |= (uint64_t)data[i] << (8*i);
+	return value;
+}
+
+static void diskcache_key_append(GString* key, const char* name, const char* value, bool doi)
+{
+	if(!value)
+		return;
+
+	// dois are case insensitive ascii, free text is compared case folded
+	char* normalized = doi ? g_ascii_strdown(value, -1) : g_utf8_casefold(value, -1);
+	g_strstrip(normalized);
+	g_string_append_printf(key, "%s=%zu:%s\n", name, strlen(normalized), normalized);
+	g_free(normalized);
+}
+
+static unsigned int diskcache_fill_mask(const FillReqest* fill)
+{
+	if(!fill)
+		return 0;
+
+	unsigned int mask = 0;
+	mask |= fill->doi << 0;
+	mask |= fill->url << 1;
+	mask |= fill->year << 2;
+	mask |= fill->publisher << 3;
+	mask |= fill->volume << 4;
+	mask |= fill->pages << 5;
+	mask |= fill->author << 6;
+	mask |= fill->title << 7;
+	mask |= fill->journal << 8;
+	mask |= fill->issn << 9;
+	mask |= fill->keywords << 10;
+	mask |= fill->downloadUrl << 11;
+	mask |= fill->abstract << 12;
+	mask |= fill->references << 13;
+	return mask;
+}
+
+char* sci_diskcache_get_request_hash(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+									 sorting_mode_t sortMode, size_t page)
+{
+	// backend ids are assigned at runtime, so the backend is identified by name
+	GString* key = g_string_new("scipaper-diskcache-1\n");
+	g_string_append_printf(key, "backend=%s\n", meta->backendId ? sci_get_backend_name(meta->backendId) : "");
+	diskcache_key_append(key, "doi", meta->doi, true);
+	diskcache_key_append(key, "author", meta->author, false);
+	diskcache_key_append(key, "title", meta->title, false);
+	diskcache_key_append(key, "journal", meta->journal, false);
+	diskcache_key_append(key, "keywords", meta->keywords, false);
+	diskcache_key_append(key, "abstract", meta->abstract, false);
+	diskcache_key_append(key, "text", meta->searchText, false);
+	g_string_append_printf(key, "year=%lu\nfulltext=%i\nfill=%u\nmax=%zu\nsort=%i\npage=%zu\n",
+						   meta->year, meta->hasFullText, diskcache_fill_mask(fill), maxCount, sortMode, page);
+
+	char* hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar*)key->str, key->len);
+	g_string_free(key, true);
+	return hash;
+}
+
+static char* diskcache_path(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount, sorting_mode_t sortMode, size_t page)
+{
+	char* hash = sci_diskcache_get_request_hash(meta, fill, maxCount, sortMode, page);
+	char shard[3] = {hash[0], hash[1], '\0'};
+	char* path = g_build_filename(cacheDir, shard, hash + 2, NULL);
+	g_free(hash);
+	return path;
+}
+
+RequestReturn* sci_diskcache_get(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+								 sorting_mode_t sortMode, size_t page, bool* negative)
+{
+	*negative = false;
+	if(!cacheDir)
+		return NULL;
+
+	char* path = diskcache_path(meta, fill, maxCount, sortMode, page);
+	FILE* file = fopen(path, "rb");
+	g_free(path);
+	if(!file)
+		return NULL;
+
+	unsigned char header[DISKCACHE_HEADER_SIZE];
+	if(fread(header, 1, sizeof(header), file) != sizeof(header) ||
+		memcmp(header, DISKCACHE_MAGIC, 4) != 0 || diskcache_read_uint(header + 4, 2) != DISKCACHE_VERSION)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	unsigned int flags = diskcache_read_uint(header + 6, 2);
+	gint64 age = g_get_real_time()/G_USEC_PER_SEC - (gint64)diskcache_read_uint(header + 8, 8);
+	if(age > ((flags & DISKCACHE_FLAG_NEGATIVE) ? negativeTtl : ttl))
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	if(flags & DISKCACHE_FLAG_NEGATIVE)
+	{
+		sci_log(LL_DEBUG, "%s: negative hit", __func__);
+		fclose(file);
+		*negative = true;
+		return NULL;
+	}
+
+	size_t totalCount = diskcache_read_uint(header + 16, 8);
+	size_t cachedPage = diskcache_read_uint(header + 24, 8);
+	size_t count = diskcache_read_uint(header + 32, 4);
+
+	long end = -1;
+	if(fseek(file, 0, SEEK_END) == 0)
+		end = ftell(file);
+	if(end < DISKCACHE_HEADER_SIZE || count > (size_t)end || fseek(file, DISKCACHE_HEADER_SIZE, SEEK_SET) != 0)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	// the records are read into the arena of the RequestReturn and used in place
+	size_t length = end - DISKCACHE_HEADER_SIZE;
+	SciArena* arena = sci_arena_new();
+	char* data = sci_arena_alloc(arena, length + 1);
+	bool ret = fread(data, 1, length, file) == length;
+	fclose(file);
+	data[length] = '\0';
+	if(!ret)
+	{
+		sci_arena_unref(arena);
+		return NULL;
+	}
+
+	RequestReturn* result = request_return_new_arena(count, maxCount, arena);
+	result->page = cachedPage;
+	result->totalCount = totalCount;
+
+	size_t offset = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		size_t nameLength = 0;
+		if(length - offset >= 4)
+			nameLength = diskcache_read_uint((const unsigned char*)data + offset, 4);
+		if(length - offset < 4 || nameLength > length - offset - 4)
+		{
+			sci_log(LL_WARN, "%s: corrupt cache entry", __func__);
+			request_return_free(result);
+			return NULL;
+		}
+		offset += 4;
+
+		// entries from backends that are not loaded are treated as a miss
+		char* name = g_strndup(data + offset, nameLength);
+		int backendId = sci_backend_get_id_by_name(name);
+		g_free(name);
+		if(backendId == 0)
+		{
+			request_return_free(result);
+			return NULL;
+		}
+		offset += nameLength;
+
+		size_t recordLength;
+		result->documents[i] = document_meta_view_binary(arena, data + offset, length - offset, &recordLength, NULL);
+		if(!result->documents[i])
+		{
+			sci_log(LL_WARN, "%s: corrupt cache entry", __func__);
+			request_return_free(result);
+			return NULL;
+		}
+		result->documents[i]->backendId = backendId;
+		offset += recordLength;
+	}
+
+	sci_log(LL_DEBUG, "%s: hit with %zu documents", __func__, count);
+	return result;
+}
+
+void sci_diskcache_put(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount,
+					   sorting_mode_t sortMode, size_t page, const RequestReturn* result)
+{
+	if(!cacheDir)
+		return;
+
+	size_t count = 0;
+	for(size_t i = 0; result && i < result->count; ++i)
+	{
+		if(result->documents[i])
+			++count;
+	}
+
+	GByteArray* data = g_byte_array_new();
+	g_byte_array_append(data, (const guint8*)DISKCACHE_MAGIC, 4);
+	diskcache_write_uint(data, DISKCACHE_VERSION, 2);
+	diskcache_write_uint(data, result ? 0 : DISKCACHE_FLAG_NEGATIVE, 2);
+	diskcache_write_uint(data, g_get_real_time()/G_USEC_PER_SEC, 8);
+	diskcache_write_uint(data, result ? result->totalCount : 0, 8);
+	diskcache_write_uint(data, result ? result->page : page, 8);
+	diskcache_write_uint(data, count, 4);
+
+	for(size_t i = 0; result && i < result->count; ++i)
+	{
+		if(!result->documents[i])
+			continue;
+
+		const char* backendName = sci_get_backend_name(result->documents[i]->backendId);
+		diskcache_write_uint(data, strlen(backendName), 4);
+		g_byte_array_append(data, (const guint8*)backendName, strlen(backendName));
+
+		size_t length;
+		char* record = document_meta_get_binary(result->documents[i], NULL, &length);
+		if(!record)
+		{
+			g_byte_array_free(data, true);
+			return;
+		}
+		g_byte_array_append(data, (const guint8*)record, length);
+		g_free(record);
+	}
+
+	char* path = diskcache_path(meta, fill, maxCount, sortMode, page);
+	char* dir = g_path_get_dirname(path);
+	GError* error = NULL;
+	// the file is written next to its final name and renamed into place, so concurrent readers never see a partial entry
+	if(g_mkdir_with_parents(dir, 0777) != 0 ||
+		!g_file_set_contents_full(path, (const gchar*)data->data, data->len, G_FILE_SET_CONTENTS_CONSISTENT, 0666, &error))
+	{
+		sci_log(LL_WARN, "%s: Could not write %s: %s", __func__, path, error ? error->message : g_strerror(errno));
+		g_clear_error(&error);
+	}
+
+	g_free(dir);
+	g_free(path);
+	g_byte_array_free(data, true);
+}
+
+static char* diskcache_sharded_path(const char* dir, const char* hash)
+{
+	char shard[3] = {hash[0], hash[1], '\0'};
+	return g_build_filename(cacheDir, DISKCACHE_PDF_DIR, dir, shard, hash + 2, NULL);
+}
+
+static char* diskcache_doi_path(const char* doi)
+{
+	char* normalized = g_ascii_strdown(doi, -1);
+	g_strstrip(normalized);
+	char* hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, normalized, -1);
+	char* path = diskcache_sharded_path("doi", hash);
+	g_free(hash);
+	g_free(normalized);
+	return path;
+}
+
+static bool diskcache_write_file(const char* path, const char* data, size_t length)
+{
+	char* dir = g_path_get_dirname(path);
+	GError* error = NULL;
+	bool ret = g_mkdir_with_parents(dir, 0777) == 0 &&
+		g_file_set_contents_full(path, data, length, G_FILE_SET_CONTENTS_CONSISTENT, 0666, &error);
+	if(!ret)
+	{
+		sci_log(LL_WARN, "%s: Could not write %s: %s", __func__, path, error ? error->message : g_strerror(errno));
+		g_clear_error(&error);
+	}
+	g_free(dir);
+	return ret;
+}
+
+PdfData* sci_diskcache_get_pdf(const DocumentMeta* meta)
+{
+	if(!cacheDir || !cachePdfs || !meta->doi)
+		return NULL;
+
+	char* doiPath = diskcache_doi_path(meta->doi);
+	char* hash = NULL;
+	size_t hashLength = 0;
+	bool ret = g_file_get_contents(doiPath, &hash, &hashLength, NULL);
+	g_free(doiPath);
+	if(!ret || hashLength != DISKCACHE_HASH_LENGTH)
+	{
+		g_free(hash);
+		return NULL;
+	}
+
+	char* blobPath = diskcache_sharded_path("blobs", hash);
+	PdfData* pdf = g_malloc0(sizeof(*pdf));
+	ret = g_file_get_contents(blobPath, (char**)&pdf->data, &pdf->length, NULL);
+	g_free(blobPath);
+
+	// a blob that does not match its name was damaged and is treated as a miss
+	char* blobHash = ret ? g_compute_checksum_for_data(G_CHECKSUM_SHA256, pdf->data, pdf->length) : NULL;
+	if(!blobHash || strcmp(blobHash, hash) != 0)
+	{
+		g_free(blobHash);
+		g_free(hash);
+		g_free(pdf->data);
+		g_free(pdf);
+		return NULL;
+	}
+	g_free(blobHash);
+	g_free(hash);
+
+	pdf->meta = document_meta_ref(meta);
+	sci_log(LL_DEBUG, "%s: hit for %s", __func__, meta->doi);
+	return pdf;
+}
+
+void sci_diskcache_put_pdf(const DocumentMeta* meta, const unsigned char* data, size_t length)
+{
+	if(!cacheDir || !cachePdfs || !meta->doi || !data || length == 0)
+		return;
+
+	char* hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256, data, length);
+	char* blobPath = diskcache_sharded_path("blobs", hash);
+	bool ret = g_file_test(blobPath, G_FILE_TEST_IS_REGULAR) || diskcache_write_file(blobPath, (const char*)data, length);
+	g_free(blobPath);
+
+	if(ret)
+	{
+		char* doiPath = diskcache_doi_path(meta->doi);
+		diskcache_write_file(doiPath, hash, DISKCACHE_HASH_LENGTH);
+		g_free(doiPath);
+	}
+	g_free(hash);
+}
+
+void sci_diskcache_put_pdf_file(const DocumentMeta* meta, const char* fileName)
+{
+	if(!cacheDir || !cachePdfs || !meta->doi)
+		return;
+
+	char* data;
+	size_t length;
+	if(g_file_get_contents(fileName, &data, &length, NULL))
+	{
+		sci_diskcache_put_pdf(meta, (const unsigned char*)data, length);
+		g_free(data);
+	}
+}
+
+bool sci_diskcache_init(void)
+{
+	if(!sci_conf_get_bool(SCI_CONF_CACHE_GROUP, "Enable", false, NULL))
+		return true;
+
+	char* dir = sci_conf_get_string(SCI_CONF_CACHE_GROUP, "Directory", NULL, NULL);
+	if(!dir)
+		dir = g_build_filename(g_get_user_cache_dir(), "scipaper", NULL);
+
+	if(g_mkdir_with_parents(dir, 0777) != 0)
+	{
+		sci_log(LL_WARN, "%s: Could not create %s, the cache is disabled: %s", __func__, dir, g_strerror(errno));
+		g_free(dir);
+		return true;
+	}
+
+	ttl = sci_conf_get_int(SCI_CONF_CACHE_GROUP, "TTL", ttl, NULL);
+	negativeTtl = sci_conf_get_int(SCI_CONF_CACHE_GROUP, "NegativeTTL", negativeTtl, NULL);
+	cachePdfs = sci_conf_get_bool(SCI_CONF_CACHE_GROUP, "Pdf", true, NULL);
+	cacheDir = dir;
+	sci_log(LL_DEBUG, "%s: caching lookups in %s", __func__, cacheDir);
+	return true;
+}
+
+void sci_diskcache_exit(void)
+{
+	g_free(cacheDir);
+	cacheDir = NULL;
+}
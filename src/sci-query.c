@@ -0,0 +1,179 @@
+/**
+ * @file sci-query.c
+ * Iterator over the results of a query that prefetches the following pages, for SCIPAPER
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * scipaper is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * scipaper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with scipaper.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+
+#include "sci-log.h"
+#include "scipaper.h"
+
+struct _SciQuery
+{
+	DocumentMeta* meta;
+	FillReqest fill;
+	bool hasFill;
+	size_t pageSize;
+	sorting_mode_t sortMode;
+	size_t lookahead;
+	size_t totalCount;
+
+	GThread* thread;
+	GMutex lock;
+	GCond cond;
+	GQueue pages;
+	bool waiting;
+	bool finished;
+	bool closing;
+
+	RequestReturn* current;
+	size_t index;
+};
+
+static bool sci_query_is_last_page(const SciQuery* query, const RequestReturn* result, size_t page)
+{
+	if(query->totalCount > 0)
+		return (page + 1)*query->pageSize >= query->totalCount;
+	return !result || result->count < query->pageSize;
+}
+
+/* Fetches the pages after the first one, staying at most lookahead pages ahead of the consumer,
+ * or if lookahead is 0 only fetching a page once the consumer waits for it */
+static gpointer sci_query_prefetch(gpointer data)
+{
+	SciQuery* query = data;
+
+	for(size_t page = 1;; ++page)
+	{
+		g_mutex_lock(&query->lock);
+		while(!query->closing && query->pages.length >= query->lookahead &&
+			!(query->pages.length == 0 && query->waiting))
+		{
+			g_cond_wait(&query->cond, &query->lock);
+		}
+		bool closing = query->closing;
+		g_mutex_unlock(&query->lock);
+		if(closing)
+			break;
+
+		RequestReturn* result = sci_fill_meta(query->meta, query->hasFill ? &query->fill : NULL,
+											  query->pageSize, query->sortMode, page);
+		if(!result)
+			sci_log(LL_WARN, "%s: Could not get page %zu", __func__, page);
+		bool last = sci_query_is_last_page(query, result, page);
+
+		g_mutex_lock(&query->lock);
+		if(result && result->count > 0)
+			g_queue_push_tail(&query->pages, result);
+		else
+			request_return_free(result);
+		query->finished = last;
+		g_cond_broadcast(&query->cond);
+		g_mutex_unlock(&query->lock);
+
+		if(last)
+			break;
+	}
+
+	return NULL;
+}
+
+SciQuery* sci_query_open(const DocumentMeta* meta, const FillReqest* fill, size_t pageSize, sorting_mode_t sortMode, size_t lookahead)
+{
+	RequestReturn* first = sci_fill_meta(meta, fill, pageSize, sortMode, 0);
+	if(!first)
+		return NULL;
+
+	SciQuery* query = g_malloc0(sizeof(*query));
+	query->meta = document_meta_ref(meta);
+	if(fill)
+	{
+		query->fill = *fill;
+		query->hasFill = true;
+	}
+	query->pageSize = pageSize;
+	query->sortMode = sortMode;
+	query->lookahead = lookahead;
+	query->totalCount = first->totalCount;
+	query->current = first;
+	g_mutex_init(&query->lock);
+	g_cond_init(&query->cond);
+	g_queue_init(&query->pages);
+
+	if(pageSize == 0 || sci_query_is_last_page(query, first, 0))
+		query->finished = true;
+	else
+		query->thread = g_thread_new("sci-query", sci_query_prefetch, query);
+
+	return query;
+}
+
+DocumentMeta* sci_query_next(SciQuery* query)
+{
+	while(true)
+	{
+		while(query->current && query->index < query->current->count)
+		{
+			DocumentMeta* document = query->current->documents[query->index++];
+			if(document)
+				return document_meta_ref(document);
+		}
+
+		request_return_free(query->current);
+		query->current = NULL;
+		query->index = 0;
+
+		g_mutex_lock(&query->lock);
+		query->waiting = true;
+		g_cond_broadcast(&query->cond);
+		while(query->pages.length == 0 && !query->finished)
+			g_cond_wait(&query->cond, &query->lock);
+		query->waiting = false;
+		query->current = g_queue_pop_head(&query->pages);
+		// taking a page frees a slot of the lookahead
+		g_cond_broadcast(&query->cond);
+		g_mutex_unlock(&query->lock);
+
+		if(!query->current)
+			return NULL;
+	}
+}
+
+size_t sci_query_get_total_count(const SciQuery* query)
+{
+	return query->totalCount;
+}
+
+void sci_query_close(SciQuery* query)
+{
+	if(!query)
+		return;
+
+	g_mutex_lock(&query->lock);
+	query->closing = true;
+	g_cond_broadcast(&query->cond);
+	g_mutex_unlock(&query->lock);
+
+	// waits for a page that is being fetched, as the backend may not be unloaded before it returns
+	if(query->thread)
+		g_thread_join(query->thread);
+
+	g_queue_clear_full(&query->pages, (GDestroyNotify)request_return_free);
+	request_return_free(query->current);
+	document_meta_unref(query->meta);
+	g_mutex_clear(&query->lock);
+	g_cond_clear(&query->cond);
+	g_free(query);
+}
@@ -25,10 +25,37 @@
 #include "sci-log.h"
 #include "sci-conf.h"
 #include "sci-modules.h"
+#include "sci-diskcache.h"
+#include "sci-async.h"
 #include "scipaper.h"
+#include "utils.h"
 
 static const VersionFixed version = {1, 0, 0};
 
+static void sci_dispatch_init(void)
+{
+	char* modeName = sci_conf_get_string("Dispatch", "Mode", "serial", NULL);
+	dispatch_mode_t mode = SCI_DISPATCH_INVALID;
+	for(dispatch_mode_t i = SCI_DISPATCH_SERIAL; i <= SCI_DISPATCH_MERGE; ++i)
+	{
+		if(g_ascii_strcasecmp(modeName, dispatch_mode_name(i)) == 0)
+			mode = i;
+	}
+
+	if(mode == SCI_DISPATCH_INVALID)
+	{
+		sci_log(LL_WARN, "Unkown dispatch mode %s, using serial", modeName);
+		mode = SCI_DISPATCH_SERIAL;
+	}
+	g_free(modeName);
+
+	sci_set_dispatch_mode(mode, sci_conf_get_int("Dispatch", "Timeout", 30000, NULL));
+	sci_set_circuit_breaker(sci_conf_get_int("Dispatch", "BreakerThreshold", 5, NULL),
+							sci_conf_get_int("Dispatch", "BreakerCooldown", 30000, NULL));
+	sci_set_adaptive_order(sci_conf_get_bool("Dispatch", "AdaptiveOrder", true, NULL));
+	sci_set_completion_threads(sci_conf_get_int("Dispatch", "CompletionThreads", 8, NULL));
+}
+
 bool sci_paper_init(const char* config_file, const char* data, size_t length)
 {
 	sci_log_open("libscipaper", LOG_USER, SCI_LOG_STDERR);
@@ -36,15 +63,33 @@ bool sci_paper_init(const char* config_file, const char* data, size_t length)
 	if(!sci_conf_init(config_file, data, length))
 		return false;
 
+	if(!utils_init())
+		return false;
+
+	if(!sci_diskcache_init())
+		return false;
+
+	int cacheEntries = sci_conf_get_int(SCI_CONF_CACHE_GROUP, "MemoryEntries", 256, NULL);
+	sci_result_cache_set_size(cacheEntries > 0 ? cacheEntries : 0);
+
+	sci_dispatch_init();
+
 	if(!sci_modules_init())
 		return false;
 
+	if(!sci_async_init())
+		return false;
+
 	return true;
 }
 
 void sci_paper_exit(void)
 {
+	sci_async_exit();
+	sci_result_cache_flush();
 	sci_modules_exit();
+	sci_diskcache_exit();
+	utils_exit();
 	sci_conf_exit();
 	size_t backendCount = sci_get_backend_count();
 	if(backendCount != 0)
@@ -59,7 +104,7 @@ DocumentMeta* sci_find_by_doi(const char* doi, int backendId)
 	RequestReturn* documents = sci_fill_meta(&meta, NULL, 1, SCI_SORT_RELEVANCE,  0);
 	if(documents)
 	{
-		DocumentMeta* meta = document_meta_copy(documents->documents[0]);
+		DocumentMeta* meta = documents->count > 0 && documents->documents[0] ? document_meta_ref(documents->documents[0]) : NULL;
 		request_return_free(documents);
 		return meta;
 	}
@@ -83,7 +128,7 @@ DocumentMeta* sci_find_by_title(const char* title)
 	RequestReturn* documents = sci_fill_meta(&meta, NULL, 1, SCI_SORT_RELEVANCE, 0);
 	if(documents)
 	{
-		DocumentMeta* meta = document_meta_copy(documents->documents[0]);
+		DocumentMeta* meta = documents->count > 0 && documents->documents[0] ? document_meta_ref(documents->documents[0]) : NULL;
 		request_return_free(documents);
 		return meta;
 	}
@@ -116,16 +161,6 @@ bool sci_save_pdf_to_file(const PdfData* data, const char* fileName)
 	return true;
 }
 
-bool sci_save_document_to_file(const DocumentMeta* meta, const char* fileName)
-{
-	PdfData* data = sci_get_document_pdf_data(meta);
-	if(!data)
-		return false;
-	bool ret = sci_save_pdf_to_file(data, fileName);
-	pdf_data_free(data);
-	return ret;
-}
-
 const VersionFixed* sci_get_version(void)
 {
 	return &version;
@@ -0,0 +1,174 @@
+/*
+ * async.h
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * async.h is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * async.h is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <glib.h>
+#include <scipaper/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* @addtogroup API
+*
+* @{
+*/
+
+/**
+ * @brief A request that is processed in the background.
+ *
+ * Requests are processed by a pool of worker threads inside libscipaper, the size of which is given by the
+ * AsyncThreads key of the Dispatch config group, 16 by default. This is not an event loop: every worker blocks on
+ * the network for the whole request, so at most AsyncThreads requests are processed at the same time and further
+ * requests wait in a queue until a worker becomes free. Any number of requests can be made this way, but only that many
+ * make progress concurrently. Once a request is done, its callback is invoked on the GMainContext given when
+ * the request was made, so that all results are handled on one thread.
+ * The workers call into the backends concurrently, which requires every loaded module to be thread safe, see sci_plugin_register().
+ * Documents passed to a request are shared with the workers and must not be modified until its callback was invoked.
+ * The callback is invoked exactly once for every request, also for requests that where cancelled.
+ * A SciRequest is owned by libscipaper and is valid until its callback has returned.
+ */
+typedef struct _SciRequest SciRequest;
+
+/**
+ * @brief Callback for sci_fill_meta_async()
+ * @param request The request that finished
+ * @param result The result as sci_fill_meta() would return it, owned by the callback, NULL if nothing was found or the request was cancelled
+ * @param userData The userData pointer given when the request was made
+ */
+typedef void (*sci_fill_meta_cb)(SciRequest* request, RequestReturn* result, void* userData);
+
+/**
+ * @brief Callback for sci_find_by_doi_async()
+ * @param request The request that finished
+ * @param meta The document, owned by the callback, NULL if nothing was found or the request was cancelled
+ * @param userData The userData pointer given when the request was made
+ */
+typedef void (*sci_document_meta_cb)(SciRequest* request, DocumentMeta* meta, void* userData);
+
+/**
+ * @brief Callback for sci_get_document_text_async()
+ * @param request The request that finished
+ * @param text The full text, owned by the callback and to be freed with free(), NULL on failure or if the request was cancelled
+ * @param userData The userData pointer given when the request was made
+ */
+typedef void (*sci_text_cb)(SciRequest* request, char* text, void* userData);
+
+/**
+ * @brief Callback for sci_get_document_pdf_data_async()
+ * @param request The request that finished
+ * @param pdf The pdf, owned by the callback and to be freed with pdf_data_free(), NULL on failure or if the request was cancelled
+ * @param userData The userData pointer given when the request was made
+ */
+typedef void (*sci_pdf_cb)(SciRequest* request, PdfData* pdf, void* userData);
+
+/**
+ * @brief Callback for sci_save_document_to_file_async()
+ * @param request The request that finished
+ * @param success true if the pdf was saved, false on failure or if the request was cancelled
+ * @param userData The userData pointer given when the request was made
+ */
+typedef void (*sci_save_cb)(SciRequest* request, bool success, void* userData);
+
+/**
+ * @brief Asynchronous version of sci_fill_meta()
+ * @param meta The query, see sci_fill_meta(), copied or referenced so it may be freed once this function returns
+ * @param fill See sci_fill_meta(), copied
+ * @param maxCount See sci_fill_meta()
+ * @param sortMode See sci_fill_meta()
+ * @param page See sci_fill_meta()
+ * @param context The GMainContext to invoke the callback on, NULL for the thread default context of the calling thread
+ * @param callback The function to call once the request is done
+ * @param userData A pointer that is passed to callback
+ * @return A handle that can be passed to sci_request_cancel()
+ */
+SciRequest* sci_fill_meta_async(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount, sorting_mode_t sortMode,
+								size_t page, GMainContext* context, sci_fill_meta_cb callback, void* userData);
+
+/**
+ * @brief Asynchronous version of sci_find_by_doi()
+ * @param doi The DOI to look up, copied
+ * @param backendId See sci_find_by_doi()
+ * @param context The GMainContext to invoke the callback on, NULL for the thread default context of the calling thread
+ * @param callback The function to call once the request is done
+ * @param userData A pointer that is passed to callback
+ * @return A handle that can be passed to sci_request_cancel()
+ */
+SciRequest* sci_find_by_doi_async(const char* doi, int backendId, GMainContext* context,
+								  sci_document_meta_cb callback, void* userData);
+
+/**
+ * @brief Asynchronous version of sci_get_document_text()
+ * @param meta The document, copied or referenced so it may be freed once this function returns
+ * @param context The GMainContext to invoke the callback on, NULL for the thread default context of the calling thread
+ * @param callback The function to call once the request is done
+ * @param userData A pointer that is passed to callback
+ * @return A handle that can be passed to sci_request_cancel()
+ */
+SciRequest* sci_get_document_text_async(const DocumentMeta* meta, GMainContext* context, sci_text_cb callback, void* userData);
+
+/**
+ * @brief Asynchronous version of sci_get_document_pdf_data()
+ * @param meta The document, copied or referenced so it may be freed once this function returns
+ * @param context The GMainContext to invoke the callback on, NULL for the thread default context of the calling thread
+ * @param callback The function to call once the request is done
+ * @param userData A pointer that is passed to callback
+ * @return A handle that can be passed to sci_request_cancel()
+ */
+SciRequest* sci_get_document_pdf_data_async(const DocumentMeta* meta, GMainContext* context, sci_pdf_cb callback, void* userData);
+
+/**
+ * @brief Asynchronous version of sci_save_document_to_file()
+ * @param meta The document, copied or referenced so it may be freed once this function returns
+ * @param fileName The file to save the pdf to, copied
+ * @param context The GMainContext to invoke the callback on, NULL for the thread default context of the calling thread
+ * @param callback The function to call once the request is done
+ * @param userData A pointer that is passed to callback
+ * @return A handle that can be passed to sci_request_cancel()
+ */
+SciRequest* sci_save_document_to_file_async(const DocumentMeta* meta, const char* fileName, GMainContext* context,
+											sci_save_cb callback, void* userData);
+
+/**
+ * @brief Cancels a request.
+ * A request that has not started yet is not processed at all, the result of a request that is already being processed
+ * is discarded. Either way the callback is invoked with an empty result.
+ * This must be called on the thread that runs the GMainContext of the request, before its callback was invoked.
+ * @param request The request to cancel
+ */
+void sci_request_cancel(SciRequest* request);
+
+/**
+ * @brief Checks whether a request was cancelled, useful in callbacks to tell a cancelled request from one that found nothing
+ * @param request The request
+ * @return true if sci_request_cancel() was called for this request
+ */
+bool sci_request_is_cancelled(const SciRequest* request);
+
+/**
+....
+* @}
+*/
+
+#ifdef __cplusplus
+}
+#endif
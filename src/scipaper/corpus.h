@@ -0,0 +1,122 @@
+/*
+ * corpus.h
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * corpus.h is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * corpus.h is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <scipaper/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* @addtogroup API
+*
+* @{
+*/
+
+/**
+ * @brief A store for a large number of documents.
+ *
+ * A corpus is a directory containing an append only data file holding the metadata, full text and pdf of each document
+ * and a memory mapped hash index to find documents by their DOI.
+ * A corpus may only be opened by one process at a time and its functions are not thread safe.
+ */
+typedef struct _SciCorpus SciCorpus;
+
+/**
+ * @brief Function to be called for every document in a corpus by sci_corpus_foreach()
+ * @param meta The metadata of the document, only valid for the duration of the call, use document_meta_copy() to keep it
+ * @param fullText The full text of the document or NULL, only valid for the duration of the call
+ * @param pdf The pdf of the document or NULL, only valid for the duration of the call
+ * @param pdfLength The length of the data at pdf
+ * @param userData The userData pointer passed to sci_corpus_foreach()
+ * @return true to continue with the next document, false to stop
+ */
+typedef bool (*sci_corpus_foreach_fn)(const DocumentMeta* meta, const char* fullText,
+									  const unsigned char* pdf, size_t pdfLength, void* userData);
+
+/**
+ * @brief Opens a corpus, creating it if it does not exist
+ * @param directory The directory the corpus is stored in
+ * @return A corpus to be closed with sci_corpus_close(), or NULL on failure
+ */
+SciCorpus* sci_corpus_open(const char* directory);
+
+/**
+ * @brief Closes a corpus
+ * @param corpus The corpus to close, it is safe to pass NULL here
+ */
+void sci_corpus_close(SciCorpus* corpus);
+
+/**
+ * @brief Appends a document to a corpus
+ * If a document with the same DOI already exists in the corpus, it is replaced in the index by the new document.
+ * Documents without a DOI are stored but can only be found via sci_corpus_foreach()
+ * @param corpus The corpus to add to
+ * @param meta The metadata of the document
+ * @param fullText The full text of the document, or NULL
+ * @param pdf The pdf of the document, or NULL
+ * @param pdfLength The length of the data at pdf
+ * @return true on success false on failure
+ */
+bool sci_corpus_add(SciCorpus* corpus, const DocumentMeta* meta, const char* fullText, const unsigned char* pdf, size_t pdfLength);
+
+/**
+ * @brief Looks up a document in a corpus by its DOI
+ * @param corpus The corpus to search in
+ * @param doi The DOI of the document, DOIs are compared case insensitively and with any doi.org prefix removed
+ * @param fullText If not NULL, set to a newly allocated copy of the full text of the document, or NULL
+ * @return A newly allocated DocumentMeta, or NULL if the corpus contains no document with this DOI
+ */
+DocumentMeta* sci_corpus_find_by_doi(SciCorpus* corpus, const char* doi, char** fullText);
+
+/**
+ * @brief Gets the pdf of a document in a corpus by its DOI
+ * @param corpus The corpus to search in
+ * @param doi The DOI of the document
+ * @return A PdfData struct to be freed with pdf_data_free(), or NULL if the document is not found or has no pdf
+ */
+PdfData* sci_corpus_get_pdf(SciCorpus* corpus, const char* doi);
+
+/**
+ * @brief Calls a function for every document in a corpus in the order they where added
+ * @param corpus The corpus to iterate over
+ * @param fn The function to call
+ * @param userData A pointer that is passed to fn
+ * @return The number of documents fn was called for
+ */
+size_t sci_corpus_foreach(SciCorpus* corpus, sci_corpus_foreach_fn fn, void* userData);
+
+/**
+ * @brief Gets the number of documents with a distinct DOI in a corpus
+ * @param corpus The corpus
+ * @return The number of documents that can be found by their DOI
+ */
+size_t sci_corpus_get_count(const SciCorpus* corpus);
+
+/**
+....
+* @}
+*/
+
+#ifdef __cplusplus
+}
+#endif
@@ -49,10 +49,113 @@ void sci_log_set_verbosity(loglevel_t verbosity);
  * @param maxCount maximum number of documents to match
  * @param sortingMode in what order to return the document metas
  * @param page if page is set > 0, the first page*maxCount entries are skipped and the subsequent results are returned instead
- * @return A RequestReturn, to be freed with request_return_free(), or NULL if none could be found
+ * @return A RequestReturn, to be freed with request_return_free(), or NULL if none could be found.
+ * The documents may be shared with the result cache, see sci_result_cache_set_size(), use document_meta_make_writable() before modifying them.
  */
 RequestReturn* sci_fill_meta(const DocumentMeta* meta, const FillReqest* fill, size_t maxCount, sorting_mode_t sortingMode, size_t page);
 
+/**
+ * @brief An iterator over all results of a query, see sci_query_open()
+ */
+typedef struct _SciQuery SciQuery;
+
+/**
+ * @brief Starts iterating over all results of a query.
+ * The results are fetched page by page with sci_fill_meta(), while the caller processes one page the following pages are
+ * fetched in the background.
+ *
+ * @param meta The query, see sci_fill_meta(), copied or referenced so it may be freed once this function returns
+ * @param fill See sci_fill_meta(), copied
+ * @param pageSize The number of documents fetched with each request
+ * @param sortMode In what order to return the documents
+ * @param lookahead The maximum number of pages fetched ahead of the page currently being iterated,
+ * 0 fetches every page only once it is needed
+ * @return A SciQuery to be closed with sci_query_close(), or NULL if the first page found nothing.
+ * This function blocks until the first page was fetched
+ */
+SciQuery* sci_query_open(const DocumentMeta* meta, const FillReqest* fill, size_t pageSize, sorting_mode_t sortMode, size_t lookahead);
+
+/**
+ * @brief Gets the next document of a query, blocking if its page has not been fetched yet.
+ * Pages that can not be fetched are skipped.
+ * @param query The query
+ * @return The document, to be freed with document_meta_free(), or NULL once all results have been returned
+ */
+DocumentMeta* sci_query_next(SciQuery* query);
+
+/**
+ * @brief Gets the total number of results of a query as reported by the backend with the first page
+ * @param query The query
+ * @return The total number of results, or 0 if the backend did not report it
+ */
+size_t sci_query_get_total_count(const SciQuery* query);
+
+/**
+ * @brief Stops iterating over the results of a query, waiting for a page that is being fetched, and frees it
+ * @param query The query, it is safe to pass NULL here
+ */
+void sci_query_close(SciQuery* query);
+
+/**
+ * @brief Sets how sci_fill_meta() queries the backends for requests that do not specify a backend.
+ * The mode is initially taken from the Mode and Timeout keys of the Dispatch config group.
+ * In the parallel modes the backend calls of all sci_fill_meta() calls share a pool of 32 threads,
+ * calls that find no free thread wait for one and this waiting counts towards the timeout.
+ * Merged results that lack the answer of a backend that failed or timed out are not cached.
+ * @param mode The dispatch mode, see dispatch_mode_t
+ * @param timeout In the parallel modes, the time in ms after which backends that have not answered are ignored
+ */
+void sci_set_dispatch_mode(dispatch_mode_t mode, int timeout);
+
+/**
+ * @brief Configures the circuit breaker that stops libscipaper from calling backends whose server is failing.
+ * After threshold consecutive calls of a backend that failed due to the network or the server, calls of the same kind
+ * to this backend fail immediately for cooldown ms. After that a single call is let through, if it succeeds the backend
+ * is used normally again, otherwise it is skipped for another cooldown.
+ * Initially taken from the BreakerThreshold and BreakerCooldown keys of the Dispatch config group.
+ * @param threshold The number of consecutive failures after which a backend is skipped, 0 to disable the circuit breaker
+ * @param cooldown The time in ms a failing backend is skipped for
+ */
+void sci_set_circuit_breaker(int threshold, int cooldown);
+
+/**
+ * @brief Sets whether backends are tried in the order of their expected cost.
+ * If enabled libscipaper keeps a moving average of the latency and the fraction of successful calls of every backend
+ * and tries the backend that is expected to deliver a result the fastest first. Backends that where not used for a while
+ * are tried first again once, so that a backend that recovered is used again.
+ * Initially taken from the AdaptiveOrder key of the Dispatch config group.
+ * @param adaptive true to order backends by expected cost, false to try them in the order they where registered
+ */
+void sci_set_adaptive_order(bool adaptive);
+
+/**
+ * @brief Sets the number of threads used to complete the documents of one sci_fill_meta() result.
+ * Documents that lack fields requested in the FillReqest are looked up by their DOI with the other backends,
+ * this many of them are looked up concurrently. Initially taken from the CompletionThreads key of the Dispatch config group.
+ * @param threads The number of threads, 1 completes the documents one after the other
+ */
+void sci_set_completion_threads(int threads);
+
+/**
+ * @brief Sets the number of sci_fill_meta() results kept in memory, so that repeated requests are answered without asking any backend.
+ * The least recently used results are dropped first. The size is initially taken from the MemoryEntries key of the Cache config group.
+ * @param entries The number of results to keep, 0 disables the cache
+ */
+void sci_result_cache_set_size(size_t entries);
+
+/**
+ * @brief Drops all results kept in memory by the result cache
+ */
+void sci_result_cache_flush(void);
+
+/**
+ * @brief Gets statistics about the result cache
+ * @param hits If not NULL, set to the number of sci_fill_meta() calls answered from the cache
+ * @param misses If not NULL, set to the number of sci_fill_meta() calls that where not in the cache
+ * @param entries If not NULL, set to the number of results currently in the cache
+ */
+void sci_result_cache_get_stats(size_t* hits, size_t* misses, size_t* entries);
+
 /**
  * @brief Tries to find the metadata of the document with the given DOI
  *
@@ -62,6 +165,19 @@ RequestReturn* sci_fill_meta(const DocumentMeta* meta, const FillReqest* fill, s
  */
 DocumentMeta* sci_find_by_doi(const char* doi, int backendId);
 
+/**
+ * @brief Tries to find the metadata of many documents by their DOIs.
+ * Backends that support it are asked for many DOIs with a single request, the remaining DOIs are looked up
+ * concurrently like with sci_find_by_doi(), using as many threads as set with sci_set_completion_threads().
+ *
+ * @param dois An array of DOIs to search for
+ * @param count The number of DOIs in dois
+ * @param backendId The backend to use to find the DOIs, or 0 for "any"
+ * @return An array of count DocumentMeta structs where the i-th entry belongs to dois[i] and is NULL if it could not be found,
+ * to be freed with document_meta_free_list()
+ */
+DocumentMeta** sci_find_by_dois(const char** dois, size_t count, int backendId);
+
 /**
  * @brief Tries to find the metadata of the document with the given title
  *
@@ -19,6 +19,7 @@
 #pragma once
 #include <time.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -66,6 +67,18 @@ typedef enum {
 
 const char* sorting_mode_name(sorting_mode_t mode);
 
+/**
+ * @brief How sci_fill_meta() queries the backends when no backend is specified
+ */
+typedef enum {
+	SCI_DISPATCH_INVALID = -1,
+	SCI_DISPATCH_SERIAL = 0,	/**< Query the backends one after the other until one returns a result*/
+	SCI_DISPATCH_FIRST_SUCCESS,	/**< Query all backends in parallel and use the first result to arrive*/
+	SCI_DISPATCH_MERGE,	/**< Query all backends in parallel and merge all results that arrive in time*/
+} dispatch_mode_t;
+
+const char* dispatch_mode_name(dispatch_mode_t mode);
+
 /**
  * @brief returns the capabilities flags as a human readable string.
  * @param capabilities Print with INFO priority if true and DEBUG priority if false
@@ -90,6 +103,11 @@ typedef struct _BackendInfo {
 	capability_flags_t capabilities; /**< Flags that describe what a backend can do */
 } BackendInfo;
 
+/**
+ * @brief A bump allocator that can own DocumentMeta structs and their strings, see request_return_new_arena()
+ */
+typedef struct _SciArena SciArena;
+
 /**
  * @brief This bitfield tells libscipaper what fields you require to have filled.
  * libscipaper will try each of its backends in sequence until
@@ -113,6 +131,14 @@ typedef struct _FillReqest {
 
 /**
  * @brief This struct contains the metadata of a paper, must be created via document_meta_new() and freed via document_meta_free()
+ *
+ * DocumentMeta structs are reference counted, a struct obtained via document_meta_ref() is shared and must be treated as read only.
+ * Use document_meta_make_writable() before modifying a struct that may be shared.
+ *
+ * This changes the API and ABI compared to earlier versions of libscipaper: the struct gained the refcount member
+ * and structs that were not created by document_meta_new() or document_meta_new_arena(), such as ones
+ * allocated by the client itself, have a refcount of 0 and are never freed by document_meta_free().
+ * Clients that allocate a DocumentMeta themselves must also free it and its strings themselves.
  */
 typedef struct _DocumentMeta {
 	//To be filled by user for query or by backend as a result
@@ -140,6 +166,8 @@ typedef struct _DocumentMeta {
 	void* backendData; /**< Backend specific data, not to be used by clients*/
 	void (*backend_data_free_fn)(void*); /**< Function to free backend specific data, not to be used by clients*/
 	void* (*backend_data_copy_fn)(void*); /**< Function to deep copy backend specific data, not to be used by clients*/
+	SciArena* arena; /**< Arena that owns this struct and its strings, NULL if it was allocated on its own, not to be used by clients*/
+	int refcount; /**< Number of references held to this struct, 0 for structs not created by libscipaper such as ones on the stack, not to be used by clients*/
 
 	//Filled by libscipaper core
 	bool compleatedLookup; /**< Entry lookup completed */
@@ -151,15 +179,59 @@ typedef struct _DocumentMeta {
  */
 DocumentMeta* document_meta_new(void);
 
+/**
+ * @brief Allocates a DocumentMeta struct inside an arena and initializes it
+ * The struct and all strings set via document_meta_strdup() are released together with the arena
+ * @param arena The arena to allocate the struct in
+ * @return A new DocumentMeta struct owned by arena
+ */
+DocumentMeta* document_meta_new_arena(SciArena* arena);
+
+/**
+ * @brief Duplicates a string so that it can be stored in a field of meta
+ * For metas owned by an arena the string is placed in the same arena, otherwise it is allocated on its own.
+ * Fields of metas owned by an arena must only be set via this function
+ * @param meta The DocumentMeta struct the string is to be stored in
+ * @param str The string to duplicate, it is safe to pass NULL here
+ * @return A copy of str that is freed together with meta, or NULL if str is NULL
+ */
+char* document_meta_strdup(const DocumentMeta* meta, const char* str);
+
 /**
  * @brief Dose a deep copy of a DocumentMeta struct
+ * The copy is always allocated on its own, even if meta is owned by an arena
  * @param meta The DocumentMeta struct to copy
  * @return A newly allocated copy of the meta struct
  */
 DocumentMeta* document_meta_copy(const DocumentMeta* meta);
 
 /**
- * @brief Frees a document meta struct
+ * @brief Takes a reference to a DocumentMeta struct
+ * Structs that are not reference counted, such as ones on the stack, are copied instead
+ * @param meta The DocumentMeta struct to reference
+ * @return meta or a newly allocated copy of it, to be released with document_meta_unref()
+ */
+DocumentMeta* document_meta_ref(const DocumentMeta* meta);
+
+/**
+ * @brief Drops a reference to a DocumentMeta struct, the struct is freed when the last reference is dropped
+ * For metas owned by an arena only the backend data is freed, the rest is released with the arena
+ * @param meta The DocumentMeta struct to unreference, it is safe to pass NULL here
+ */
+void document_meta_unref(DocumentMeta* meta);
+
+/**
+ * @brief Makes sure that the caller holds the only reference to a DocumentMeta struct so that it may be modified
+ * The caller must own a reference to meta, the reference count is read without further synchronization
+ * which is only safe if no other thread can drop the last reference while this function runs.
+ * @param meta The DocumentMeta struct to modify, the callers reference to it is consumed
+ * @return meta if the caller held the only reference, otherwise a newly allocated copy
+ */
+DocumentMeta* document_meta_make_writable(DocumentMeta* meta);
+
+/**
+ * @brief Frees a document meta struct, this is the same as document_meta_unref()
+ * Structs with a refcount of 0, i.e. ones not created by libscipaper, are left untouched and must be freed by their owner.
  * @param meta The DocumentMeta struct to free, it is safe to pass NULL here
  */
 void document_meta_free(DocumentMeta* meta);
@@ -189,6 +261,16 @@ char* document_meta_get_json(const DocumentMeta* meta, const char* fullText, siz
 
 char* document_meta_get_json_only_fillrq(const DocumentMeta* meta, const FillReqest rq, const char* fullText, size_t* length);
 
+/**
+ * @brief Writes the json data of the supplied DoucmentMeta straight to a file without building it in memory first
+ * @param file The file to write to
+ * @param meta The DocumentMeta struct to write
+ * @param rq The fields of meta to write
+ * @param fullText Optionally the full text associated with the DocumentMeta
+ * @return true on success false on failure
+ */
+bool document_meta_write_json_only_fillrq(FILE* file, const DocumentMeta* meta, const FillReqest rq, const char* fullText);
+
 /**
  * @brief create a DocumentMeta from json data saved by document_meta_get_json()
  * @param jsonFile a c string containing the json data
@@ -210,6 +292,62 @@ DocumentMeta* document_meta_load_from_json_file(const char* jsonFileName);
  */
 char* document_meta_load_full_text_from_json_file(const char* jsonFileName);
 
+/**
+ * @brief Get a record in the compact binary format containing the supplied DocumentMeta
+ * The binary format is versioned and length prefixed, records can be concatenated and loaded much faster than json
+ * @param meta The DocumentMeta struct to save into the record
+ * @param fullText Optionally the full text associated with the DocumentMeta
+ * @param length length of the returned record
+ * @return A newly allocated buffer containing the record, or NULL on failure
+ */
+char* document_meta_get_binary(const DocumentMeta* meta, const char* fullText, size_t* length);
+
+/**
+ * @brief Writes a binary record of the supplied DocumentMeta to the current position of a file
+ * @param file The file to write to
+ * @param meta The DocumentMeta struct to write
+ * @param fullText Optionally the full text associated with the DocumentMeta
+ * @return true on success false on failure
+ */
+bool document_meta_write_binary(FILE* file, const DocumentMeta* meta, const char* fullText);
+
+/**
+ * @brief Saves a DocumentMeta to disk in the binary format
+ * @param fileName The file name under which to save the DocumentMeta
+ * @param meta The DocumentMeta struct to save to disk
+ * @param fullText Optionally the full text associated with the DocumentMeta
+ * @return true on success false on failure
+ */
+bool document_meta_save_binary(const char* fileName, const DocumentMeta* meta, const char* fullText);
+
+/**
+ * @brief Creates a DocumentMeta that refers to a binary record in place, without copying its strings
+ * @param arena The arena to allocate the DocumentMeta in, the meta holds a reference to it
+ * @param data The start of the record, this buffer must outlive the returned DocumentMeta and must not be modified
+ * @param length The number of bytes available at data, the record may be followed by further records
+ * @param recordLength If not NULL, set to the length of the record so that the next one can be found
+ * @param fullText If not NULL, set to the full text contained in the record, which also points into data, or NULL
+ * @return A DocumentMeta to be released with document_meta_unref(), or NULL if the record is invalid
+ */
+DocumentMeta* document_meta_view_binary(SciArena* arena, const char* data, size_t length, size_t* recordLength, const char** fullText);
+
+/**
+ * @brief Creates a DocumentMeta from a binary record created by document_meta_get_binary()
+ * @param data The start of the record
+ * @param length The number of bytes available at data
+ * @param fullText If not NULL, set to a newly allocated copy of the full text contained in the record, or NULL
+ * @return A newly allocated DocumentMeta, or NULL if the record is invalid
+ */
+DocumentMeta* document_meta_load_from_binary(const char* data, size_t length, char** fullText);
+
+/**
+ * @brief Creates a DocumentMeta from a file saved by document_meta_save_binary()
+ * @param fileName The file name of the file to load
+ * @param fullText If not NULL, set to a newly allocated copy of the full text contained in the file, or NULL
+ * @return A newly allocated DocumentMeta, or NULL if the file is invalid
+ */
+DocumentMeta* document_meta_load_from_binary_file(const char* fileName, char** fullText);
+
 /**
  * @brief Get string containing biblatex entry of the supplied DoucmentMeta
  * @param meta The DocumentMeta struct to save into the string
@@ -256,6 +394,7 @@ typedef struct _RequestReturn {
 	size_t maxCount; /**< The maximum number of search results to be presented, as requested by the interface user */
 	size_t page; /**< The page that was requested */
 	size_t totalCount; /**< The total number of search results found by the backend, 0 if this information is not supported by the backend*/
+	SciArena* arena; /**< Arena owning the documents, or NULL, not to be used by clients*/
 } RequestReturn;
 
 /**
@@ -266,6 +405,39 @@ typedef struct _RequestReturn {
  */
 RequestReturn* request_return_new(size_t count, size_t maxCount);
 
+/**
+ * @brief Allocates a empty RequestReturn struct that takes ownership of an arena
+ * The documents are expected to be allocated in the arena via document_meta_new_arena(),
+ * so that request_return_free() releases them all at once
+ * @param count number of DocumentMeta structs this struct contains
+ * @param maxCount maximum number of DocumentMeta structs requested by interface user
+ * @param arena The arena to take ownership of
+ * @return a newly allocated RequestReturn struct, to be freed with request_return_free()
+ */
+RequestReturn* request_return_new_arena(size_t count, size_t maxCount, SciArena* arena);
+
+/**
+ * @brief Creates a new, empty arena
+ * @return A newly allocated arena to be handed to request_return_new_arena() or released with sci_arena_unref()
+ */
+SciArena* sci_arena_new(void);
+
+/**
+ * @brief Allocates memory from an arena
+ * @param arena The arena to allocate from
+ * @param size The number of bytes to allocate
+ * @return Memory aligned for any type that is valid until the arena is freed
+ */
+void* sci_arena_alloc(SciArena* arena, size_t size);
+
+/**
+ * @brief Drops a reference to an arena
+ * Every DocumentMeta allocated in the arena holds a reference to it, so the arena and everything allocated in it
+ * is freed once the creator has dropped its reference and all of those DocumentMeta structs have been freed
+ * @param arena The arena to unreference, it is safe to pass NULL here
+ */
+void sci_arena_unref(SciArena* arena);
+
 /**
  * @brief Frees a RequestReturn struct
  * @param reqRet The RequestReturn to free, it is safe to pass NULL here
@@ -19,6 +19,8 @@
 #include "types.h"
 #include <glib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include "sci-log.h"
 #include "utils.h"
@@ -58,6 +60,99 @@ const char* sorting_mode_name(sorting_mode_t mode)
 	}
 }
 
+const char* dispatch_mode_name(dispatch_mode_t mode)
+{
+	switch(mode)
+	{
+		case SCI_DISPATCH_SERIAL:
+			return "serial";
+		case SCI_DISPATCH_FIRST_SUCCESS:
+			return "first";
+		case SCI_DISPATCH_MERGE:
+			return "merge";
+		default:
+			return NULL;
+	}
+}
+
+#define SCI_ARENA_BLOCK_SIZE 16384
+#define SCI_ARENA_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+struct SciArenaBlock
+{
+	struct SciArenaBlock* next;
+	size_t used;
+	size_t size;
+};
+
+struct _SciArena
+{
+	struct SciArenaBlock* blocks;
+	int refcount;
+};
+
+SciArena* sci_arena_new(void)
+{
+	SciArena* arena = g_malloc0(sizeof(SciArena));
+	arena->refcount = 1;
+	return arena;
+}
+
+void sci_arena_unref(SciArena* arena)
+{
+	if(!arena || !g_atomic_int_dec_and_test(&arena->refcount))
+		return;
+
+	struct SciArenaBlock* block = arena->blocks;
+	while(block)
+	{
+		struct SciArenaBlock* next = block->next;
+		g_free(block);
+		block = next;
+	}
+	g_free(arena);
+}
+
+void* sci_arena_alloc(SciArena* arena, size_t size)
+{
+	const size_t header = SCI_ARENA_ALIGN(sizeof(struct SciArenaBlock));
+	size = SCI_ARENA_ALIGN(size);
+
+	struct SciArenaBlock* block = arena->blocks;
+	if(!block || block->size - block->used < size)
+	{
+		bool oversized = size > SCI_ARENA_BLOCK_SIZE/4;
+		size_t blockSize = oversized ? size : SCI_ARENA_BLOCK_SIZE;
+		struct SciArenaBlock* newBlock = g_malloc(header + blockSize);
+		newBlock->used = 0;
+		newBlock->size = blockSize;
+
+		// oversized allocations get a block of their own behind the current one so that its free space is not lost
+		if(block && oversized)
+		{
+			newBlock->next = block->next;
+			block->next = newBlock;
+		}
+		else
+		{
+			newBlock->next = block;
+			arena->blocks = newBlock;
+		}
+		block = newBlock;
+	}
+
+	void* ptr = (char*)block + header + block->used;
+	block->used += size;
+	return ptr;
+}
+
+RequestReturn* request_return_new_arena(size_t count, size_t maxCount, SciArena* arena)
+{
+	RequestReturn* ret = request_return_new(count, maxCount);
+	ret->arena = arena;
+	return ret;
+}
+
 RequestReturn* request_return_new(size_t count, size_t maxCount)
 {
 	RequestReturn* ret = g_malloc0(sizeof(*ret));
@@ -73,6 +168,7 @@ void request_return_free(RequestReturn* reqRet)
 		return;
 
 	document_meta_free_list(reqRet->documents, reqRet->count);
+	sci_arena_unref(reqRet->arena);
 	g_free(reqRet);
 }
 
@@ -80,9 +176,34 @@ DocumentMeta* document_meta_new(void)
 {
 	DocumentMeta* meta = g_malloc0(sizeof(DocumentMeta));
 	meta->references = -1;
+	meta->refcount = 1;
 	return meta;
 }
 
+DocumentMeta* document_meta_new_arena(SciArena* arena)
+{
+	DocumentMeta* meta = sci_arena_alloc(arena, sizeof(DocumentMeta));
+	memset(meta, 0, sizeof(*meta));
+	meta->references = -1;
+	meta->arena = arena;
+	meta->refcount = 1;
+	g_atomic_int_inc(&arena->refcount);
+	return meta;
+}
+
+char* document_meta_strdup(const DocumentMeta* meta, const char* str)
+{
+	if(!str)
+		return NULL;
+	if(!meta->arena)
+		return g_strdup(str);
+
+	size_t length = strlen(str) + 1;
+	char* copy = sci_arena_alloc(meta->arena, length);
+	memcpy(copy, str, length);
+	return copy;
+}
+
 DocumentMeta* document_meta_copy(const DocumentMeta* meta)
 {
 	DocumentMeta* copy = g_malloc0(sizeof(*copy));
@@ -112,13 +233,52 @@ DocumentMeta* document_meta_copy(const DocumentMeta* meta)
 	copy->backend_data_free_fn = meta->backend_data_free_fn;
 	copy->backend_data_copy_fn = meta->backend_data_copy_fn;
 	copy->compleatedLookup = meta->compleatedLookup;
+	copy->refcount = 1;
 
 	return copy;
 }
 
+DocumentMeta* document_meta_ref(const DocumentMeta* meta)
+{
+	if(g_atomic_int_get(&meta->refcount) == 0)
+		return document_meta_copy(meta);
+
+	DocumentMeta* ref = (DocumentMeta*)meta;
+	g_atomic_int_inc(&ref->refcount);
+	return ref;
+}
+
+DocumentMeta* document_meta_make_writable(DocumentMeta* meta)
+{
+	if(g_atomic_int_get(&meta->refcount) == 1)
+		return meta;
+
+	DocumentMeta* copy = document_meta_copy(meta);
+	document_meta_unref(meta);
+	return copy;
+}
+
 void document_meta_free(DocumentMeta* meta)
 {
-	if(meta)
+	document_meta_unref(meta);
+}
+
+void document_meta_unref(DocumentMeta* meta)
+{
+	// structs with a refcount of 0 were not allocated by us and are never freed
+	if(!meta || g_atomic_int_get(&meta->refcount) == 0 || !g_atomic_int_dec_and_test(&meta->refcount))
+		return;
+
+	if(meta->arena)
+	{
+		if(meta->backendData)
+		{
+			assert(meta->backend_data_free_fn);
+			meta->backend_data_free_fn(meta->backendData);
+		}
+		sci_arena_unref(meta->arena);
+	}
+	else
 	{
 		g_free(meta->doi);
 		g_free(meta->url);
@@ -157,7 +317,7 @@ void document_meta_free_list(DocumentMeta** meta, size_t length)
 	if(meta)
 	{
 		for(size_t i = 0; i < length; ++i)
-			document_meta_free(meta[i]);
+			document_meta_unref(meta[i]);
 		g_free(meta);
 	}
 }
@@ -167,154 +327,125 @@ void document_meta_combine(DocumentMeta* target, const DocumentMeta* source)
 	if(!target || !source)
 		return;
 	if(!target->doi)
-		target->doi = g_strdup(source->doi);
+		target->doi = document_meta_strdup(target, source->doi);
 	if(!target->url)
-		target->url = g_strdup(source->url);
+		target->url = document_meta_strdup(target, source->url);
 	if(!target->year)
 		target->year = source->year;
 	if(!target->publisher)
-		target->publisher = g_strdup(source->publisher);
+		target->publisher = document_meta_strdup(target, source->publisher);
 	if(!target->volume)
-		target->volume = g_strdup(source->volume);
+		target->volume = document_meta_strdup(target, source->volume);
 	if(!target->pages)
-		target->pages = g_strdup(source->pages);
+		target->pages = document_meta_strdup(target, source->pages);
 	if(!target->author)
-		target->author = g_strdup(source->author);
+		target->author = document_meta_strdup(target, source->author);
 	if(!target->journal)
-		target->journal = g_strdup(source->journal);
+		target->journal = document_meta_strdup(target, source->journal);
 	if(!target->issn)
-		target->issn = g_strdup(source->issn);
+		target->issn = document_meta_strdup(target, source->issn);
 	if(!target->keywords)
-		target->keywords =  g_strdup(source->keywords);
+		target->keywords = document_meta_strdup(target, source->keywords);
 	if(!target->downloadUrl)
-		target->downloadUrl =  g_strdup(source->downloadUrl);
+		target->downloadUrl = document_meta_strdup(target, source->downloadUrl);
 	if(!target->abstract)
-		target->abstract =  g_strdup(source->abstract);
+		target->abstract = document_meta_strdup(target, source->abstract);
 	if(target->references < source->references)
 		target->references = source->references;
 }
 
-char* document_meta_get_json_only_fillrq(const DocumentMeta* meta, const FillReqest rq, const char* fullText, size_t* length)
+static void document_meta_write_json_entries(JsonWriter* writer, const DocumentMeta* meta, const FillReqest rq, const char* fullText)
 {
-	if(length)
-		*length = 0;
-	if(!meta)
-		return NULL;
-
-	GString* string = g_string_new("{\n");
-	GString* entry;
+	json_writer_append(writer, "{\n", 2);
 
 	if(rq.doi)
-	{
-		entry = createJsonEntry(1, "doi", meta->doi, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "doi", meta->doi, true, true);
 
 	if(rq.url)
-	{
-		entry = createJsonEntry(1, "url", meta->url, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "url", meta->url, true, true);
 
 	if(rq.year && meta->year != 0)
 	{
-		char* yearStr = g_strdup_printf("%lu", meta->year);
-		entry = createJsonEntry(1, "year", yearStr, false, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-		g_free(yearStr);
+		char yearStr[24];
+		snprintf(yearStr, sizeof(yearStr), "%lu", meta->year);
+		json_writer_append_entry(writer, 1, "year", yearStr, false, true);
 	}
 
 	if(rq.publisher)
-	{
-		entry = createJsonEntry(1, "publisher", meta->publisher, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "publisher", meta->publisher, true, true);
 
 	if(rq.volume)
-	{
-		entry = createJsonEntry(1, "volume", meta->volume, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "volume", meta->volume, true, true);
 
 	if(rq.pages)
-	{
-		entry = createJsonEntry(1, "pages", meta->pages, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "pages", meta->pages, true, true);
 
 	if(rq.author)
-	{
-		entry = createJsonEntry(1, "author", meta->author, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "author", meta->author, true, true);
 
 	if(rq.title)
-	{
-		entry = createJsonEntry(1, "title", meta->title, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "title", meta->title, true, true);
 
 	if(rq.journal)
-	{
-		entry = createJsonEntry(1, "journal", meta->journal, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "journal", meta->journal, true, true);
 
 	if(rq.issn)
-	{
-		entry = createJsonEntry(1, "issn", meta->issn, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "issn", meta->issn, true, true);
 
 	if(rq.keywords)
-	{
-		entry = createJsonEntry(1, "keywords", meta->keywords, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "keywords", meta->keywords, true, true);
 
 	if(rq.references && meta->references >= 0)
 	{
-		char* referanceStr = g_strdup_printf("%i", meta->references);
-		entry = createJsonEntry(1, "referances", referanceStr, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-		g_free(referanceStr);
+		char referanceStr[16];
+		snprintf(referanceStr, sizeof(referanceStr), "%i", meta->references);
+		json_writer_append_entry(writer, 1, "referances", referanceStr, true, true);
 	}
 
 	if(rq.downloadUrl)
-	{
-		entry = createJsonEntry(1, "download-url", meta->downloadUrl, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "download-url", meta->downloadUrl, true, true);
 
 	if(rq.abstract)
-	{
-		entry = createJsonEntry(1, "abstract", meta->abstract, true, true);
-		g_string_append(string, entry->str);
-		g_string_free(entry, true);
-	}
+		json_writer_append_entry(writer, 1, "abstract", meta->abstract, true, true);
+
+	json_writer_append_entry(writer, 1, "full-text", fullText, true, true);
+
+	json_writer_append(writer, "}\n", 2);
+}
+
+char* document_meta_get_json_only_fillrq(const DocumentMeta* meta, const FillReqest rq, const char* fullText, size_t* length)
+{
+	if(length)
+		*length = 0;
+	if(!meta)
+		return NULL;
 
-	entry = createJsonEntry(1, "full-text", fullText, true, true);
-	g_string_append(string, entry->str);
-	g_string_free(entry, true);
+	// the length is counted first so that the whole entry is escaped straight into a single allocation
+	JsonWriter writer;
+	json_writer_init_count(&writer);
+	document_meta_write_json_entries(&writer, meta, rq, fullText);
 
-	g_string_append(string, "}\n");
+	char* string = g_malloc(writer.length + 1);
+	json_writer_init_buffer(&writer, string);
+	document_meta_write_json_entries(&writer, meta, rq, fullText);
 
 	if(length)
-		*length = string->len;
-	return string->str;
+		*length = writer.length;
+	return string;
+}
+
+bool document_meta_write_json_only_fillrq(FILE* file, const DocumentMeta* meta, const FillReqest rq, const char* fullText)
+{
+	if(!meta)
+		return false;
+
+	JsonWriter writer;
+	json_writer_init_file(&writer, file);
+	document_meta_write_json_entries(&writer, meta, rq, fullText);
+
+	if(writer.error)
+		sci_log(LL_ERR, "%s: Could not write json entry", __func__);
+	return !writer.error;
 }
 
 char* document_meta_get_json(const DocumentMeta* meta, const char* fullText, size_t* length)
@@ -395,6 +526,44 @@ char* document_meta_load_full_text_from_json_file(const char* jsonFileName)
 	return g_strdup(nx_json_get(json, "full-text")->text_value);
 }
 
+static void biblatex_write_field(JsonWriter* writer, const char* name, const char* value)
+{
+	if(!value)
+		return;
+	json_writer_append(writer, "\t", 1);
+	json_writer_append(writer, name, strlen(name));
+	json_writer_append(writer, "={", 2);
+	json_writer_append(writer, value, strlen(value));
+	json_writer_append(writer, "},\n", 3);
+}
+
+static void document_meta_write_biblatex_entries(JsonWriter* writer, const DocumentMeta* meta, const char* type, const char* key, const char* authors)
+{
+	json_writer_append(writer, "@", 1);
+	json_writer_append(writer, type, strlen(type));
+	json_writer_append(writer, "{", 1);
+	json_writer_append(writer, key, strlen(key));
+	json_writer_append(writer, ",\n", 2);
+
+	biblatex_write_field(writer, "author", authors);
+	biblatex_write_field(writer, "title", meta->title);
+	biblatex_write_field(writer, "doi", meta->doi);
+	biblatex_write_field(writer, "url", meta->url);
+	if(meta->year)
+	{
+		char year[32];
+		snprintf(year, sizeof(year), "%lu", meta->year);
+		biblatex_write_field(writer, "year", year);
+	}
+	biblatex_write_field(writer, "publisher", meta->publisher);
+	biblatex_write_field(writer, "volume", meta->volume);
+	biblatex_write_field(writer, "pages", meta->pages);
+	biblatex_write_field(writer, "issn", meta->issn);
+	biblatex_write_field(writer, "keywords", meta->keywords);
+	biblatex_write_field(writer, "journal", meta->journal);
+	json_writer_append(writer, "}\n", 2);
+}
+
 char* document_meta_get_biblatex(const DocumentMeta* meta, size_t* length, const char* type)
 {
 	if(!type)
@@ -408,63 +577,42 @@ char* document_meta_get_biblatex(const DocumentMeta* meta, size_t* length, const
 		sci_log(LL_DEBUG, "%s: the document meta must contain at least an author field", __func__);
 		return NULL;
 	}
-	GString* string = g_string_new("@");
-	g_string_append(string, type);
-	g_string_append(string, "{");
 
 	char** authorTokens = g_str_tokenize_and_fold(meta->author, NULL, NULL);
-	GString* authorString = g_string_new(NULL);
+	GString* keyString = g_string_new(NULL);
 	for(int i = 0; authorTokens[i]; ++i)
 	{
 		if(i == 0)
-			g_string_append(authorString, authorTokens[i]);
+			g_string_append(keyString, authorTokens[i]);
 		else
-			g_string_append_c(authorString, authorTokens[i][0]);
+			g_string_append_c(keyString, authorTokens[i][0]);
 
 		g_free(authorTokens[i]);
 	}
 	g_free(authorTokens);
-	g_string_ascii_up(authorString);
+	g_string_ascii_up(keyString);
 	if(meta->year)
-		g_string_append_printf(authorString, "%lu", meta->year);
+		g_string_append_printf(keyString, "%lu", meta->year);
 	else
-		g_string_append_printf(authorString, "%u", (unsigned int)(g_random_int_range(0, (1 << 16))));
-	g_string_append(string, authorString->str);
-	g_string_append(string, ",\n");
-	g_string_free(authorString, true);
+		g_string_append_printf(keyString, "%u", (unsigned int)(g_random_int_range(0, (1 << 16))));
 
-	authorString = g_string_new(meta->author);
+	GString* authorString = g_string_new(meta->author);
 	g_string_replace(authorString, ", ", " and ", 0);
 
-	g_string_append_printf(string, "\tauthor={%s},\n", authorString->str);
+	// like the json output the entry is counted first and then written straight into a single allocation
+	JsonWriter writer;
+	json_writer_init_count(&writer);
+	document_meta_write_biblatex_entries(&writer, meta, type, keyString->str, authorString->str);
+
+	char* str = g_malloc(writer.length + 1);
+	json_writer_init_buffer(&writer, str);
+	document_meta_write_biblatex_entries(&writer, meta, type, keyString->str, authorString->str);
+
+	g_string_free(keyString, true);
 	g_string_free(authorString, true);
-	if(meta->title)
-		g_string_append_printf(string, "\ttitle={%s},\n", meta->title);
-	if(meta->doi)
-		g_string_append_printf(string, "\tdoi={%s},\n", meta->doi);
-	if(meta->url)
-		g_string_append_printf(string, "\turl={%s},\n", meta->url);
-	if(meta->year)
-		g_string_append_printf(string, "\tyear={%lu},\n", meta->year);
-	if(meta->publisher)
-		g_string_append_printf(string, "\tpublisher={%s},\n", meta->publisher);
-	if(meta->volume)
-		g_string_append_printf(string, "\tvolume={%s},\n", meta->volume);
-	if(meta->pages)
-		g_string_append_printf(string, "\tpages={%s},\n", meta->pages);
-	if(meta->issn)
-		g_string_append_printf(string, "\tissn={%s},\n", meta->issn);
-	if(meta->keywords)
-		g_string_append_printf(string, "\tkeywords={%s},\n", meta->keywords);
-	if(meta->journal)
-		g_string_append_printf(string, "\tjournal={%s},\n", meta->journal);
-	g_string_append_c(string, '}');
-	g_string_append_c(string, '\n');
 
 	if(length)
-		*length = string->len;
-	char* str = string->str;
-	g_string_free(string, false);
+		*length = writer.length;
 	return str;
 }
 
@@ -496,6 +644,280 @@ bool document_meta_save(const char* fileName, const DocumentMeta* meta, const ch
 	return document_meta_save_only_fillrq(fileName, meta, rq, fullText);
 }
 
+/*
+ * Binary records are laid out as follows, all integers are little endian:
+ * magic "SCIM", u16 version, u16 string count, u32 record length, u64 year, i32 references, u32 flags
+ * followed by the strings, each a u32 length or BINARY_STRING_NULL and the bytes of the string including its terminator.
+ * The full text is always the first string, newer versions may append strings that older readers skip.
+ */
+#define BINARY_MAGIC "SCIM"
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 28
+#define BINARY_STRING_NULL 0xFFFFFFFFu
+
+enum
+{
+	BINARY_FLAG_HAS_FULL_TEXT = 1,
+	BINARY_FLAG_COMPLEATED_LOOKUP = 1 << 1,
+};
+
+static const size_t binaryStringFields[] = {
+	G_STRUCT_OFFSET(DocumentMeta, doi),
+	G_STRUCT_OFFSET(DocumentMeta, url),
+	G_STRUCT_OFFSET(DocumentMeta, publisher),
+	G_STRUCT_OFFSET(DocumentMeta, volume),
+	G_STRUCT_OFFSET(DocumentMeta, pages),
+	G_STRUCT_OFFSET(DocumentMeta, author),
+	G_STRUCT_OFFSET(DocumentMeta, title),
+	G_STRUCT_OFFSET(DocumentMeta, journal),
+	G_STRUCT_OFFSET(DocumentMeta, issn),
+	G_STRUCT_OFFSET(DocumentMeta, keywords),
+	G_STRUCT_OFFSET(DocumentMeta, downloadUrl),
+	G_STRUCT_OFFSET(DocumentMeta, abstract),
+	G_STRUCT_OFFSET(DocumentMeta, searchText),
+};
+
+#define BINARY_FIELD(meta, i) (*(char**)((char*)(meta) + binaryStringFields[i]))
+
+static void binary_write_uint(JsonWriter* writer, uint64_t value, size_t bytes)
+{
+	unsigned char buffer[8];
+	for(size_t i = 0; i < bytes; ++i)
+		buffer[i] = (value >> (8*i)) & 0xFF;
+	json_writer_append(writer, (const char*)buffer, bytes);
+}
+
+static uint64_t binary_read_uint(const unsigned char* data, size_t bytes)
+{
+	uint64_t value = 0;
+	for(size_t i = 0; i < bytes; ++i)
+		value |= (uint64_t)data[i] << (8*i);
+	return value;
+}
+
+static void binary_write_string(JsonWriter* writer, const char* str)
+{
+	if(!str)
+	{
+		binary_write_uint(writer, BINARY_STRING_NULL, 4);
+		return;
+	}
+	size_t length = strlen(str);
+	binary_write_uint(writer, length, 4);
+	json_writer_append(writer, str, length + 1);
+}
+
+static void document_meta_write_binary_record(JsonWriter* writer, const DocumentMeta* meta, const char* fullText, size_t recordLength)
+{
+	uint32_t flags = 0;
+	if(meta->hasFullText)
+		flags |= BINARY_FLAG_HAS_FULL_TEXT;
+	if(meta->compleatedLookup)
+		flags |= BINARY_FLAG_COMPLEATED_LOOKUP;
+
+	json_writer_append(writer, BINARY_MAGIC, 4);
+	binary_write_uint(writer, BINARY_VERSION, 2);
+	binary_write_uint(writer, G_N_ELEMENTS(binaryStringFields) + 1, 2);
+	binary_write_uint(writer, recordLength, 4);
+	binary_write_uint(writer, meta->year, 8);
+	binary_write_uint(writer, (uint32_t)meta->references, 4);
+	binary_write_uint(writer, flags, 4);
+
+	binary_write_string(writer, fullText);
+	for(size_t i = 0; i < G_N_ELEMENTS(binaryStringFields); ++i)
+		binary_write_string(writer, BINARY_FIELD(meta, i));
+}
+
+static size_t document_meta_binary_length(const DocumentMeta* meta, const char* fullText)
+{
+	JsonWriter writer;
+	json_writer_init_count(&writer);
+	document_meta_write_binary_record(&writer, meta, fullText, 0);
+	if(writer.length > UINT32_MAX)
+	{
+		sci_log(LL_ERR, "%s: DocumentMeta is to large to be saved in the binary format", __func__);
+		return 0;
+	}
+	return writer.length;
+}
+
+char* document_meta_get_binary(const DocumentMeta* meta, const char* fullText, size_t* length)
+{
+	if(length)
+		*length = 0;
+	if(!meta)
+		return NULL;
+
+	size_t recordLength = document_meta_binary_length(meta, fullText);
+	if(recordLength == 0)
+		return NULL;
+
+	// the buffer writer terminates what it writes, hence the extra byte
+	char* record = g_malloc(recordLength + 1);
+	JsonWriter writer;
+	json_writer_init_buffer(&writer, record);
+	document_meta_write_binary_record(&writer, meta, fullText, recordLength);
+
+	if(length)
+		*length = recordLength;
+	return record;
+}
+
+bool document_meta_write_binary(FILE* file, const DocumentMeta* meta, const char* fullText)
+{
+	if(!meta)
+		return false;
+
+	size_t recordLength = document_meta_binary_length(meta, fullText);
+	if(recordLength == 0)
+		return false;
+
+	JsonWriter writer;
+	json_writer_init_file(&writer, file);
+	document_meta_write_binary_record(&writer, meta, fullText, recordLength);
+
+	if(writer.error)
+		sci_log(LL_ERR, "%s: Could not write binary record", __func__);
+	return !writer.error;
+}
+
+bool document_meta_save_binary(const char* fileName, const DocumentMeta* meta, const char* fullText)
+{
+	size_t length;
+	char* record = document_meta_get_binary(meta, fullText, &length);
+	if(!record)
+		return false;
+
+	GError *error = NULL;
+	bool ret = g_file_set_contents_full(fileName, record, length, G_FILE_SET_CONTENTS_NONE, 0666, &error);
+	g_free(record);
+	if(!ret)
+	{
+		sci_log(LL_ERR, "%s: %s", __func__, error->message);
+		g_error_free(error);
+	}
+	return ret;
+}
+
+DocumentMeta* document_meta_view_binary(SciArena* arena, const char* data, size_t length, size_t* recordLength, const char** fullText)
+{
+	const unsigned char* record = (const unsigned char*)data;
+
+	if(length < BINARY_HEADER_SIZE || memcmp(record, BINARY_MAGIC, 4) != 0)
+	{
+		sci_log(LL_ERR, "%s: Not a binary DocumentMeta record", __func__);
+		return NULL;
+	}
+
+	unsigned int version = binary_read_uint(record + 4, 2);
+	size_t stringCount = binary_read_uint(record + 6, 2);
+	size_t totalLength = binary_read_uint(record + 8, 4);
+	if(version != BINARY_VERSION || totalLength < BINARY_HEADER_SIZE || totalLength > length)
+	{
+		sci_log(LL_ERR, "%s: Binary record of version %u and length %zu is unsupported or truncated", __func__, version, totalLength);
+		return NULL;
+	}
+
+	DocumentMeta* meta = document_meta_new_arena(arena);
+	meta->year = binary_read_uint(record + 12, 8);
+	meta->references = (int32_t)binary_read_uint(record + 20, 4);
+	uint32_t flags = binary_read_uint(record + 24, 4);
+	meta->hasFullText = flags & BINARY_FLAG_HAS_FULL_TEXT;
+	meta->compleatedLookup = flags & BINARY_FLAG_COMPLEATED_LOOKUP;
+
+	const char* text = NULL;
+	size_t offset = BINARY_HEADER_SIZE;
+	for(size_t i = 0; i < stringCount; ++i)
+	{
+		if(totalLength - offset < 4)
+			goto invalid;
+		size_t stringLength = binary_read_uint(record + offset, 4);
+		offset += 4;
+
+		const char* str = NULL;
+		if(stringLength != BINARY_STRING_NULL)
+		{
+			if(totalLength - offset <= stringLength || record[offset + stringLength] != '\0')
+				goto invalid;
+			str = data + offset;
+			offset += stringLength + 1;
+		}
+
+		if(i == 0)
+			text = str;
+		else if(i - 1 < G_N_ELEMENTS(binaryStringFields))
+			BINARY_FIELD(meta, i - 1) = (char*)str;
+	}
+
+	if(recordLength)
+		*recordLength = totalLength;
+	if(fullText)
+		*fullText = text;
+	return meta;
+
+invalid:
+	sci_log(LL_ERR, "%s: Binary record is corrupt", __func__);
+	document_meta_unref(meta);
+	return NULL;
+}
+
+/* Loads a record that has been placed in memory owned by arena, the returned meta holds the only reference to the arena */
+static DocumentMeta* document_meta_load_from_arena_record(SciArena* arena, const char* record, size_t length, char** fullText)
+{
+	const char* text;
+	DocumentMeta* meta = document_meta_view_binary(arena, record, length, NULL, &text);
+	sci_arena_unref(arena);
+	if(fullText)
+		*fullText = meta ? g_strdup(text) : NULL;
+	return meta;
+}
+
+DocumentMeta* document_meta_load_from_binary(const char* data, size_t length, char** fullText)
+{
+	// the record is copied once into an arena instead of duplicateing every string
+	SciArena* arena = sci_arena_new();
+	char* record = sci_arena_alloc(arena, length);
+	memcpy(record, data, length);
+	return document_meta_load_from_arena_record(arena, record, length, fullText);
+}
+
+DocumentMeta* document_meta_load_from_binary_file(const char* fileName, char** fullText)
+{
+	if(fullText)
+		*fullText = NULL;
+
+	FILE* file = fopen(fileName, "rb");
+	if(!file)
+	{
+		sci_log(LL_ERR, "%s: Could not open %s", __func__, fileName);
+		return NULL;
+	}
+
+	long length = -1;
+	if(fseek(file, 0, SEEK_END) == 0)
+		length = ftell(file);
+	if(length <= 0 || fseek(file, 0, SEEK_SET) != 0)
+	{
+		sci_log(LL_ERR, "%s: Could not get the size of %s", __func__, fileName);
+		fclose(file);
+		return NULL;
+	}
+
+	// the file is read straight into the arena that will own the strings of the meta
+	SciArena* arena = sci_arena_new();
+	char* record = sci_arena_alloc(arena, length);
+	size_t read = fread(record, 1, length, file);
+	fclose(file);
+	if(read != (size_t)length)
+	{
+		sci_log(LL_ERR, "%s: Could not read %s", __func__, fileName);
+		sci_arena_unref(arena);
+		return NULL;
+	}
+
+	return document_meta_load_from_arena_record(arena, record, length, fullText);
+}
+
 bool document_meta_is_equal(const DocumentMeta* a, const DocumentMeta* b)
 {
 	if(a == b)
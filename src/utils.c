@@ -20,8 +20,18 @@
 
 #include <curl/curl.h>
 #include <sci-log.h>
+#include <sci-conf.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 void pair_free(struct Pair* pair)
 {
@@ -55,6 +65,9 @@ GString* buildQuery(const GSList* list)
 	return string;
 }
 
+typedef size_t (*write_callback_fn)(void *contents, size_t size, size_t nmemb, void *userp);
+typedef void (*write_reset_fn)(void *userp);
+
 static size_t writeCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
 	GString* buffer = userp;
@@ -62,38 +75,369 @@ static size_t writeCallback(void *contents, size_t size, size_t nmemb, void *use
 	return size * nmemb;
 }
 
-static GString* wgetUrlUa(const char* url, int timeout)
+static void writeReset(void *userp)
+{
+	GString* buffer = userp;
+	g_string_truncate(buffer, 0);
+}
+
+#define BROWSER_USER_AGENT "Mozilla/5.0 (X11; Linux x86_64; rv:106.0) Gecko/20100101 Firefox/106.0"
+#define CURL_POOL_MAX_IDLE 8
+#define RETRY_MAX_DELAY_MS 60000
+
+struct HostPool
+{
+	GQueue idle;
+	gint64 interval;
+	gint64 nextSlot;
+	int retries;
+};
+
+static int defaultRetries = 2;
+static int retryDelayMs = 500;
+
+// number of transfers made by the current thread that failed because of the network or the server
+static GPrivate transferFailures = G_PRIVATE_INIT(NULL);
+
+static GMutex poolMutex;
+static GHashTable* hostPools;
+static CURLSH* curlShare;
+static GMutex shareMutexes[CURL_LOCK_DATA_LAST];
+
+static void shareLock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+	(void)handle;
+	(void)access;
+	(void)userptr;
+	g_mutex_lock(&shareMutexes[data]);
+}
+
+static void shareUnlock(CURL* handle, curl_lock_data data, void* userptr)
 {
-	CURL* curlContext = curl_easy_init();
-	if(!curlContext)
+	(void)handle;
+	(void)userptr;
+	g_mutex_unlock(&shareMutexes[data]);
+}
+
+static void host_pool_free(void* data)
+{
+	struct HostPool* pool = data;
+	CURL* handle;
+	while((handle = g_queue_pop_head(&pool->idle)))
+		curl_easy_cleanup(handle);
+	g_free(pool);
+}
+
+static struct HostPool* host_pool_get_locked(const char* hostKey)
+{
+	struct HostPool* pool = g_hash_table_lookup(hostPools, hostKey);
+	if(!pool)
 	{
-		sci_log(LL_ERR, "Utils: Could not init curl");
-		return NULL;
+		pool = g_malloc0(sizeof(*pool));
+		g_queue_init(&pool->idle);
+		pool->retries = -1;
+		g_hash_table_insert(hostPools, g_strdup(hostKey), pool);
 	}
+	return pool;
+}
 
-	char errorBuffer[CURL_ERROR_SIZE] = "";
-	GString* buffer = g_string_new(NULL);
+static char* host_key_from_url(const char* url)
+{
+	char* scheme = NULL;
+	char* host = NULL;
+	int port = -1;
+	if(!g_uri_split_network(url, G_URI_FLAGS_NONE, &scheme, &host, &port, NULL))
+		return g_strdup("");
+
+	char* key = g_strdup_printf("%s://%s:%i", scheme ? scheme : "", host ? host : "", port);
+	g_free(scheme);
+	g_free(host);
+	return key;
+}
+
+static CURL* curl_handle_acquire(const char* hostKey)
+{
+	CURL* handle = NULL;
+
+	g_mutex_lock(&poolMutex);
+	struct HostPool* pool = hostPools ? g_hash_table_lookup(hostPools, hostKey) : NULL;
+	if(pool)
+		handle = g_queue_pop_head(&pool->idle);
+	g_mutex_unlock(&poolMutex);
+
+	if(handle)
+	{
+		// keeps live connections, the dns cache and the share, but drops all options
+		curl_easy_reset(handle);
+	}
+	else
+	{
+		handle = curl_easy_init();
+		if(!handle)
+			return NULL;
+	}
+
+	CURLcode ret;
+	ret = curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+	assert(ret == CURLE_OK);
+	ret = curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+	assert(ret == CURLE_OK);
+	if(curlShare)
+	{
+		ret = curl_easy_setopt(handle, CURLOPT_SHARE, curlShare);
+		assert(ret == CURLE_OK);
+	}
+
+	return handle;
+}
+
+static void curl_handle_release(CURL* handle, const char* hostKey)
+{
+	curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, NULL);
+
+	g_mutex_lock(&poolMutex);
+	if(hostPools)
+	{
+		struct HostPool* pool = host_pool_get_locked(hostKey);
+		if(pool->idle.length < CURL_POOL_MAX_IDLE)
+		{
+			// most recently used handle first, its connection is the most likely to still be alive
+			g_queue_push_head(&pool->idle, handle);
+			handle = NULL;
+		}
+	}
+	g_mutex_unlock(&poolMutex);
+
+	if(handle)
+		curl_easy_cleanup(handle);
+}
+
+void wsetRateLimit(const char* url, int requestsPerSecond)
+{
+	char* hostKey = host_key_from_url(url);
+
+	g_mutex_lock(&poolMutex);
+	if(hostPools)
+	{
+		struct HostPool* pool = host_pool_get_locked(hostKey);
+		pool->interval = requestsPerSecond > 0 ? G_USEC_PER_SEC/requestsPerSecond : 0;
+		pool->nextSlot = 0;
+	}
+	g_mutex_unlock(&poolMutex);
+
+	g_free(hostKey);
+}
+
+/* Reserves the next free request slot of the host and returns the monotonic time at which it may be used.
+ * Slots are handed out interval apart without any burst allowance, so concurrent requests are spread evenly */
+static gint64 host_rate_limit_reserve(const char* hostKey)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 slot = now;
+
+	g_mutex_lock(&poolMutex);
+	struct HostPool* pool = hostPools ? g_hash_table_lookup(hostPools, hostKey) : NULL;
+	if(pool)
+	{
+		slot = MAX(now, pool->nextSlot);
+		pool->nextSlot = slot + pool->interval;
+	}
+	g_mutex_unlock(&poolMutex);
+
+	return slot;
+}
+
+/* Holds back all further requests to the host until the given monotonic time, used when the host asks us to back off */
+static void host_rate_limit_defer(const char* hostKey, gint64 until)
+{
+	g_mutex_lock(&poolMutex);
+	if(hostPools)
+	{
+		struct HostPool* pool = host_pool_get_locked(hostKey);
+		pool->nextSlot = MAX(pool->nextSlot, until);
+	}
+	g_mutex_unlock(&poolMutex);
+}
+
+void wsetRetry(const char* url, int retries)
+{
+	char* hostKey = host_key_from_url(url);
+
+	g_mutex_lock(&poolMutex);
+	if(hostPools)
+		host_pool_get_locked(hostKey)->retries = retries;
+	g_mutex_unlock(&poolMutex);
+
+	g_free(hostKey);
+}
+
+static int host_retries(const char* hostKey)
+{
+	int retries = defaultRetries;
+
+	g_mutex_lock(&poolMutex);
+	struct HostPool* pool = hostPools ? g_hash_table_lookup(hostPools, hostKey) : NULL;
+	if(pool && pool->retries >= 0)
+		retries = pool->retries;
+	g_mutex_unlock(&poolMutex);
+
+	return retries;
+}
+
+static void transfer_count_failure(void)
+{
+	g_private_set(&transferFailures, GUINT_TO_POINTER(GPOINTER_TO_UINT(g_private_get(&transferFailures)) + 1));
+}
+
+unsigned int wgetFailureCount(void)
+{
+	return GPOINTER_TO_UINT(g_private_get(&transferFailures));
+}
+
+static bool transfer_is_transient(CURL* handle, CURLcode result)
+{
+	long httpCode = 0;
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &httpCode);
+
+	// checked first as a non pdf error page may have aborted a pdf transfer with CURLE_WRITE_ERROR
+	switch(httpCode)
+	{
+		case 408:
+		case 429:
+		case 500:
+		case 502:
+		case 503:
+		case 504:
+			return true;
+		default:
+			break;
+	}
+
+	switch(result)
+	{
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_SSL_CONNECT_ERROR:
+		case CURLE_HTTP2:
+		case CURLE_HTTP2_STREAM:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Returns the delay in us before the given retry, attempt starts at 0.
+ * The delay grows exponentially with jitter so that clients that failed together dont retry together,
+ * a Retry-After header sent by the server is used instead if it asks for more time. */
+static gint64 retry_delay(CURL* handle, int attempt)
+{
+	gint64 delayMs = retryDelayMs;
+	for(int i = 0; i < attempt && delayMs < RETRY_MAX_DELAY_MS; ++i)
+		delayMs *= 2;
+	delayMs = MIN(delayMs, RETRY_MAX_DELAY_MS);
+	delayMs = delayMs/2 + g_random_int_range(0, delayMs/2 + 1);
+
+	curl_off_t retryAfter = 0;
+	if(curl_easy_getinfo(handle, CURLINFO_RETRY_AFTER, &retryAfter) == CURLE_OK && retryAfter > 0)
+		delayMs = MAX(delayMs, MIN(retryAfter*1000, RETRY_MAX_DELAY_MS));
+
+	return delayMs*1000;
+}
+
+static void setup_request(CURL* curlContext, const char* url, const char* postData, const char* userAgent,
+						  int timeout, write_callback_fn writeFn, void* writeData, char* errorBuffer)
+{
 	CURLcode ret;
 
 	ret = curl_easy_setopt(curlContext, CURLOPT_ERRORBUFFER, errorBuffer);
 	assert(ret == CURLE_OK);
 	ret = curl_easy_setopt(curlContext, CURLOPT_URL, url);
 	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEFUNCTION, writeCallback);
+	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEFUNCTION, writeFn);
 	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEDATA, buffer);
+	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEDATA, writeData);
 	assert(ret == CURLE_OK);
 	ret = curl_easy_setopt(curlContext, CURLOPT_TIMEOUT, (long)timeout);
 	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_USERAGENT, "Mozilla/5.0 (X11; Linux x86_64; rv:106.0) Gecko/20100101 Firefox/106.0");
-	assert(ret == CURLE_OK);
+	if(userAgent)
+	{
+		ret = curl_easy_setopt(curlContext, CURLOPT_USERAGENT, userAgent);
+		assert(ret == CURLE_OK);
+	}
+	if(postData)
+	{
+		ret = curl_easy_setopt(curlContext, CURLOPT_POST, 1L);
+		assert(ret == CURLE_OK);
+		ret = curl_easy_setopt(curlContext, CURLOPT_POSTFIELDS, postData);
+		assert(ret == CURLE_OK);
+	}
 	ret = curl_easy_setopt(curlContext, CURLOPT_SERVER_RESPONSE_TIMEOUT, (long)timeout/3);
 	assert(ret == CURLE_OK);
-	ret = curl_easy_perform(curlContext);
-	curl_easy_cleanup(curlContext);
-	if(ret != CURLE_OK)
+}
+
+static CURLcode performTransfer(const char* url, const char* postData, const char* userAgent, int timeout,
+								write_callback_fn writeFn, write_reset_fn resetFn, void* writeData)
+{
+	char* hostKey = host_key_from_url(url);
+	char errorBuffer[CURL_ERROR_SIZE] = "";
+
+	int retries = host_retries(hostKey);
+	CURLcode ret;
+	for(int attempt = 0;; ++attempt)
 	{
+		gint64 delay = host_rate_limit_reserve(hostKey) - g_get_monotonic_time();
+		if(delay > 0)
+			g_usleep(delay);
+
+		// the handle is only held for the transfer itself so that waiting requests dont keep handles out of the pool
+		CURL* curlContext = curl_handle_acquire(hostKey);
+		if(!curlContext)
+		{
+			sci_log(LL_ERR, "Utils: Could not init curl");
+			g_free(hostKey);
+			return CURLE_FAILED_INIT;
+		}
+		setup_request(curlContext, url, postData, userAgent, timeout, writeFn, writeData, errorBuffer);
+
+		ret = curl_easy_perform(curlContext);
+		bool transient = transfer_is_transient(curlContext, ret);
+		if(!transient || attempt >= retries)
+		{
+			curl_handle_release(curlContext, hostKey);
+			if(transient)
+				transfer_count_failure();
+			if(transient && ret == CURLE_OK)
+				ret = CURLE_HTTP_RETURNED_ERROR;
+			break;
+		}
+
+		gint64 retryDelay = retry_delay(curlContext, attempt);
+		curl_handle_release(curlContext, hostKey);
+		sci_log(LL_WARN, "Request to %s failed transiently, retrying %i of %i in %lims",
+				url, attempt+1, retries, (long)(retryDelay/1000));
+		host_rate_limit_defer(hostKey, g_get_monotonic_time() + retryDelay);
+		resetFn(writeData);
+		errorBuffer[0] = '\0';
+	}
+
+	g_free(hostKey);
+	if(ret != CURLE_OK && ret != CURLE_WRITE_ERROR)
 		sci_log(LL_ERR, "Could not load from %s curl retuned errno %i\n%s", url, ret, errorBuffer);
+
+	return ret;
+}
+
+static GString* performRequest(const char* url, const char* postData, const char* userAgent, int timeout)
+{
+	GString* buffer = g_string_new(NULL);
+	CURLcode ret = performTransfer(url, postData, userAgent, timeout, writeCallback, writeReset, buffer);
+	if(ret != CURLE_OK)
+	{
 		g_string_free(buffer, true);
 		return NULL;
 	}
@@ -101,10 +445,13 @@ static GString* wgetUrlUa(const char* url, int timeout)
 	return buffer;
 }
 
-PdfData* wgetPdf(const char* url, int timeout)
+static GString* wgetUrlUa(const char* url, int timeout)
 {
-	GString *response = wgetUrlUa(url, timeout);
+	return performRequest(url, NULL, BROWSER_USER_AGENT, timeout);
+}
 
+static PdfData* pdf_data_from_response(GString* response)
+{
 	PdfData* pdfData = NULL;
 
 	if(response && response->len > 100)
@@ -128,114 +475,753 @@ PdfData* wgetPdf(const char* url, int timeout)
 		sci_log(LL_DEBUG, "%s: Return data to short to be a pdf at length %zu", __func__, response ? response->len : 0);
 	}
 	if(response)
-		g_string_free(response, false);
+		g_string_free(response, !pdfData);
 
 	return pdfData;
 }
 
-GString* wgetUrl(const char* url, int timeout)
+PdfData* wgetPdf(const char* url, int timeout)
+{
+	return pdf_data_from_response(wgetUrlUa(url, timeout));
+}
+
+#define PDF_MAGIC "%PDF"
+#define PDF_MAGIC_LENGTH 4
+#define PDF_MIN_LENGTH 100
+
+struct PdfFile
 {
-	CURL* curlContext = curl_easy_init();
-	if(!curlContext)
+	char* fileName;
+	char* tmpName;
+	FILE* file;
+	char head[PDF_MAGIC_LENGTH];
+	size_t length;
+	bool rejected;
+	bool failed;
+};
+
+static struct PdfFile* pdf_file_open(const char* fileName)
+{
+	struct PdfFile* pdfFile = g_malloc0(sizeof(*pdfFile));
+	pdfFile->fileName = g_strdup(fileName);
+	pdfFile->tmpName = g_strconcat(fileName, ".XXXXXX", NULL);
+
+	int fd = g_mkstemp_full(pdfFile->tmpName, O_WRONLY, 0666);
+	if(fd >= 0)
+		pdfFile->file = fdopen(fd, "wb");
+
+	if(!pdfFile->file)
 	{
-		sci_log(LL_ERR, "Utils: Could not init curl");
+		sci_log(LL_ERR, "%s: Could not create %s: %s", __func__, pdfFile->tmpName, g_strerror(errno));
+		if(fd >= 0)
+		{
+			close(fd);
+			g_unlink(pdfFile->tmpName);
+		}
+		g_free(pdfFile->fileName);
+		g_free(pdfFile->tmpName);
+		g_free(pdfFile);
 		return NULL;
 	}
 
-	char errorBuffer[CURL_ERROR_SIZE] = "";
-	GString* buffer = g_string_new(NULL);
-	CURLcode ret;
+	return pdfFile;
+}
 
-	ret = curl_easy_setopt(curlContext, CURLOPT_ERRORBUFFER, errorBuffer);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_URL, url);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEFUNCTION, writeCallback);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEDATA, buffer);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_TIMEOUT, timeout);
-	assert(ret == CURLE_OK);
-	//ret = curl_easy_setopt(curlContext, CURLOPT_USERAGENT, "Mozilla/5.0 (X11; Linux x86_64; rv:106.0) Gecko/20100101 Firefox/106.0");
-	//assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_SERVER_RESPONSE_TIMEOUT, timeout/3);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_perform(curlContext);
-	curl_easy_cleanup(curlContext);
+static size_t pdfFileWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	struct PdfFile* pdfFile = userp;
+	const char* data = contents;
+	size_t length = size * nmemb;
+	size_t offset = 0;
+
+	// the magic is checked on the first bytes so that html landing pages are aborted right away
+	if(pdfFile->length < PDF_MAGIC_LENGTH)
+	{
+		offset = MIN(PDF_MAGIC_LENGTH - pdfFile->length, length);
+		memcpy(pdfFile->head + pdfFile->length, data, offset);
+		pdfFile->length += offset;
+		if(pdfFile->length < PDF_MAGIC_LENGTH)
+			return length;
+
+		if(memcmp(pdfFile->head, PDF_MAGIC, PDF_MAGIC_LENGTH) != 0)
+		{
+			sci_log(LL_DEBUG, "%s: Got invalid pdf data", __func__);
+			pdfFile->rejected = true;
+			return 0;
+		}
+
+		if(fwrite(pdfFile->head, 1, PDF_MAGIC_LENGTH, pdfFile->file) != PDF_MAGIC_LENGTH)
+		{
+			pdfFile->failed = true;
+			return 0;
+		}
+	}
+
+	if(fwrite(data + offset, 1, length - offset, pdfFile->file) != length - offset)
+	{
+		pdfFile->failed = true;
+		return 0;
+	}
+
+	pdfFile->length += length - offset;
+	return length;
+}
+
+static void pdfFileWriteReset(void *userp)
+{
+	struct PdfFile* pdfFile = userp;
+	rewind(pdfFile->file);
+	if(ftruncate(fileno(pdfFile->file), 0) != 0)
+		pdfFile->failed = true;
+	pdfFile->length = 0;
+	pdfFile->rejected = false;
+}
+
+static bool pdf_file_finish(struct PdfFile* pdfFile, bool transferOk)
+{
+	bool ret = transferOk && !pdfFile->rejected && !pdfFile->failed;
+
+	if(fclose(pdfFile->file) != 0)
+		pdfFile->failed = true;
+
+	if(pdfFile->failed)
+	{
+		sci_log(LL_ERR, "%s: Could not write to %s: %s", __func__, pdfFile->tmpName, g_strerror(errno));
+		ret = false;
+	}
+	else if(ret && pdfFile->length <= PDF_MIN_LENGTH)
+	{
+		sci_log(LL_DEBUG, "%s: Return data to short to be a pdf at length %zu", __func__, pdfFile->length);
+		ret = false;
+	}
+
+	if(ret && g_rename(pdfFile->tmpName, pdfFile->fileName) != 0)
+	{
+		sci_log(LL_ERR, "%s: Could not move pdf to %s: %s", __func__, pdfFile->fileName, g_strerror(errno));
+		ret = false;
+	}
+
+	if(!ret)
+		g_unlink(pdfFile->tmpName);
+
+	g_free(pdfFile->fileName);
+	g_free(pdfFile->tmpName);
+	g_free(pdfFile);
+	return ret;
+}
+
+bool wgetPdfToFile(const char* url, int timeout, const char* fileName)
+{
+	struct PdfFile* pdfFile = pdf_file_open(fileName);
+	if(!pdfFile)
+		return false;
+
+	CURLcode ret = performTransfer(url, NULL, BROWSER_USER_AGENT, timeout, pdfFileWriteCallback, pdfFileWriteReset, pdfFile);
+	return pdf_file_finish(pdfFile, ret == CURLE_OK);
+}
+
+GString* wgetUrl(const char* url, int timeout)
+{
+	return performRequest(url, NULL, NULL, timeout);
+}
+
+struct JsonSink
+{
+	nx_json_stream* stream;
+	const char* itemsPath;
+	const nx_json_projection* projection;
+	nx_json_item_callback itemFn;
+	void* userData;
+	size_t seen;
+	size_t emitted;
+};
+
+static void jsonSinkItem(const nx_json* item, void* userp)
+{
+	struct JsonSink* sink = userp;
+
+	// items the caller already got before a retry restarted the transfer are not handed out again
+	if(++sink->seen <= sink->emitted)
+		return;
+
+	++sink->emitted;
+	sink->itemFn(item, sink->userData);
+}
+
+static size_t jsonWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	struct JsonSink* sink = userp;
+	if(!nx_json_stream_feed(sink->stream, contents, size * nmemb))
+		return 0;
+	return size * nmemb;
+}
+
+static void jsonWriteReset(void *userp)
+{
+	struct JsonSink* sink = userp;
+	nx_json_stream_free(sink->stream);
+	sink->stream = nx_json_stream_new(sink->itemsPath, jsonSinkItem, sink);
+	nx_json_stream_set_projection(sink->stream, sink->projection);
+	sink->seen = 0;
+}
+
+const nx_json* wgetJson(const char* url, int timeout, const char* itemsPath, const nx_json_projection* projection,
+					   nx_json_item_callback itemFn, void* userData)
+{
+	struct JsonSink sink = {
+		.itemsPath = itemsPath,
+		.projection = projection,
+		.itemFn = itemFn,
+		.userData = userData
+	};
+	sink.stream = nx_json_stream_new(itemsPath, jsonSinkItem, &sink);
+	nx_json_stream_set_projection(sink.stream, projection);
+
+	CURLcode ret = performTransfer(url, NULL, NULL, timeout, jsonWriteCallback, jsonWriteReset, &sink);
 	if(ret != CURLE_OK)
 	{
-		sci_log(LL_ERR, "Could not load from %s curl retuned errno %i\n%s", url, ret, errorBuffer);
-		g_string_free(buffer, true);
+		if(ret == CURLE_WRITE_ERROR)
+			sci_log(LL_WARN, "%s: Got invalid json from %s", __func__, url);
+		nx_json_stream_free(sink.stream);
 		return NULL;
 	}
 
-	return buffer;
+	const nx_json* json = nx_json_stream_finish(sink.stream);
+	if(!json)
+		sci_log(LL_WARN, "%s: Got incomplete json from %s", __func__, url);
+	return json;
 }
 
 GString* wpostUrl(const char* url, const char* data, int timeout)
 {
-	CURL* curlContext = curl_easy_init();
-	if(!curlContext)
+	return performRequest(url, data, NULL, timeout);
+}
+
+struct WRequest
+{
+	CURL* handle;
+	char* hostKey;
+	char* url;
+	char* postData;
+	GString* buffer;
+	struct PdfFile* pdfFile;
+	char errorBuffer[CURL_ERROR_SIZE];
+	wrequest_done_fn done;
+	wrequest_pdf_done_fn pdfDone;
+	wrequest_file_done_fn fileDone;
+	void* userData;
+	gint64 notBefore;
+	bool started;
+	int attempt;
+	int retries;
+	GList* link;
+};
+
+struct _WRequestSet
+{
+	CURLM* multi;
+	GQueue active;
+};
+
+WRequestSet* wrequest_set_new(void)
+{
+	CURLM* multi = curl_multi_init();
+	if(!multi)
 	{
-		sci_log(LL_ERR, "Utils: Could not init curl");
+		sci_log(LL_ERR, "Utils: Could not init curl multi");
 		return NULL;
 	}
 
-	char errorBuffer[CURL_ERROR_SIZE] = "";
-	GString* buffer = g_string_new(NULL);
-	CURLcode ret;
+	WRequestSet* set = g_malloc0(sizeof(*set));
+	set->multi = multi;
+	g_queue_init(&set->active);
+	return set;
+}
 
-	ret = curl_easy_setopt(curlContext, CURLOPT_ERRORBUFFER, errorBuffer);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_URL, url);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEFUNCTION, writeCallback);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_WRITEDATA, buffer);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_POST, 1);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_POSTFIELDS, data);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_TIMEOUT, timeout);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_setopt(curlContext, CURLOPT_SERVER_RESPONSE_TIMEOUT, timeout/3);
-	assert(ret == CURLE_OK);
-	ret = curl_easy_perform(curlContext);
-	curl_easy_cleanup(curlContext);
-	if(ret != CURLE_OK)
+static void wrequest_free(struct WRequest* request)
+{
+	if(request->handle)
+		curl_handle_release(request->handle, request->hostKey);
+	g_free(request->hostKey);
+	g_free(request->url);
+	g_free(request->postData);
+	if(request->buffer)
+		g_string_free(request->buffer, true);
+	g_free(request);
+}
+
+static void wrequest_complete(struct WRequest* request, GString* response)
+{
+	if(request->pdfFile)
 	{
-		sci_log(LL_ERR, "Could not load from %s curl retuned errno %i\n%s", url, ret, errorBuffer);
-		g_string_free(buffer, true);
-		return NULL;
+		bool saved = pdf_file_finish(request->pdfFile, response != NULL);
+		request->pdfFile = NULL;
+		if(response)
+			g_string_free(response, true);
+		if(request->fileDone)
+			request->fileDone(saved, request->userData);
 	}
+	else if(request->pdfDone)
+		request->pdfDone(pdf_data_from_response(response), request->userData);
+	else if(request->done)
+		request->done(response, request->userData);
+	else if(response)
+		g_string_free(response, true);
+}
 
-	return buffer;
+static bool wrequest_set_add(WRequestSet* set, struct WRequest* request, const char* url, const char* postData,
+							 const char* userAgent, int timeout)
+{
+	request->hostKey = host_key_from_url(url);
+	request->url = g_strdup(url);
+	request->postData = g_strdup(postData);
+	request->buffer = g_string_new(NULL);
+	request->handle = curl_handle_acquire(request->hostKey);
+	request->retries = host_retries(request->hostKey);
+
+	if(!request->handle)
+	{
+		sci_log(LL_ERR, "Utils: Could not init curl");
+		wrequest_complete(request, NULL);
+		wrequest_free(request);
+		return false;
+	}
+
+	if(request->pdfFile)
+	{
+		setup_request(request->handle, request->url, request->postData, userAgent, timeout,
+					  pdfFileWriteCallback, request->pdfFile, request->errorBuffer);
+	}
+	else
+	{
+		setup_request(request->handle, request->url, request->postData, userAgent, timeout,
+					  writeCallback, request->buffer, request->errorBuffer);
+	}
+	curl_easy_setopt(request->handle, CURLOPT_PRIVATE, request);
+
+	// the request is only handed to curl once its rate limit slot has come, see wrequest_set_start_due
+	request->notBefore = host_rate_limit_reserve(request->hostKey);
+	g_queue_push_tail(&set->active, request);
+	request->link = set->active.tail;
+	return true;
 }
 
-GString* createJsonEntry(const int indent, const char* key, const char* value, bool quote, bool newline)
+bool wrequest_set_add_get(WRequestSet* set, const char* url, int timeout, wrequest_done_fn done, void* userData)
 {
-	if(!key || !value)
-		return g_string_new("");
+	struct WRequest* request = g_malloc0(sizeof(*request));
+	request->done = done;
+	request->userData = userData;
+	return wrequest_set_add(set, request, url, NULL, NULL, timeout);
+}
+
+bool wrequest_set_add_post(WRequestSet* set, const char* url, const char* data, int timeout, wrequest_done_fn done, void* userData)
+{
+	struct WRequest* request = g_malloc0(sizeof(*request));
+	request->done = done;
+	request->userData = userData;
+	return wrequest_set_add(set, request, url, data, NULL, timeout);
+}
+
+bool wrequest_set_add_pdf(WRequestSet* set, const char* url, int timeout, wrequest_pdf_done_fn done, void* userData)
+{
+	struct WRequest* request = g_malloc0(sizeof(*request));
+	request->pdfDone = done;
+	request->userData = userData;
+	return wrequest_set_add(set, request, url, NULL, BROWSER_USER_AGENT, timeout);
+}
+
+bool wrequest_set_add_pdf_file(WRequestSet* set, const char* url, int timeout, const char* fileName,
+							   wrequest_file_done_fn done, void* userData)
+{
+	struct PdfFile* pdfFile = pdf_file_open(fileName);
+	if(!pdfFile)
+	{
+		if(done)
+			done(false, userData);
+		return false;
+	}
+
+	struct WRequest* request = g_malloc0(sizeof(*request));
+	request->pdfFile = pdfFile;
+	request->fileDone = done;
+	request->userData = userData;
+	return wrequest_set_add(set, request, url, NULL, BROWSER_USER_AGENT, timeout);
+}
+
+/* Starts all requests whose rate limit slot has come and returns the time the next pending request is due, or 0 if there is none */
+static gint64 wrequest_set_start_due(WRequestSet* set)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 nextStart = 0;
+
+	GList* element = set->active.head;
+	while(element)
+	{
+		struct WRequest* request = element->data;
+		element = element->next;
+
+		if(request->started)
+			continue;
+
+		if(request->notBefore > now)
+		{
+			if(!nextStart || request->notBefore < nextStart)
+				nextStart = request->notBefore;
+			continue;
+		}
+
+		CURLMcode ret = curl_multi_add_handle(set->multi, request->handle);
+		if(ret != CURLM_OK)
+		{
+			sci_log(LL_ERR, "Could not add request for %s: %s", request->url, curl_multi_strerror(ret));
+			g_queue_delete_link(&set->active, request->link);
+			wrequest_complete(request, NULL);
+			wrequest_free(request);
+			continue;
+		}
+		request->started = true;
+	}
+
+	return nextStart;
+}
+
+static void wrequest_set_finish(WRequestSet* set, struct WRequest* request, CURLcode result)
+{
+	curl_multi_remove_handle(set->multi, request->handle);
+
+	bool transient = transfer_is_transient(request->handle, result);
+	if(transient && request->attempt < request->retries)
+	{
+		gint64 retryDelay = retry_delay(request->handle, request->attempt);
+		++request->attempt;
+		sci_log(LL_WARN, "Request to %s failed transiently, retrying %i of %i in %lims",
+				request->url, request->attempt, request->retries, (long)(retryDelay/1000));
+		host_rate_limit_defer(request->hostKey, g_get_monotonic_time() + retryDelay);
+
+		if(request->pdfFile)
+			pdfFileWriteReset(request->pdfFile);
+		else
+			writeReset(request->buffer);
+		request->errorBuffer[0] = '\0';
+
+		// stays in the active queue and is restarted by wrequest_set_start_due once its slot has come
+		request->started = false;
+		request->notBefore = host_rate_limit_reserve(request->hostKey);
+		return;
+	}
+	else if(transient)
+	{
+		transfer_count_failure();
+		if(result == CURLE_OK)
+			result = CURLE_HTTP_RETURNED_ERROR;
+	}
 
-	GString* ret = g_string_new(NULL);
+	g_queue_delete_link(&set->active, request->link);
+
+	GString* response = NULL;
+	if(result == CURLE_OK)
+	{
+		response = request->buffer;
+		request->buffer = NULL;
+	}
+	else if(result != CURLE_WRITE_ERROR)
+	{
+		sci_log(LL_ERR, "Could not load from %s curl retuned errno %i\n%s", request->url, result, request->errorBuffer);
+	}
+
+	// return the handle to the pool before the callback, so that requests queued by it can reuse the connection
+	curl_handle_release(request->handle, request->hostKey);
+	request->handle = NULL;
+	wrequest_complete(request, response);
+	wrequest_free(request);
+}
+
+size_t wrequest_set_poll(WRequestSet* set, int timeoutMs)
+{
+	int running = 0;
+	gint64 nextStart = wrequest_set_start_due(set);
+	CURLMcode ret = curl_multi_perform(set->multi, &running);
+	if(ret == CURLM_OK && (running > 0 || nextStart) && timeoutMs > 0)
+	{
+		// dont sleep past the point where a rate limited request may start
+		if(nextStart)
+		{
+			gint64 untilStart = (nextStart - g_get_monotonic_time() + 999)/1000;
+			timeoutMs = CLAMP(untilStart, 0, timeoutMs);
+		}
+
+		ret = curl_multi_poll(set->multi, NULL, 0, timeoutMs, NULL);
+		wrequest_set_start_due(set);
+		if(ret == CURLM_OK)
+			ret = curl_multi_perform(set->multi, &running);
+	}
+
+	if(ret != CURLM_OK)
+		sci_log(LL_ERR, "%s: curl multi failed: %s", __func__, curl_multi_strerror(ret));
+
+	CURLMsg* message;
+	int queued;
+	while((message = curl_multi_info_read(set->multi, &queued)))
+	{
+		if(message->msg != CURLMSG_DONE)
+			continue;
+
+		struct WRequest* request = NULL;
+		curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&request);
+		wrequest_set_finish(set, request, message->data.result);
+	}
+
+	return set->active.length;
+}
+
+void wrequest_set_wait(WRequestSet* set)
+{
+	while(wrequest_set_poll(set, 1000) > 0);
+}
+
+void wrequest_set_free(WRequestSet* set)
+{
+	if(!set)
+		return;
+
+	struct WRequest* request;
+	while((request = g_queue_pop_head(&set->active)))
+	{
+		if(request->started)
+			curl_multi_remove_handle(set->multi, request->handle);
+		wrequest_complete(request, NULL);
+		wrequest_free(request);
+	}
+
+	curl_multi_cleanup(set->multi);
+	g_free(set);
+}
+
+bool utils_init(void)
+{
+	if(curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+	{
+		sci_log(LL_ERR, "Utils: Could not init curl");
+		return false;
+	}
+
+	curlShare = curl_share_init();
+	if(curlShare)
+	{
+		curl_share_setopt(curlShare, CURLSHOPT_LOCKFUNC, shareLock);
+		curl_share_setopt(curlShare, CURLSHOPT_UNLOCKFUNC, shareUnlock);
+		curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		// the connection cache is not shared, libcurl does not support using a shared one from several threads,
+		// connections are kept alive by the per host handle pool instead
+	}
+	else
+	{
+		sci_log(LL_WARN, "Utils: Could not create curl share, dns and tls sessions will not be shared");
+	}
+
+	defaultRetries = sci_conf_get_int("Network", "Retry", defaultRetries, NULL);
+	retryDelayMs = sci_conf_get_int("Network", "RetryDelay", retryDelayMs, NULL);
+
+	g_mutex_lock(&poolMutex);
+	hostPools = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, host_pool_free);
+	g_mutex_unlock(&poolMutex);
+
+	return true;
+}
+
+void utils_exit(void)
+{
+	g_mutex_lock(&poolMutex);
+	if(hostPools)
+		g_hash_table_destroy(hostPools);
+	hostPools = NULL;
+	g_mutex_unlock(&poolMutex);
+
+	if(curlShare)
+		curl_share_cleanup(curlShare);
+	curlShare = NULL;
+
+	curl_global_cleanup();
+}
+
+void json_writer_init_count(JsonWriter* writer)
+{
+	writer->buffer = NULL;
+	writer->file = NULL;
+	writer->length = 0;
+	writer->error = false;
+}
+
+void json_writer_init_buffer(JsonWriter* writer, char* buffer)
+{
+	json_writer_init_count(writer);
+	writer->buffer = buffer;
+	buffer[0] = '\0';
+}
+
+void json_writer_init_file(JsonWriter* writer, FILE* file)
+{
+	json_writer_init_count(writer);
+	writer->file = file;
+}
+
+void json_writer_append(JsonWriter* writer, const char* data, size_t length)
+{
+	if(writer->buffer)
+	{
+		memcpy(writer->buffer + writer->length, data, length);
+		writer->buffer[writer->length + length] = '\0';
+	}
+	else if(writer->file && !writer->error)
+	{
+		if(fwrite(data, 1, length, writer->file) != length)
+			writer->error = true;
+	}
+	writer->length += length;
+}
+
+/* Returns the number of bytes at the start of p that can be copied verbatim, that is printable ascii not contained in specials.
+ * Control characters and non ascii bytes always end the run, so that the caller can escape or validate them. */
+static size_t escape_scan(const unsigned char* p, const unsigned char* end, const char* specials)
+{
+	const unsigned char* start = p;
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(' ');
+	while(end - p >= 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)p);
+		// the compare is signed, so bytes >= 0x80 are caught together with the control characters
+		__m128i hits = _mm_cmplt_epi8(block, space);
+		for(const char* special = specials; *special; ++special)
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(*special)));
+		int mask = _mm_movemask_epi8(hits);
+		if(mask)
+			return p - start + g_bit_nth_lsf(mask, -1);
+		p += 16;
+	}
+#endif
+	while(p < end && *p >= ' ' && *p < 0x80 && !strchr(specials, *p))
+		++p;
+	return p - start;
+}
+
+// returns the length of the valid utf-8 sequence at p, or 0 if it is invalid
+static size_t utf8_sequence_length(const unsigned char* p, const unsigned char* end)
+{
+	static const unsigned int minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+	size_t length;
+	unsigned int codepoint;
+
+	if(*p < 0x80)
+		return 1;
+	else if((*p & 0xE0) == 0xC0)
+		length = 2, codepoint = *p & 0x1F;
+	else if((*p & 0xF0) == 0xE0)
+		length = 3, codepoint = *p & 0x0F;
+	else if((*p & 0xF8) == 0xF0)
+		length = 4, codepoint = *p & 0x07;
+	else
+		return 0;
+
+	if((size_t)(end - p) < length)
+		return 0;
+
+	for(size_t i = 1; i < length; ++i)
+	{
+		if((p[i] & 0xC0) != 0x80)
+			return 0;
+		codepoint = codepoint << 6 | (p[i] & 0x3F);
+	}
+
+	if(codepoint < minimum[length] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+		return 0;
+	return length;
+}
+
+void json_writer_append_escaped(JsonWriter* writer, const char* value)
+{
+	const unsigned char* p = (const unsigned char*)value;
+	const unsigned char* end = p + strlen(value);
+	while(p < end)
+	{
+		size_t run = escape_scan(p, end, "\"\\");
+		if(run)
+			json_writer_append(writer, (const char*)p, run);
+		p += run;
+		if(p == end)
+			break;
+
+		if(*p >= 0x80)
+		{
+			size_t length = utf8_sequence_length(p, end);
+			if(length)
+				json_writer_append(writer, (const char*)p, length);
+			else
+				json_writer_append(writer, "\\ufffd", 6);
+			p += length ? length : 1;
+			continue;
+		}
+
+		char escape[8] = {'\\', *p};
+		size_t length = 2;
+		switch(*p)
+		{
+			case '\b':
+				escape[1] = 'b';
+				break;
+			case '\f':
+				escape[1] = 'f';
+				break;
+			case '\n':
+				escape[1] = 'n';
+				break;
+			case '\r':
+				escape[1] = 'r';
+				break;
+			case '\t':
+				escape[1] = 't';
+				break;
+			case '\\':
+			case '"':
+				break;
+			default:
+				length = snprintf(escape, sizeof(escape), "\\u%04x", *p);
+				break;
+		}
+		json_writer_append(writer, escape, length);
+		++p;
+	}
+}
+
+void json_writer_append_entry(JsonWriter* writer, int indent, const char* key, const char* value, bool quote, bool newline)
+{
+	if(!key || !value)
+		return;
 
 	for(int i = 0; i < indent; ++i)
-		g_string_append_c(ret, '\t');
+		json_writer_append(writer, "\t", 1);
 
-	g_string_append_c(ret, '\"');
-	g_string_append(ret, key);
-	g_string_append(ret, "\":");
-	g_string_append_c(ret, ' ');
+	json_writer_append(writer, "\"", 1);
+	json_writer_append(writer, key, strlen(key));
+	json_writer_append(writer, quote ? "\": \"" : "\": ", quote ? 4 : 3);
+	json_writer_append_escaped(writer, value);
 	if(quote)
-		g_string_append_c(ret, '\"');
-	char* escapedValue = g_strescape(value, NULL);
-	g_string_append(ret, escapedValue);
-	g_free(escapedValue);
-	if(quote)
-		g_string_append_c(ret, '\"');
+		json_writer_append(writer, "\"", 1);
 	if(newline)
-		g_string_append(ret, ",\n");
+		json_writer_append(writer, ",\n", 2);
+}
+
+GString* createJsonEntry(const int indent, const char* key, const char* value, bool quote, bool newline)
+{
+	JsonWriter writer;
+	json_writer_init_count(&writer);
+	json_writer_append_entry(&writer, indent, key, value, quote, newline);
+
+	GString* ret = g_string_sized_new(writer.length);
+	json_writer_init_buffer(&writer, ret->str);
+	json_writer_append_entry(&writer, indent, key, value, quote, newline);
+	ret->len = writer.length;
 
 	return ret;
 }
@@ -0,0 +1,110 @@
+/*
+ * arena.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * arena.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * arena.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "types.h"
+
+#define DOCUMENT_COUNT 1000
+
+static void test_request_return(void)
+{
+	SciArena* arena = sci_arena_new();
+	RequestReturn* ret = request_return_new_arena(DOCUMENT_COUNT, DOCUMENT_COUNT, arena);
+
+	for(size_t i = 0; i < ret->count; ++i)
+	{
+		DocumentMeta* meta = document_meta_new_arena(arena);
+		g_assert_true(meta->arena == arena);
+		g_assert_cmpint(meta->references, ==, -1);
+		g_assert_null(meta->title);
+
+		char* doi = g_strdup_printf("10.1000/%zu", i);
+		meta->doi = document_meta_strdup(meta, doi);
+		meta->title = document_meta_strdup(meta, "A title");
+		meta->abstract = document_meta_strdup(meta, NULL);
+		g_free(doi);
+		ret->documents[i] = meta;
+	}
+
+	// nothing allocated in the arena may overlap, so every string has to be intact after all allocations
+	for(size_t i = 0; i < ret->count; ++i)
+	{
+		char* doi = g_strdup_printf("10.1000/%zu", i);
+		g_assert_cmpstr(ret->documents[i]->doi, ==, doi);
+		g_assert_cmpstr(ret->documents[i]->title, ==, "A title");
+		g_assert_null(ret->documents[i]->abstract);
+		g_free(doi);
+	}
+
+	request_return_free(ret);
+}
+
+// strings larger than a quarter of a block get blocks of their own, the smaller ones must still share blocks
+static void test_large_strings(void)
+{
+	SciArena* arena = sci_arena_new();
+	RequestReturn* ret = request_return_new_arena(3, 3, arena);
+
+	GString* large = g_string_new(NULL);
+	for(size_t i = 0; i < 40000; ++i)
+		g_string_append_c(large, 'a' + i % 26);
+
+	for(size_t i = 0; i < ret->count; ++i)
+	{
+		ret->documents[i] = document_meta_new_arena(arena);
+		ret->documents[i]->title = document_meta_strdup(ret->documents[i], "before");
+		ret->documents[i]->abstract = document_meta_strdup(ret->documents[i], large->str);
+		ret->documents[i]->author = document_meta_strdup(ret->documents[i], "after");
+	}
+
+	for(size_t i = 0; i < ret->count; ++i)
+	{
+		g_assert_cmpstr(ret->documents[i]->title, ==, "before");
+		g_assert_cmpstr(ret->documents[i]->abstract, ==, large->str);
+		g_assert_cmpstr(ret->documents[i]->author, ==, "after");
+	}
+
+	g_string_free(large, true);
+	request_return_free(ret);
+}
+
+// a RequestReturn without an arena still owns documents that were allocated on their own
+static void test_without_arena(void)
+{
+	RequestReturn* ret = request_return_new(2, 2);
+	g_assert_null(ret->arena);
+	for(size_t i = 0; i < ret->count; ++i)
+	{
+		ret->documents[i] = document_meta_new();
+		ret->documents[i]->doi = document_meta_strdup(ret->documents[i], "10.1000/1");
+		g_assert_null(ret->documents[i]->arena);
+	}
+	request_return_free(ret);
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/arena/request-return", test_request_return);
+	g_test_add_func("/arena/large-strings", test_large_strings);
+	g_test_add_func("/arena/without-arena", test_without_arena);
+	return g_test_run();
+}
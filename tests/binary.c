@@ -0,0 +1,187 @@
+/*
+ * binary.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * binary.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * binary.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "types.h"
+
+static DocumentMeta* create_meta(void)
+{
+	DocumentMeta* meta = document_meta_new();
+	meta->doi = g_strdup("10.1000/182");
+	meta->url = g_strdup("https://example.org/182");
+	meta->year = 2023;
+	meta->title = g_strdup("Sch\xc3\xb6" "ne \"Titel\"");
+	meta->author = g_strdup("A. Author, B. Author");
+	meta->abstract = g_strdup("");
+	meta->references = 42;
+	meta->hasFullText = true;
+	meta->compleatedLookup = true;
+	return meta;
+}
+
+static void check_meta(const DocumentMeta* meta, const DocumentMeta* expected)
+{
+	g_assert_true(document_meta_is_equal(meta, expected));
+	g_assert_cmpstr(meta->abstract, ==, expected->abstract);
+	g_assert_cmpstr(meta->searchText, ==, expected->searchText);
+	g_assert_null(meta->publisher);
+	g_assert_cmpint(meta->references, ==, expected->references);
+	g_assert_true(meta->hasFullText == expected->hasFullText);
+	g_assert_true(meta->compleatedLookup == expected->compleatedLookup);
+}
+
+static void test_roundtrip(void)
+{
+	DocumentMeta* meta = create_meta();
+	size_t length;
+	char* record = document_meta_get_binary(meta, "full text", &length);
+	g_assert_nonnull(record);
+
+	char* fullText;
+	DocumentMeta* loaded = document_meta_load_from_binary(record, length, &fullText);
+	g_assert_nonnull(loaded);
+	check_meta(loaded, meta);
+	g_assert_cmpstr(fullText, ==, "full text");
+	g_free(fullText);
+	document_meta_unref(loaded);
+
+	// the loaded meta must not refer to the buffer it was loaded from
+	loaded = document_meta_load_from_binary(record, length, NULL);
+	memset(record, 0, length);
+	g_assert_cmpstr(loaded->doi, ==, "10.1000/182");
+	document_meta_unref(loaded);
+
+	g_free(record);
+	document_meta_unref(meta);
+}
+
+static void test_view_concatenated(void)
+{
+	DocumentMeta* first = create_meta();
+	DocumentMeta* second = document_meta_new();
+	second->doi = g_strdup("10.1000/183");
+	second->references = -1;
+
+	size_t firstLength, secondLength;
+	char* firstRecord = document_meta_get_binary(first, NULL, &firstLength);
+	char* secondRecord = document_meta_get_binary(second, "text", &secondLength);
+	char* data = g_malloc(firstLength + secondLength);
+	memcpy(data, firstRecord, firstLength);
+	memcpy(data + firstLength, secondRecord, secondLength);
+
+	SciArena* arena = sci_arena_new();
+	size_t recordLength;
+	const char* fullText;
+	DocumentMeta* view = document_meta_view_binary(arena, data, firstLength + secondLength, &recordLength, &fullText);
+	g_assert_nonnull(view);
+	g_assert_cmpuint(recordLength, ==, firstLength);
+	g_assert_null(fullText);
+	check_meta(view, first);
+	// the strings of a view point into the record instead of being copied
+	g_assert_true(view->doi >= data && view->doi < data + firstLength);
+	document_meta_unref(view);
+
+	view = document_meta_view_binary(arena, data + recordLength, secondLength, &recordLength, &fullText);
+	g_assert_nonnull(view);
+	g_assert_cmpuint(recordLength, ==, secondLength);
+	g_assert_cmpstr(fullText, ==, "text");
+	g_assert_cmpstr(view->doi, ==, "10.1000/183");
+	g_assert_cmpint(view->references, ==, -1);
+	g_assert_null(view->title);
+	document_meta_unref(view);
+	sci_arena_unref(arena);
+
+	g_free(data);
+	g_free(firstRecord);
+	g_free(secondRecord);
+	document_meta_unref(first);
+	document_meta_unref(second);
+}
+
+static void test_invalid(void)
+{
+	DocumentMeta* meta = create_meta();
+	size_t length;
+	char* record = document_meta_get_binary(meta, "full text", &length);
+
+	// every truncation of the record has to be rejected
+	for(size_t i = 0; i < length; ++i)
+		g_assert_null(document_meta_load_from_binary(record, i, NULL));
+
+	char* corrupt = g_memdup2(record, length);
+	corrupt[0] = 'X';
+	g_assert_null(document_meta_load_from_binary(corrupt, length, NULL));
+
+	// an unknown version
+	memcpy(corrupt, record, length);
+	corrupt[4] = 2;
+	g_assert_null(document_meta_load_from_binary(corrupt, length, NULL));
+
+	// a string whose length runs past the end of the record
+	memcpy(corrupt, record, length);
+	corrupt[28] = 0x7f;
+	g_assert_null(document_meta_load_from_binary(corrupt, length, NULL));
+
+	// a string missing its terminator
+	memcpy(corrupt, record, length);
+	corrupt[length - 1] = 'x';
+	g_assert_null(document_meta_load_from_binary(corrupt, length, NULL));
+
+	g_free(corrupt);
+	g_free(record);
+	document_meta_unref(meta);
+}
+
+static void test_file(void)
+{
+	char* fileName = g_build_filename(g_get_tmp_dir(), "scipaper-test-binary-XXXXXX", NULL);
+	int fd = g_mkstemp(fileName);
+	g_assert_cmpint(fd, >=, 0);
+	close(fd);
+
+	DocumentMeta* meta = create_meta();
+	g_assert_true(document_meta_save_binary(fileName, meta, "full text"));
+
+	char* fullText;
+	DocumentMeta* loaded = document_meta_load_from_binary_file(fileName, &fullText);
+	g_assert_nonnull(loaded);
+	check_meta(loaded, meta);
+	g_assert_cmpstr(fullText, ==, "full text");
+
+	g_free(fullText);
+	document_meta_unref(loaded);
+	document_meta_unref(meta);
+	g_unlink(fileName);
+	g_free(fileName);
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/binary/roundtrip", test_roundtrip);
+	g_test_add_func("/binary/view-concatenated", test_view_concatenated);
+	g_test_add_func("/binary/invalid", test_invalid);
+	g_test_add_func("/binary/file", test_file);
+	return g_test_run();
+}
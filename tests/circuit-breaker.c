@@ -0,0 +1,197 @@
+/*
+ * circuit-breaker.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * circuit-breaker.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * circuit-breaker.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "scipaper.h"
+#include "sci-backend.h"
+#include "utils.h"
+
+#define COOLDOWN 200
+
+// nothing listens on port 1, so every request fails at once and counts as a failure of the server
+static const char config[] =
+	"[Modules]\nModules=\n"
+	"[Cache]\nEnable=false\nMemoryEntries=256\n"
+	"[Network]\nRetry=0\n"
+	"[Dispatch]\nMode=serial\nAdaptiveOrder=false\nBreakerThreshold=3\nBreakerCooldown=60000\n";
+
+static const BackendInfo backendInfo = {"breaker-test", SCI_CAP_FILL};
+static int backendId;
+static int fillCalls;
+static bool serverDown;
+
+static RequestReturn* fill_meta(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page, void* user_data)
+{
+	(void)maxCount;
+	(void)sortMode;
+	(void)page;
+	(void)user_data;
+
+	g_atomic_int_inc(&fillCalls);
+	if(serverDown)
+	{
+		GString* response = wgetUrl("http://127.0.0.1:1/", 1000);
+		g_assert_null(response);
+		return NULL;
+	}
+	// dois starting with 10.0 do not exist, the backend answers but finds nothing
+	if(g_str_has_prefix(meta->doi, "10.0"))
+		return NULL;
+
+	RequestReturn* ret = request_return_new(1, 1);
+	ret->documents[0] = document_meta_new();
+	ret->documents[0]->doi = g_strdup(meta->doi);
+	ret->totalCount = 1;
+	return ret;
+}
+
+static void setup(void)
+{
+	g_assert_true(sci_paper_init(NULL, config, sizeof(config) - 1));
+	backendId = sci_plugin_register(&backendInfo, fill_meta, NULL, NULL, NULL);
+	fillCalls = 0;
+	serverDown = false;
+}
+
+static void teardown(void)
+{
+	sci_plugin_unregister(backendId);
+	sci_paper_exit();
+}
+
+// every lookup uses a new doi so that none of them is answered from the result cache
+static bool lookup(void)
+{
+	static int serial;
+	char* doi = g_strdup_printf("10.1000/%i", ++serial);
+	DocumentMeta* meta = sci_find_by_doi(doi, 0);
+	g_free(doi);
+	document_meta_unref(meta);
+	return meta != NULL;
+}
+
+static void test_open(void)
+{
+	setup();
+	serverDown = true;
+	for(int i = 0; i < 3; ++i)
+		g_assert_false(lookup());
+	g_assert_cmpint(fillCalls, ==, 3);
+
+	// after three failures in a row the backend is not called at all
+	serverDown = false;
+	for(int i = 0; i < 3; ++i)
+		g_assert_false(lookup());
+	g_assert_cmpint(fillCalls, ==, 3);
+	teardown();
+}
+
+static void test_probe(void)
+{
+	setup();
+	sci_set_circuit_breaker(2, COOLDOWN);
+	serverDown = true;
+	g_assert_false(lookup());
+	g_assert_false(lookup());
+	g_assert_false(lookup());
+	g_assert_cmpint(fillCalls, ==, 2);
+
+	// a failing probe after the cooldown opens the breaker again right away
+	g_usleep(COOLDOWN*1000);
+	g_assert_false(lookup());
+	g_assert_false(lookup());
+	g_assert_cmpint(fillCalls, ==, 3);
+
+	// a successful probe closes it
+	serverDown = false;
+	g_usleep(COOLDOWN*1000);
+	g_assert_true(lookup());
+	g_assert_true(lookup());
+	g_assert_cmpint(fillCalls, ==, 5);
+	teardown();
+}
+
+// a backend that answers but finds nothing is working and must never be skipped
+static void test_not_found(void)
+{
+	setup();
+	for(int i = 0; i < 10; ++i)
+	{
+		char* doi = g_strdup_printf("10.0/%i", i);
+		g_assert_null(sci_find_by_doi(doi, 0));
+		g_free(doi);
+	}
+	g_assert_cmpint(fillCalls, ==, 10);
+	teardown();
+}
+
+// a success in between resets the count of consecutive failures
+static void test_reset(void)
+{
+	setup();
+	for(int i = 0; i < 3; ++i)
+	{
+		serverDown = true;
+		g_assert_false(lookup());
+		g_assert_false(lookup());
+		serverDown = false;
+		g_assert_true(lookup());
+	}
+	g_assert_cmpint(fillCalls, ==, 9);
+	teardown();
+}
+
+// a lookup that failed is no answer and must not be remembered, unlike a lookup that found nothing
+static void test_failure_not_cached(void)
+{
+	setup();
+	serverDown = true;
+	g_assert_null(sci_find_by_doi("10.1000/failed", 0));
+	serverDown = false;
+	DocumentMeta* meta = sci_find_by_doi("10.1000/failed", 0);
+	g_assert_nonnull(meta);
+	document_meta_unref(meta);
+	g_assert_cmpint(fillCalls, ==, 2);
+	teardown();
+}
+
+static void test_disabled(void)
+{
+	setup();
+	sci_set_circuit_breaker(0, COOLDOWN);
+	serverDown = true;
+	for(int i = 0; i < 5; ++i)
+		g_assert_false(lookup());
+	g_assert_cmpint(fillCalls, ==, 5);
+	teardown();
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/circuit-breaker/open", test_open);
+	g_test_add_func("/circuit-breaker/probe", test_probe);
+	g_test_add_func("/circuit-breaker/not-found", test_not_found);
+	g_test_add_func("/circuit-breaker/reset", test_reset);
+	g_test_add_func("/circuit-breaker/failure-not-cached", test_failure_not_cached);
+	g_test_add_func("/circuit-breaker/disabled", test_disabled);
+	return g_test_run();
+}
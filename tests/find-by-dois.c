@@ -0,0 +1,197 @@
+/*
+ * find-by-dois.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * find-by-dois.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * find-by-dois.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "scipaper.h"
+#include "sci-backend.h"
+
+static const char config[] =
+	"[Modules]\nModules=\n"
+	"[Cache]\nEnable=false\nMemoryEntries=256\n"
+	"[Dispatch]\nMode=serial\nAdaptiveOrder=false\nCompletionThreads=4\n";
+
+/* Two fake backends, batch knows a and b and can look up many dois at once, it answers for c without finding it
+ * and gets no answer for d. single can only look up dois one by one and knows d */
+struct FakeBackend
+{
+	const char** known;
+	GMutex lock;
+	GString* asked; // every doi asked of fill_meta, separated by spaces
+	GString* batches; // the dois of every batch, one batch per line
+	int id;
+};
+
+static const char* batchKnown[] = {"10.1/a", "10.1/b", NULL};
+static const char* singleKnown[] = {"10.1/d", NULL};
+static const BackendInfo batchInfo = {"batch", SCI_CAP_FILL};
+static const BackendInfo singleInfo = {"single", SCI_CAP_FILL};
+static struct FakeBackend batch = {batchKnown};
+static struct FakeBackend single = {singleKnown};
+
+static DocumentMeta* fake_lookup(struct FakeBackend* backend, const char* doi)
+{
+	if(!g_strv_contains(backend->known, doi))
+		return NULL;
+	DocumentMeta* meta = document_meta_new();
+	meta->doi = g_strdup(doi);
+	meta->backendId = backend->id;
+	return meta;
+}
+
+static RequestReturn* fill_meta(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page, void* user_data)
+{
+	(void)maxCount;
+	(void)sortMode;
+	(void)page;
+
+	struct FakeBackend* backend = user_data;
+	g_mutex_lock(&backend->lock);
+	g_string_append_printf(backend->asked, "%s ", meta->doi);
+	g_mutex_unlock(&backend->lock);
+
+	DocumentMeta* found = fake_lookup(backend, meta->doi);
+	if(!found)
+		return NULL;
+	RequestReturn* ret = request_return_new(1, 1);
+	ret->documents[0] = found;
+	ret->totalCount = 1;
+	return ret;
+}
+
+static void find_by_dois(const char** dois, size_t count, DocumentMeta** results, bool* answered, void* user_data)
+{
+	struct FakeBackend* backend = user_data;
+	g_mutex_lock(&backend->lock);
+	for(size_t i = 0; i < count; ++i)
+		g_string_append_printf(backend->batches, i ? " %s" : "%s", dois[i]);
+	g_string_append_c(backend->batches, '\n');
+	g_mutex_unlock(&backend->lock);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		results[i] = fake_lookup(backend, dois[i]);
+		answered[i] = strcmp(dois[i], "10.1/d") != 0;
+	}
+}
+
+static void setup(void)
+{
+	g_assert_true(sci_paper_init(NULL, config, sizeof(config) - 1));
+	batch.id = sci_plugin_register(&batchInfo, fill_meta, NULL, NULL, &batch);
+	sci_plugin_register_find_by_dois(batch.id, find_by_dois);
+	single.id = sci_plugin_register(&singleInfo, fill_meta, NULL, NULL, &single);
+	batch.asked = g_string_new(NULL);
+	batch.batches = g_string_new(NULL);
+	single.asked = g_string_new(NULL);
+	single.batches = g_string_new(NULL);
+}
+
+static void teardown(void)
+{
+	sci_plugin_unregister(batch.id);
+	sci_plugin_unregister(single.id);
+	sci_paper_exit();
+	g_string_free(batch.asked, true);
+	g_string_free(batch.batches, true);
+	g_string_free(single.asked, true);
+	g_string_free(single.batches, true);
+}
+
+static void check_results(DocumentMeta** results)
+{
+	g_assert_nonnull(results[0]);
+	g_assert_cmpstr(results[0]->doi, ==, "10.1/a");
+	g_assert_cmpint(results[0]->backendId, ==, batch.id);
+	g_assert_nonnull(results[1]);
+	g_assert_cmpstr(results[1]->doi, ==, "10.1/b");
+	g_assert_cmpint(results[1]->backendId, ==, batch.id);
+	g_assert_null(results[2]);
+	g_assert_nonnull(results[3]);
+	g_assert_cmpstr(results[3]->doi, ==, "10.1/d");
+	g_assert_cmpint(results[3]->backendId, ==, single.id);
+}
+
+static void test_fallback(void)
+{
+	setup();
+	const char* dois[] = {"10.1/a", "10.1/b", "10.1/c", "10.1/d"};
+	DocumentMeta** results = sci_find_by_dois(dois, G_N_ELEMENTS(dois), 0);
+	check_results(results);
+
+	g_assert_cmpstr(batch.batches->str, ==, "10.1/a 10.1/b 10.1/c 10.1/d\n");
+	// c was answered by batch and is only asked of single, d got no answer and is asked of both
+	g_assert_null(strstr(batch.asked->str, "10.1/a"));
+	g_assert_null(strstr(batch.asked->str, "10.1/b"));
+	g_assert_null(strstr(batch.asked->str, "10.1/c"));
+	g_assert_null(strstr(single.asked->str, "10.1/a"));
+	g_assert_null(strstr(single.asked->str, "10.1/b"));
+	g_assert_nonnull(strstr(single.asked->str, "10.1/c"));
+	g_assert_nonnull(strstr(single.asked->str, "10.1/d"));
+
+	document_meta_free_list(results, G_N_ELEMENTS(dois));
+	teardown();
+}
+
+// documents found before are answered from the cache, only the rest is handed to the batch lookup
+static void test_cached(void)
+{
+	setup();
+	const char* dois[] = {"10.1/a", "10.1/b", "10.1/c", "10.1/d"};
+	DocumentMeta** results = sci_find_by_dois(dois, G_N_ELEMENTS(dois), 0);
+	document_meta_free_list(results, G_N_ELEMENTS(dois));
+	g_string_truncate(batch.batches, 0);
+	g_string_truncate(batch.asked, 0);
+	g_string_truncate(single.asked, 0);
+
+	results = sci_find_by_dois(dois, G_N_ELEMENTS(dois), 0);
+	check_results(results);
+	g_assert_cmpstr(batch.batches->str, ==, "10.1/c\n");
+	g_assert_null(strstr(single.asked->str, "10.1/d"));
+
+	document_meta_free_list(results, G_N_ELEMENTS(dois));
+	teardown();
+}
+
+// with a backend given only it is asked, one by one for what its batch lookup did not find
+static void test_backend_id(void)
+{
+	setup();
+	const char* dois[] = {"10.1/a", "10.1/d"};
+	DocumentMeta** results = sci_find_by_dois(dois, G_N_ELEMENTS(dois), batch.id);
+	g_assert_nonnull(results[0]);
+	g_assert_null(results[1]);
+	g_assert_cmpstr(batch.asked->str, ==, "10.1/d ");
+	g_assert_cmpstr(single.asked->str, ==, "");
+
+	document_meta_free_list(results, G_N_ELEMENTS(dois));
+	teardown();
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_mutex_init(&batch.lock);
+	g_mutex_init(&single.lock);
+	g_test_add_func("/find-by-dois/fallback", test_fallback);
+	g_test_add_func("/find-by-dois/cached", test_cached);
+	g_test_add_func("/find-by-dois/backend-id", test_backend_id);
+	return g_test_run();
+}
@@ -0,0 +1,190 @@
+/*
+ * json-writer.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * json-writer.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * json-writer.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+// writes value once to a counting writer and once to a buffer writer, the lengths have to agree
+static char* escape(const char* value)
+{
+	JsonWriter writer;
+	json_writer_init_count(&writer);
+	json_writer_append_escaped(&writer, value);
+	size_t length = writer.length;
+
+	char* buffer = g_malloc(length + 1);
+	json_writer_init_buffer(&writer, buffer);
+	json_writer_append_escaped(&writer, value);
+	g_assert_cmpuint(writer.length, ==, length);
+	g_assert_cmpuint(strlen(buffer), ==, length);
+	return buffer;
+}
+
+// byte at a time escaper the vectorized one is checked against, invalid UTF-8 is only handled for single bytes here
+static char* escape_reference(const char* value)
+{
+	GString* out = g_string_new(NULL);
+	for(const unsigned char* p = (const unsigned char*)value; *p; ++p)
+	{
+		switch(*p)
+		{
+			case '"':
+				g_string_append(out, "\\\"");
+				break;
+			case '\\':
+				g_string_append(out, "\\\\");
+				break;
+			case '\b':
+				g_string_append(out, "\\b");
+				break;
+			case '\f':
+				g_string_append(out, "\\f");
+				break;
+			case '\n':
+				g_string_append(out, "\\n");
+				break;
+			case '\r':
+				g_string_append(out, "\\r");
+				break;
+			case '\t':
+				g_string_append(out, "\\t");
+				break;
+			default:
+				if(*p < ' ')
+					g_string_append_printf(out, "\\u%04x", *p);
+				else if(*p >= 0x80)
+					g_string_append(out, "\\ufffd");
+				else
+					g_string_append_c(out, *p);
+				break;
+		}
+	}
+	return g_string_free(out, false);
+}
+
+static void check_escape(const char* value, const char* expected)
+{
+	char* escaped = escape(value);
+	g_assert_cmpstr(escaped, ==, expected);
+	g_free(escaped);
+}
+
+static void test_escape_basic(void)
+{
+	check_escape("", "");
+	check_escape("plain text", "plain text");
+	check_escape("say \"hi\"", "say \\\"hi\\\"");
+	check_escape("C:\\dir", "C:\\\\dir");
+	check_escape("a\nb\tc\rd\be\ff", "a\\nb\\tc\\rd\\be\\ff");
+	check_escape("\x01\x1f", "\\u0001\\u001f");
+	check_escape("/<>{}", "/<>{}");
+}
+
+static void test_escape_utf8(void)
+{
+	check_escape("Schr\xc3\xb6" "dinger", "Schr\xc3\xb6" "dinger");
+	check_escape("\xe2\x82\xac 10", "\xe2\x82\xac 10");
+	check_escape("\xf0\x9f\x93\x84", "\xf0\x9f\x93\x84");
+	// a stray continuation byte, a truncated sequence, an overlong encoding and an encoded surrogate
+	check_escape("a\x80z", "a\\ufffdz");
+	check_escape("a\xc3", "a\\ufffd");
+	check_escape("\xc0\xaf", "\\ufffd\\ufffd");
+	check_escape("\xed\xa0\x80", "\\ufffd\\ufffd\\ufffd");
+	check_escape("\xff", "\\ufffd");
+}
+
+// every special character at every position of a string long enough to span several 16 byte blocks
+static void test_escape_boundaries(void)
+{
+	const char specials[] = "\"\\\n\x01\x7f\xff";
+	char value[50];
+	for(size_t s = 0; s < sizeof(specials) - 1; ++s)
+	{
+		for(size_t position = 0; position < sizeof(value) - 1; ++position)
+		{
+			memset(value, 'x', sizeof(value) - 1);
+			value[sizeof(value) - 1] = '\0';
+			value[position] = specials[s];
+
+			char* escaped = escape(value);
+			char* expected = escape_reference(value);
+			g_assert_cmpstr(escaped, ==, expected);
+			g_free(escaped);
+			g_free(expected);
+		}
+	}
+
+	// multi byte sequences straddling a block boundary have to survive unchanged
+	for(size_t position = 10; position < 20; ++position)
+	{
+		memset(value, 'x', sizeof(value) - 1);
+		value[sizeof(value) - 1] = '\0';
+		memcpy(value + position, "\xe2\x82\xac", 3);
+		check_escape(value, value);
+	}
+}
+
+static void test_entry(void)
+{
+	GString* entry = createJsonEntry(2, "title", "a \"b\"", true, true);
+	g_assert_cmpstr(entry->str, ==, "\t\t\"title\": \"a \\\"b\\\"\",\n");
+	g_assert_cmpuint(entry->len, ==, strlen(entry->str));
+	g_string_free(entry, true);
+
+	entry = createJsonEntry(0, "year", "2023", false, false);
+	g_assert_cmpstr(entry->str, ==, "\"year\": 2023");
+	g_string_free(entry, true);
+
+	entry = createJsonEntry(0, "missing", NULL, true, true);
+	g_assert_cmpuint(entry->len, ==, 0);
+	g_string_free(entry, true);
+}
+
+static void test_file(void)
+{
+	char* data = NULL;
+	size_t size = 0;
+	FILE* file = open_memstream(&data, &size);
+	g_assert_nonnull(file);
+
+	JsonWriter writer;
+	json_writer_init_file(&writer, file);
+	json_writer_append_entry(&writer, 1, "doi", "10.1000/\"x\"", true, false);
+	fclose(file);
+
+	g_assert_false(writer.error);
+	g_assert_cmpuint(writer.length, ==, size);
+	g_assert_cmpstr(data, ==, "\t\"doi\": \"10.1000/\\\"x\\\"\"");
+	free(data);
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/json-writer/escape/basic", test_escape_basic);
+	g_test_add_func("/json-writer/escape/utf8", test_escape_utf8);
+	g_test_add_func("/json-writer/escape/boundaries", test_escape_boundaries);
+	g_test_add_func("/json-writer/entry", test_entry);
+	g_test_add_func("/json-writer/file", test_file);
+	return g_test_run();
+}
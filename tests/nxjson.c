@@ -0,0 +1,255 @@
+/*
+ * nxjson.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * nxjson.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxjson.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nxjson.h"
+
+static const char streamText[] =
+	"{\"status\": \"ok\", \"message\": {\"total\": 3, \"items\": ["
+	"{\"title\": \"first\", \"n\": 1, \"skip\": {\"deep\": [1, 2, {\"x\": \"}]\"}]}},"
+	"{\"title\": \"sec\\u00f6nd\", \"n\": 2, \"skip\": null},"
+	"{\"title\": \"third\", \"n\": 3, \"skip\": [\"a\", \"b\"]}"
+	"], \"after\": true}}";
+
+struct StreamItems
+{
+	GString* titles;
+	long long sum;
+	int count;
+	bool sawSkip;
+};
+
+static void stream_item(const nx_json* item, void* userData)
+{
+	struct StreamItems* items = userData;
+	g_string_append(items->titles, nx_json_get(item, "title")->text_value);
+	g_string_append_c(items->titles, ';');
+	items->sum += nx_json_get(item, "n")->int_value;
+	if(nx_json_get(item, "skip")->type != NX_JSON_NULL)
+		items->sawSkip = true;
+	++items->count;
+}
+
+static const nx_json* parse_stream(size_t chunkSize, const nx_json_projection* projection, struct StreamItems* items)
+{
+	nx_json_stream* stream = nx_json_stream_new("message.items", stream_item, items);
+	if(projection)
+		nx_json_stream_set_projection(stream, projection);
+
+	size_t length = strlen(streamText);
+	for(size_t offset = 0; offset < length; offset += chunkSize)
+	{
+		if(!nx_json_stream_feed(stream, streamText + offset, MIN(chunkSize, length - offset)))
+		{
+			nx_json_stream_free(stream);
+			return NULL;
+		}
+	}
+	return nx_json_stream_finish(stream);
+}
+
+static void test_stream_chunks(void)
+{
+	// every chunk size splits the text at different places, including inside strings and escapes
+	for(size_t chunkSize = 1; chunkSize <= 17; ++chunkSize)
+	{
+		struct StreamItems items = {.titles = g_string_new(NULL)};
+		const nx_json* json = parse_stream(chunkSize, NULL, &items);
+		g_assert_nonnull(json);
+		g_assert_cmpint(items.count, ==, 3);
+		g_assert_cmpint(items.sum, ==, 6);
+		g_assert_cmpstr(items.titles->str, ==, "first;sec\xc3\xb6nd;third;");
+		g_assert_cmpstr(nx_json_get(json, "status")->text_value, ==, "ok");
+		g_assert_cmpint(nx_json_get(nx_json_get(json, "message"), "total")->int_value, ==, 3);
+		g_assert_cmpint(nx_json_get(nx_json_get(json, "message"), "after")->type, ==, NX_JSON_BOOL);
+		g_assert_cmpint(nx_json_get(nx_json_get(json, "message"), "items")->length, ==, 0);
+		nx_json_free(json);
+		g_string_free(items.titles, true);
+	}
+}
+
+static void test_stream_incomplete(void)
+{
+	nx_json_stream* stream = nx_json_stream_new("message.items", NULL, NULL);
+	g_assert_true(nx_json_stream_feed(stream, streamText, strlen(streamText)/2));
+	g_assert_null(nx_json_stream_finish(stream));
+
+	stream = nx_json_stream_new("message.items", NULL, NULL);
+	g_assert_false(nx_json_stream_feed(stream, "{\"message\": {\"items\": [}", 25));
+	nx_json_stream_free(stream);
+}
+
+static void test_arena(void)
+{
+	// enough nodes and string data to span many arena blocks, including strings larger than a block
+	GString* text = g_string_new("[");
+	for(int i = 0; i < 20000; ++i)
+		g_string_append_printf(text, "%s{\"id\": %i, \"name\": \"item %i\"}", i ? "," : "", i, i);
+	g_string_append(text, ", \"");
+	for(int i = 0; i < 100000; ++i)
+		g_string_append_c(text, 'a' + i % 26);
+	g_string_append(text, "\"]");
+
+	const nx_json* json = nx_json_parse_utf8(text->str);
+	g_assert_nonnull(json);
+	g_assert_cmpint(json->length, ==, 20001);
+	for(int i = 0; i < 20000; i += 997)
+	{
+		const nx_json* item = nx_json_item(json, i);
+		char* name = g_strdup_printf("item %i", i);
+		g_assert_cmpint(nx_json_get(item, "id")->int_value, ==, i);
+		g_assert_cmpstr(nx_json_get(item, "name")->text_value, ==, name);
+		g_free(name);
+	}
+	g_assert_cmpuint(strlen(nx_json_item(json, 20000)->text_value), ==, 100000);
+	nx_json_free(json);
+	g_string_free(text, true);
+}
+
+static void test_index(void)
+{
+	GString* text = g_string_new("{\"array\": [");
+	for(int i = 0; i < 1000; ++i)
+		g_string_append_printf(text, "%s%i", i ? "," : "", i);
+	g_string_append(text, "]");
+	for(int i = 0; i < 300; ++i)
+		g_string_append_printf(text, ", \"key%i\": %i", i, i*2);
+	g_string_append(text, "}");
+
+	const nx_json* json = nx_json_parse_utf8(text->str);
+	g_assert_nonnull(json);
+
+	const nx_json* array = nx_json_get(json, "array");
+	g_assert_cmpint(array->length, ==, 1000);
+	for(int i = 0; i < 1000; ++i)
+		g_assert_cmpint(nx_json_item(array, i)->int_value, ==, i);
+	g_assert_cmpint(nx_json_item(array, 1000)->type, ==, NX_JSON_NULL);
+	g_assert_cmpint(nx_json_item(array, -1)->type, ==, NX_JSON_NULL);
+
+	for(int i = 299; i >= 0; --i)
+	{
+		char key[16];
+		snprintf(key, sizeof(key), "key%i", i);
+		g_assert_cmpint(nx_json_get(json, key)->int_value, ==, i*2);
+	}
+	g_assert_cmpint(nx_json_get(json, "key300")->type, ==, NX_JSON_NULL);
+	g_assert_cmpint(nx_json_get(json, "")->type, ==, NX_JSON_NULL);
+
+	nx_json_free(json);
+	g_string_free(text, true);
+}
+
+static void test_projection(void)
+{
+	char text[] = "{\"keep\": {\"a\": 1, \"b\": \"x\"}, \"drop\": {\"deep\": [1, {\"s\": \"\\\"}\"}]},"
+		" \"list\": [{\"x\": 1, \"y\": 2}, {\"x\": 3, \"y\": {\"z\": 4}}], \"scalar\": -1.5e3}";
+
+	nx_json_projection* projection = nx_json_projection_new();
+	nx_json_projection_add(projection, "keep");
+	nx_json_projection_add(projection, "list.x");
+
+	const nx_json* json = nx_json_parse_projected(text, projection, nx_json_unicode_to_utf8);
+	g_assert_nonnull(json);
+	g_assert_cmpint(nx_json_get(nx_json_get(json, "keep"), "a")->int_value, ==, 1);
+	g_assert_cmpstr(nx_json_get(nx_json_get(json, "keep"), "b")->text_value, ==, "x");
+	g_assert_cmpint(nx_json_get(json, "drop")->type, ==, NX_JSON_NULL);
+	g_assert_cmpint(nx_json_get(json, "scalar")->type, ==, NX_JSON_NULL);
+
+	const nx_json* list = nx_json_get(json, "list");
+	g_assert_cmpint(list->length, ==, 2);
+	g_assert_cmpint(nx_json_get(nx_json_item(list, 0), "x")->int_value, ==, 1);
+	g_assert_cmpint(nx_json_get(nx_json_item(list, 1), "x")->int_value, ==, 3);
+	g_assert_cmpint(nx_json_get(nx_json_item(list, 0), "y")->type, ==, NX_JSON_NULL);
+	g_assert_cmpint(nx_json_get(nx_json_item(list, 1), "y")->type, ==, NX_JSON_NULL);
+
+	nx_json_free(json);
+	nx_json_projection_free(projection);
+}
+
+static void test_projection_stream(void)
+{
+	nx_json_projection* projection = nx_json_projection_new();
+	nx_json_projection_add(projection, "status");
+	nx_json_projection_add(projection, "message.items.title");
+	nx_json_projection_add(projection, "message.items.n");
+
+	for(size_t chunkSize = 1; chunkSize <= 17; chunkSize += 4)
+	{
+		struct StreamItems items = {.titles = g_string_new(NULL)};
+		const nx_json* json = parse_stream(chunkSize, projection, &items);
+		g_assert_nonnull(json);
+		g_assert_cmpint(items.count, ==, 3);
+		g_assert_cmpint(items.sum, ==, 6);
+		g_assert_false(items.sawSkip);
+		g_assert_cmpstr(items.titles->str, ==, "first;sec\xc3\xb6nd;third;");
+		g_assert_cmpstr(nx_json_get(json, "status")->text_value, ==, "ok");
+		g_assert_cmpint(nx_json_get(nx_json_get(json, "message"), "total")->type, ==, NX_JSON_NULL);
+		nx_json_free(json);
+		g_string_free(items.titles, true);
+	}
+	nx_json_projection_free(projection);
+}
+
+static void test_projection_invalid(void)
+{
+	// skipped values are checked as far as needed to reject what the full parser rejects
+	const char* invalid[] = {
+		"{\"drop\": }",
+		"{\"keep\": 1, \"drop\": ]}",
+		"{\"drop\": nope, \"keep\": 1}",
+		"{\"drop\": {\"a\": 1}",
+		"{\"drop\": \"open}",
+	};
+
+	nx_json_projection* projection = nx_json_projection_new();
+	nx_json_projection_add(projection, "keep");
+	for(size_t i = 0; i < G_N_ELEMENTS(invalid); ++i)
+	{
+		char* text = g_strdup(invalid[i]);
+		g_assert_null(nx_json_parse_projected(text, projection, nx_json_unicode_to_utf8));
+		g_free(text);
+		text = g_strdup(invalid[i]);
+		g_assert_null(nx_json_parse_utf8(text));
+		g_free(text);
+
+		nx_json_stream* stream = nx_json_stream_new(NULL, NULL, NULL);
+		nx_json_stream_set_projection(stream, projection);
+		if(nx_json_stream_feed(stream, invalid[i], strlen(invalid[i])))
+			g_assert_null(nx_json_stream_finish(stream));
+		else
+			nx_json_stream_free(stream);
+	}
+	nx_json_projection_free(projection);
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/nxjson/stream/chunks", test_stream_chunks);
+	g_test_add_func("/nxjson/stream/incomplete", test_stream_incomplete);
+	g_test_add_func("/nxjson/arena", test_arena);
+	g_test_add_func("/nxjson/index", test_index);
+	g_test_add_func("/nxjson/projection", test_projection);
+	g_test_add_func("/nxjson/projection/stream", test_projection_stream);
+	g_test_add_func("/nxjson/projection/invalid", test_projection_invalid);
+	return g_test_run();
+}
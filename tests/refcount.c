@@ -0,0 +1,117 @@
+/*
+ * refcount.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * refcount.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * refcount.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "types.h"
+
+static void test_ref(void)
+{
+	DocumentMeta* meta = document_meta_new();
+	meta->doi = g_strdup("10.1000/1");
+	g_assert_cmpint(meta->refcount, ==, 1);
+
+	DocumentMeta* ref = document_meta_ref(meta);
+	g_assert_true(ref == meta);
+	g_assert_cmpint(meta->refcount, ==, 2);
+
+	document_meta_unref(meta);
+	g_assert_cmpint(ref->refcount, ==, 1);
+	g_assert_cmpstr(ref->doi, ==, "10.1000/1");
+	document_meta_unref(ref);
+}
+
+static void test_make_writable(void)
+{
+	DocumentMeta* meta = document_meta_new();
+	meta->title = g_strdup("shared");
+
+	// the only reference is handed back as is
+	DocumentMeta* writable = document_meta_make_writable(meta);
+	g_assert_true(writable == meta);
+
+	// a shared meta is copied and the callers reference to the original is dropped
+	DocumentMeta* ref = document_meta_ref(meta);
+	writable = document_meta_make_writable(ref);
+	g_assert_true(writable != meta);
+	g_assert_cmpint(meta->refcount, ==, 1);
+	g_assert_cmpint(writable->refcount, ==, 1);
+	g_assert_cmpstr(writable->title, ==, "shared");
+
+	g_free(writable->title);
+	writable->title = g_strdup("changed");
+	g_assert_cmpstr(meta->title, ==, "shared");
+
+	document_meta_unref(writable);
+	document_meta_unref(meta);
+}
+
+// structs not created by libscipaper have a refcount of 0, they are copied when referenced and never freed
+static void test_unowned(void)
+{
+	DocumentMeta meta = {0};
+	meta.doi = "10.1000/stack";
+	meta.references = -1;
+
+	DocumentMeta* ref = document_meta_ref(&meta);
+	g_assert_true(ref != &meta);
+	g_assert_cmpint(ref->refcount, ==, 1);
+	g_assert_cmpstr(ref->doi, ==, "10.1000/stack");
+
+	document_meta_free(&meta);
+	g_assert_cmpint(meta.refcount, ==, 0);
+	g_assert_cmpstr(meta.doi, ==, "10.1000/stack");
+	document_meta_unref(ref);
+}
+
+// a reference to a document keeps its arena alive after the RequestReturn owning the arena is freed
+static void test_outlive_request_return(void)
+{
+	SciArena* arena = sci_arena_new();
+	RequestReturn* ret = request_return_new_arena(2, 2, arena);
+	for(size_t i = 0; i < ret->count; ++i)
+	{
+		ret->documents[i] = document_meta_new_arena(arena);
+		ret->documents[i]->title = document_meta_strdup(ret->documents[i], i ? "second" : "first");
+	}
+
+	DocumentMeta* kept = document_meta_ref(ret->documents[1]);
+	request_return_free(ret);
+
+	g_assert_cmpstr(kept->title, ==, "second");
+	g_assert_cmpint(kept->refcount, ==, 1);
+
+	// a copy of an arena meta is allocated on its own
+	DocumentMeta* copy = document_meta_copy(kept);
+	g_assert_null(copy->arena);
+	document_meta_unref(kept);
+	g_assert_cmpstr(copy->title, ==, "second");
+	document_meta_unref(copy);
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/refcount/ref", test_ref);
+	g_test_add_func("/refcount/make-writable", test_make_writable);
+	g_test_add_func("/refcount/unowned", test_unowned);
+	g_test_add_func("/refcount/outlive-request-return", test_outlive_request_return);
+	return g_test_run();
+}
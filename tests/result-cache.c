@@ -0,0 +1,190 @@
+/*
+ * result-cache.c
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * result-cache.c is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * result-cache.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "scipaper.h"
+#include "sci-backend.h"
+
+static const char config[] =
+	"[Modules]\nModules=\n"
+	"[Cache]\nEnable=false\nMemoryEntries=2\n"
+	"[Dispatch]\nMode=serial\nAdaptiveOrder=false\n";
+
+static const BackendInfo backendInfo = {"cache-test", SCI_CAP_FILL};
+static int fillCalls;
+static int backendId;
+static size_t initialHits;
+static size_t initialMisses;
+
+// finds a document for every doi except ones starting with 10.0
+static RequestReturn* fill_meta(const DocumentMeta* meta, size_t maxCount, sorting_mode_t sortMode, size_t page, void* user_data)
+{
+	(void)maxCount;
+	(void)sortMode;
+	(void)page;
+	(void)user_data;
+
+	g_atomic_int_inc(&fillCalls);
+	if(!meta->doi || g_str_has_prefix(meta->doi, "10.0"))
+		return NULL;
+
+	RequestReturn* ret = request_return_new(1, 1);
+	ret->documents[0] = document_meta_new();
+	ret->documents[0]->doi = g_strdup(meta->doi);
+	ret->documents[0]->title = g_strconcat("Title of ", meta->doi, NULL);
+	ret->totalCount = 1;
+	return ret;
+}
+
+static void check_stats(size_t expectedHits, size_t expectedMisses, size_t expectedEntries)
+{
+	size_t hits, misses, entries;
+	sci_result_cache_get_stats(&hits, &misses, &entries);
+	g_assert_cmpuint(hits - initialHits, ==, expectedHits);
+	g_assert_cmpuint(misses - initialMisses, ==, expectedMisses);
+	g_assert_cmpuint(entries, ==, expectedEntries);
+}
+
+// the hit and miss counts are kept across sci_paper_init(), so the tests only look at what they added to them
+static void setup(void)
+{
+	g_assert_true(sci_paper_init(NULL, config, sizeof(config) - 1));
+	backendId = sci_plugin_register(&backendInfo, fill_meta, NULL, NULL, NULL);
+	fillCalls = 0;
+	sci_result_cache_get_stats(&initialHits, &initialMisses, NULL);
+}
+
+static void teardown(void)
+{
+	sci_plugin_unregister(backendId);
+	sci_paper_exit();
+}
+
+static DocumentMeta* lookup(const char* doi)
+{
+	return sci_find_by_doi(doi, 0);
+}
+
+static void test_hit(void)
+{
+	setup();
+	DocumentMeta* first = lookup("10.1000/1");
+	g_assert_nonnull(first);
+	g_assert_cmpint(fillCalls, ==, 1);
+	check_stats(0, 1, 1);
+
+	DocumentMeta* second = lookup("10.1000/1");
+	g_assert_nonnull(second);
+	g_assert_cmpint(fillCalls, ==, 1);
+	check_stats(1, 1, 1);
+
+	// the cache hands out references to the document it holds instead of copies
+	g_assert_true(first == second);
+	g_assert_cmpstr(second->title, ==, "Title of 10.1000/1");
+
+	// documents obtained from the cache have to be made writable before they may be modified
+	second = document_meta_make_writable(second);
+	g_assert_true(first != second);
+	g_free(second->title);
+	second->title = g_strdup("changed");
+	document_meta_unref(second);
+
+	document_meta_unref(first);
+	first = lookup("10.1000/1");
+	g_assert_cmpstr(first->title, ==, "Title of 10.1000/1");
+	document_meta_unref(first);
+	check_stats(2, 1, 1);
+	teardown();
+}
+
+// finding nothing is a valid answer that is kept just like a document
+static void test_negative(void)
+{
+	setup();
+	g_assert_null(lookup("10.0/missing"));
+	g_assert_null(lookup("10.0/missing"));
+	g_assert_cmpint(fillCalls, ==, 1);
+	check_stats(1, 1, 1);
+	teardown();
+}
+
+static void test_eviction(void)
+{
+	setup();
+	document_meta_unref(lookup("10.1000/a"));
+	document_meta_unref(lookup("10.1000/b"));
+	g_assert_cmpint(fillCalls, ==, 2);
+
+	// a is used again so b is the least recently used result and is dropped for c
+	document_meta_unref(lookup("10.1000/a"));
+	document_meta_unref(lookup("10.1000/c"));
+	g_assert_cmpint(fillCalls, ==, 3);
+	check_stats(1, 3, 2);
+
+	document_meta_unref(lookup("10.1000/a"));
+	g_assert_cmpint(fillCalls, ==, 3);
+	document_meta_unref(lookup("10.1000/b"));
+	g_assert_cmpint(fillCalls, ==, 4);
+	check_stats(2, 4, 2);
+	teardown();
+}
+
+static void test_requests_differ(void)
+{
+	setup();
+	DocumentMeta meta = {0};
+	meta.doi = "10.1000/1";
+	RequestReturn* ret = sci_fill_meta(&meta, NULL, 1, SCI_SORT_RELEVANCE, 0);
+	request_return_free(ret);
+	ret = sci_fill_meta(&meta, NULL, 1, SCI_SORT_RELEVANCE, 1);
+	request_return_free(ret);
+	ret = sci_fill_meta(&meta, NULL, 2, SCI_SORT_RELEVANCE, 0);
+	request_return_free(ret);
+	g_assert_cmpint(fillCalls, ==, 3);
+
+	ret = sci_fill_meta(&meta, NULL, 1, SCI_SORT_RELEVANCE, 1);
+	request_return_free(ret);
+	g_assert_cmpint(fillCalls, ==, 3);
+	teardown();
+}
+
+static void test_disabled(void)
+{
+	setup();
+	sci_result_cache_set_size(0);
+	check_stats(0, 0, 0);
+	document_meta_unref(lookup("10.1000/1"));
+	document_meta_unref(lookup("10.1000/1"));
+	g_assert_cmpint(fillCalls, ==, 2);
+	check_stats(0, 2, 0);
+	teardown();
+}
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/result-cache/hit", test_hit);
+	g_test_add_func("/result-cache/negative", test_negative);
+	g_test_add_func("/result-cache/eviction", test_eviction);
+	g_test_add_func("/result-cache/requests-differ", test_requests_differ);
+	g_test_add_func("/result-cache/disabled", test_disabled);
+	return g_test_run();
+}